@@ -0,0 +1,121 @@
+#include "average_colour.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+static_assert(sizeof(RGB) == 3, "pixels are read as a packed byte stream");
+
+namespace {
+
+// Pixels summed into 32 bit lanes before they are added to the totals, each lane takes at most
+// two 65535s per four pixels so this many can't overflow one
+constexpr size_t BlockPixels = 1 << 16;
+
+struct LinearTables {
+    // Linear light of each sRGB value
+    uint16_t single[256];
+    // Linear light of two adjacent bytes, the first in the low 32 bits, indexed by the two
+    // bytes loaded as one uint16_t. One lookup decodes two values, and photographs repeat
+    // neighbouring pairs enough that the 512KB table mostly stays in cache.
+    std::vector<uint64_t> pairs;
+
+    LinearTables() : pairs(65536) {
+        for (int v = 0; v < 256; v++)
+            single[v] = uint16_t(std::lround(DecodeSrgb(v / 255.0) * 65535));
+        for (uint32_t v = 0; v < 65536; v++) {
+            uint16_t index = uint16_t(v);
+            unsigned char bytes[2];
+            std::memcpy(bytes, &index, sizeof(bytes));
+            pairs[v] = uint64_t(single[bytes[0]]) | uint64_t(single[bytes[1]]) << 32;
+        }
+    }
+};
+
+const LinearTables& Tables() {
+    static const LinearTables tables;
+    return tables;
+}
+
+}
+
+double DecodeSrgb(double value) {
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+uint16_t SrgbToLinear(uint8_t value) {
+    return Tables().single[value];
+}
+
+uint8_t LinearToSrgb(double linear) {
+    linear = std::clamp(linear, 0.0, 1.0);
+    double encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+    return uint8_t(std::lround(std::clamp(encoded, 0.0, 1.0) * 255));
+}
+
+RGB AverageSrgb(const RGB* pixels, size_t count) {
+    RGB average;
+    if (count == 0)
+        return average;
+
+    uint64_t r = 0, g = 0, b = 0;
+    for (size_t i = 0; i < count; i++) {
+        r += pixels[i].r;
+        g += pixels[i].g;
+        b += pixels[i].b;
+    }
+
+    average.r = uint8_t(r / count);
+    average.g = uint8_t(g / count);
+    average.b = uint8_t(b / count);
+    return average;
+}
+
+RGB AverageLinear(const RGB* pixels, size_t count) {
+    RGB average;
+    if (count == 0)
+        return average;
+
+    const LinearTables& tables = Tables();
+    const uint64_t* pairs = tables.pairs.data();
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(pixels);
+    auto pair = [&](size_t offset) {
+        uint16_t index;
+        std::memcpy(&index, bytes + offset, sizeof(index));
+        return pairs[index];
+    };
+
+    // Four pixels are twelve bytes, six pairs: rg br gb rg br gb. Each accumulator holds two
+    // channels, one per 32 bit lane.
+    uint64_t r = 0, g = 0, b = 0;
+    size_t i = 0;
+    size_t whole = count & ~size_t(3);
+    while (i < whole) {
+        size_t end = std::min(whole, i + BlockPixels);
+        uint64_t rg = 0, br = 0, gb = 0;
+        for (; i < end; i += 4) {
+            size_t offset = i * 3;
+            rg += pair(offset);
+            br += pair(offset + 2);
+            gb += pair(offset + 4);
+            rg += pair(offset + 6);
+            br += pair(offset + 8);
+            gb += pair(offset + 10);
+        }
+        r += (rg & UINT32_MAX) + (br >> 32);
+        g += (rg >> 32) + (gb & UINT32_MAX);
+        b += (br & UINT32_MAX) + (gb >> 32);
+    }
+    for (; i < count; i++) {
+        r += tables.single[pixels[i].r];
+        g += tables.single[pixels[i].g];
+        b += tables.single[pixels[i].b];
+    }
+
+    double scale = 1.0 / (double(count) * 65535);
+    average.r = LinearToSrgb(r * scale);
+    average.g = LinearToSrgb(g * scale);
+    average.b = LinearToSrgb(b * scale);
+    return average;
+}
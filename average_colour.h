@@ -0,0 +1,28 @@
+#pragma once
+
+#include "image.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Mean colour of decoded pixels
+//
+// Summing sRGB values as stored weights the mean toward dark tones, sRGB spends more of its
+// range on them than light does. Linear light decodes every value through a lookup table
+// before summing and encodes the mean back to sRGB, so a half black, half white image
+// averages to a light grey rather than 128.
+
+// Mean of the stored values, an empty range gives black
+RGB AverageSrgb(const RGB* pixels, size_t count);
+
+// Mean in linear light, an empty range gives black
+RGB AverageLinear(const RGB* pixels, size_t count);
+
+// An sRGB value from 0 to 1 as linear light from 0 to 1
+double DecodeSrgb(double value);
+
+// An sRGB value as linear light from 0 to 65535, the table AverageLinear sums
+uint16_t SrgbToLinear(uint8_t value);
+
+// Linear light from 0 to 1 as the nearest sRGB value
+uint8_t LinearToSrgb(double linear);
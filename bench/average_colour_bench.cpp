@@ -0,0 +1,117 @@
+// Average colour of a 24 megapixel image, as stored and in linear light
+// Linear light should cost under 20% more than the plain sum on photographic content, uniform
+// noise is the worst case for its lookup table and is shown for reference
+// Build the average_colour_bench target and run it from a Release build
+
+#include "../average_colour.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+constexpr int Width = 6000;
+constexpr int Height = 4000;
+constexpr double MaxOverhead = 0.20;
+
+template <typename F>
+double BestOfMs(int runs, F run) {
+    double best = 1e300;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Smooth shading with a little sensor noise, neighbouring pixels close but not equal
+std::vector<RGB> Photographic() {
+    std::vector<RGB> pixels(size_t(Width) * Height);
+    uint32_t state = 12345;
+    for (int y = 0; y < Height; y++) {
+        for (int x = 0; x < Width; x++) {
+            state = state * 1664525u + 1013904223u;
+            int noise = int(state >> 29) - 4;
+            double u = x / double(Width), v = y / double(Height);
+            RGB& c = pixels[size_t(y) * Width + x];
+            c.r = uint8_t(std::clamp(int(120 + 100 * std::sin(3 * u + 1) * v) + noise, 0, 255));
+            c.g = uint8_t(std::clamp(int(110 + 90 * std::cos(4 * v + u)) + noise, 0, 255));
+            c.b = uint8_t(std::clamp(int(60 + 180 * u * (1 - v)) + noise, 0, 255));
+        }
+    }
+    return pixels;
+}
+
+std::vector<RGB> Noise() {
+    std::vector<RGB> pixels(size_t(Width) * Height);
+    uint32_t state = 12345;
+    for (RGB& c : pixels) {
+        state = state * 1664525u + 1013904223u;
+        c.r = uint8_t(state >> 24);
+        c.g = uint8_t(state >> 16);
+        c.b = uint8_t(state >> 8);
+    }
+    return pixels;
+}
+
+// Linear light mean with the transfer function evaluated per value in double precision
+RGB ReferenceLinear(const std::vector<RGB>& pixels) {
+    double decode[256];
+    for (int v = 0; v < 256; v++) {
+        double x = v / 255.0;
+        decode[v] = x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+    }
+    double r = 0, g = 0, b = 0;
+    for (const RGB& c : pixels) {
+        r += decode[c.r];
+        g += decode[c.g];
+        b += decode[c.b];
+    }
+    RGB average;
+    average.r = LinearToSrgb(r / pixels.size());
+    average.g = LinearToSrgb(g / pixels.size());
+    average.b = LinearToSrgb(b / pixels.size());
+    return average;
+}
+
+int MaxDifference(RGB a, RGB b) {
+    return std::max({ std::abs(a.r - b.r), std::abs(a.g - b.g), std::abs(a.b - b.b) });
+}
+
+}
+
+int main() {
+    struct Case {
+        const char* name;
+        std::vector<RGB> pixels;
+        bool target;
+    } cases[] = { { "photo", Photographic(), true }, { "noise", Noise(), false } };
+
+    bool passed = true;
+    std::printf("%-6s %10s %10s %9s %12s %12s %9s\n", "pixels", "sRGB sum", "linear", "overhead", "sRGB mean", "linear mean", "max diff");
+    for (auto& test : cases) {
+        const RGB* pixels = test.pixels.data();
+        size_t count = test.pixels.size();
+        RGB srgb, linear;
+        double srgbMs = BestOfMs(7, [&] { srgb = AverageSrgb(pixels, count); });
+        double linearMs = BestOfMs(7, [&] { linear = AverageLinear(pixels, count); });
+        double overhead = linearMs / srgbMs - 1;
+        int diff = MaxDifference(linear, ReferenceLinear(test.pixels));
+
+        char srgbText[16], linearText[16];
+        std::snprintf(srgbText, sizeof(srgbText), "%d,%d,%d", srgb.r, srgb.g, srgb.b);
+        std::snprintf(linearText, sizeof(linearText), "%d,%d,%d", linear.r, linear.g, linear.b);
+        std::printf("%-6s %8.1fms %8.1fms %8.0f%% %12s %12s %9d\n", test.name, srgbMs, linearMs, overhead * 100, srgbText, linearText, diff);
+
+        passed = passed && diff <= 1 && (!test.target || overhead < MaxOverhead);
+    }
+
+    std::printf("%s: linear light within %.0f%% of the plain sum on photographic content\n", passed ? "PASS" : "FAIL", MaxOverhead * 100);
+    return passed ? 0 : 1;
+}
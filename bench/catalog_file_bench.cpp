@@ -0,0 +1,101 @@
+// Saving a 1M image catalog and opening it again, the cost of startup before browsing can begin
+// Usage: catalog_file_bench [file], default catalog_bench.bin
+// Build the catalog_file_bench target and run it from a Release build
+
+#include "../catalog.h"
+#include "../catalog_file.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int DirectoryCount = 1000;
+constexpr int FilesPerDirectory = 1000;
+// Positions read after opening, about a screen of thumbnails
+constexpr uint64_t FirstPage = 100;
+constexpr size_t LookupCount = 100000;
+
+template <typename F>
+double TimeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string SyntheticPath(size_t i) {
+    char path[64];
+    std::snprintf(path, sizeof(path), "/photos/%04d/IMG_%07zu.JPG", int(i % DirectoryCount), i);
+    return path;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string fileName = argc > 1 ? argv[1] : "catalog_bench.bin";
+    const size_t count = size_t(DirectoryCount) * FilesPerDirectory;
+
+    Catalog catalog;
+    uint32_t state = 12345;
+    for (size_t i = 0; i < count; i++) {
+        Image img;
+        img.SetFileName(SyntheticPath(i));
+        img.fileSize = 1000 + i;
+        img.modifiedTime = int64_t(i);
+        state = state * 1664525u + 1013904223u;
+        img.averageRgb.r = uint8_t(state >> 24);
+        img.averageRgb.g = uint8_t(state >> 16);
+        img.averageRgb.b = uint8_t(state >> 8);
+        RgbToHsl(img.averageRgb, img.hsl);
+        catalog.Add(img);
+    }
+
+    std::vector<Image> records;
+    std::array<std::vector<uint32_t>, SortKeyCount> orders;
+    double exportMs = TimeMs([&] { catalog.Export(records, orders); });
+    bool saved = false;
+    double saveMs = TimeMs([&] { saved = SaveCatalog(fileName, records, orders); });
+
+    SavedCatalog file;
+    bool opened = false;
+    double openMs = TimeMs([&] { opened = file.Open(fileName); });
+
+    // What the viewer does first: the paths at the start of the order
+    size_t pathBytes = 0;
+    double pageMs = TimeMs([&] {
+        for (uint64_t i = 0; i < FirstPage && i < file.Size(); i++)
+            pathBytes += file.Path(file.At(SortKey::Hue, i)).size();
+    });
+
+    // What the pipeline does for each file it finds: unchanged ones are skipped, changed ones aren't
+    size_t hits = 0, stale = 0;
+    double lookupMs = TimeMs([&] {
+        for (size_t n = 0; n < LookupCount; n++) {
+            size_t i = n * (count / LookupCount);
+            Image img;
+            img.SetFileName(SyntheticPath(i));
+            img.fileSize = 1000 + i;
+            img.modifiedTime = int64_t(i) + (n % 10 == 0);
+            if (file.Lookup(img))
+                hits++;
+            else
+                stale++;
+        }
+    });
+
+    // Saved orders match the live catalog's
+    size_t mismatches = 0;
+    std::vector<Image> live = catalog.Snapshot();
+    for (size_t i = 0; i < live.size() && i < file.Size(); i++)
+        mismatches += live[i].FileName() != file.Path(file.At(SortKey::Hue, i));
+
+    std::printf("%zu images, export %.0fms, save %.0fms (%s)\n", count, exportMs, saveMs, saved ? "ok" : "FAILED");
+    std::printf("open %.3fms (%s), first %llu paths %.3fms\n", openMs, opened ? "ok" : "FAILED", (unsigned long long)FirstPage, pageMs);
+    std::printf("lookup %.0fns each, %zu unchanged, %zu stale\n", lookupMs * 1e6 / LookupCount, hits, stale);
+    std::printf("%zu order mismatches against the live catalog\n", mismatches);
+
+    return saved && opened && mismatches == 0 && stale == LookupCount / 10 ? 0 : 1;
+}
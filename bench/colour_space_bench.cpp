@@ -0,0 +1,108 @@
+// Converting a 1M image catalog's average colours to Oklab and CIELAB
+// Batch conversion against a per-colour reference in double precision, for speed and accuracy
+// Build the colour_space_bench target and run it from a Release build
+
+#include "../colour_space.h"
+#include "../average_colour.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr size_t ColourCount = 1000000;
+// Hue differences only count where the hue means something
+constexpr double MinimumChroma[] = { 0.01, 1 };
+
+template <typename F>
+double BestOfMs(int runs, F run) {
+    double best = 1e300;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+struct Reference {
+    double l, a, b, chroma, hue;
+};
+
+Reference ReferenceOklab(const RGB& c) {
+    double r = DecodeSrgb(c.r / 255.0), g = DecodeSrgb(c.g / 255.0), b = DecodeSrgb(c.b / 255.0);
+    double l = std::cbrt(0.4122214708 * r + 0.5363325363 * g + 0.0514459929 * b);
+    double m = std::cbrt(0.2119034982 * r + 0.6806995451 * g + 0.1073969566 * b);
+    double s = std::cbrt(0.0883024619 * r + 0.2817188376 * g + 0.6299787005 * b);
+
+    Reference out;
+    out.l = 0.2104542553 * l + 0.7936177850 * m - 0.0040720468 * s;
+    out.a = 1.9779984951 * l - 2.4285922050 * m + 0.4505937099 * s;
+    out.b = 0.0259040371 * l + 0.7827717662 * m - 0.8086757660 * s;
+    return out;
+}
+
+Reference ReferenceCielab(const RGB& c) {
+    double r = DecodeSrgb(c.r / 255.0), g = DecodeSrgb(c.g / 255.0), b = DecodeSrgb(c.b / 255.0);
+    auto f = [](double t) { return t > 216.0 / 24389 ? std::cbrt(t) : (24389.0 / 27 * t + 16) / 116; };
+    double fx = f((0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / 0.95047);
+    double fy = f(0.2126729 * r + 0.7151522 * g + 0.0721750 * b);
+    double fz = f((0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / 1.08883);
+
+    Reference out;
+    out.l = 116 * fy - 16;
+    out.a = 500 * (fx - fy);
+    out.b = 200 * (fy - fz);
+    return out;
+}
+
+}
+
+int main() {
+    std::vector<RGB> colours(ColourCount);
+    uint32_t state = 12345;
+    for (RGB& c : colours) {
+        state = state * 1664525u + 1013904223u;
+        c.r = uint8_t(state >> 24);
+        c.g = uint8_t(state >> 16);
+        c.b = uint8_t(state >> 8);
+    }
+
+    const char* names[] = { "oklab", "cielab" };
+    std::printf("%-7s %10s %10s %10s %10s %10s %10s\n", "space", "batch", "reference", "max dL", "max da,db", "max dC", "max dhue");
+    for (int s = 0; s < 2; s++) {
+        ColourSpace space = ColourSpace(s);
+        LabColumns lab;
+        double batchMs = BestOfMs(5, [&] { ConvertColours(space, colours.data(), colours.size(), lab); });
+
+        std::vector<Reference> reference(colours.size());
+        double referenceMs = BestOfMs(5, [&] {
+            for (size_t i = 0; i < colours.size(); i++) {
+                Reference& ref = reference[i];
+                ref = space == ColourSpace::Oklab ? ReferenceOklab(colours[i]) : ReferenceCielab(colours[i]);
+                ref.chroma = std::hypot(ref.a, ref.b);
+                ref.hue = std::atan2(ref.b, ref.a) * 180 / 3.14159265358979323846;
+                if (ref.hue < 0)
+                    ref.hue += 360;
+            }
+        });
+
+        double dl = 0, dab = 0, dc = 0, dh = 0;
+        for (size_t i = 0; i < colours.size(); i++) {
+            const Reference& ref = reference[i];
+            dl = std::max(dl, std::abs(lab.l[i] - ref.l));
+            dab = std::max({ dab, std::abs(lab.a[i] - ref.a), std::abs(lab.b[i] - ref.b) });
+            dc = std::max(dc, std::abs(lab.chroma[i] - ref.chroma));
+            if (ref.chroma >= MinimumChroma[s]) {
+                double d = std::abs(lab.hue[i] - ref.hue);
+                dh = std::max(dh, std::min(d, 360 - d));
+            }
+        }
+        std::printf("%-7s %8.1fms %8.1fms %10.2g %10.2g %10.2g %10.2g\n", names[s], batchMs, referenceMs, dl, dab, dc, dh);
+    }
+    return 0;
+}
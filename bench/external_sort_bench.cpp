@@ -0,0 +1,82 @@
+// External sort of a synthetic catalog through a small memory limit
+// Usage: external_sort_bench [folder] [images] [memory MB], defaults ext_sort_bench 10000000 32
+// Build the external_sort_bench target and run it from a Release build
+
+#include "../external_sort.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+namespace {
+
+template <typename F>
+double TimeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident memory of the process, 0 where it can't be read
+size_t PeakResidentBytes() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return size_t(std::strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+    }
+#endif
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string folder = argc > 1 ? argv[1] : "ext_sort_bench";
+    uint64_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000;
+    size_t memoryBytes = size_t(argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 32) * 1024 * 1024;
+
+    ExternalSorter sorter;
+    if (!sorter.Open(folder, memoryBytes)) {
+        std::printf("Couldn't open %s\n", folder.c_str());
+        return 1;
+    }
+
+    uint32_t state = 12345;
+    double addMs = TimeMs([&] {
+        char path[64];
+        for (uint64_t i = 0; i < count; i++) {
+            std::snprintf(path, sizeof(path), "/archive/%05u/IMG_%09llu.JPG", unsigned(i % 50000), (unsigned long long)i);
+            state = state * 1664525u + 1013904223u;
+            sorter.Add(state & 0xffffff00u, path);
+        }
+    });
+
+    bool finished = false;
+    double mergeMs = TimeMs([&] { finished = sorter.Finish(); });
+    auto stats = sorter.GetStats();
+    // Before the order is mapped, paging through it counts its pages as resident too
+    size_t peakBytes = PeakResidentBytes();
+
+    SortedOrder order;
+    uint64_t misordered = 0;
+    double checkMs = TimeMs([&] {
+        if (!order.Open(folder))
+            return;
+        for (uint64_t i = 1; i < order.Size(); i++)
+            misordered += order.Key(i - 1) > order.Key(i);
+    });
+
+    std::printf("%llu images, %zuMB limit: %d runs, %.0fMB of paths\n", (unsigned long long)count, memoryBytes >> 20, stats.runs,
+                stats.pathBytes / 1048576.0);
+    std::printf("add and spill %.0fms, merge %.0fms, check %.0fms\n", addMs, mergeMs, checkMs);
+    std::printf("peak resident while sorting %.0fMB\n", peakBytes / 1048576.0);
+    std::printf("order %s, %llu entries, %llu misordered, first %s\n", finished ? "written" : "FAILED",
+                (unsigned long long)order.Size(), (unsigned long long)misordered, order.Path(0).c_str());
+
+    return finished && order.Size() == count && misordered == 0 ? 0 : 1;
+}
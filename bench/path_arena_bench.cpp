@@ -0,0 +1,123 @@
+// Memory and copy cost of interned paths against one std::string per image
+// Builds a synthetic 5M file library, 5000 directories of 1000 camera-named files
+// Build the path_arena_bench target and run it from a Release build
+
+#include "../path_arena.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int DirectoryCount = 5000;
+constexpr int FilesPerDirectory = 1000;
+
+std::string SyntheticPath(int directory, int file) {
+    char path[128];
+    std::snprintf(path, sizeof(path), "/mnt/library/photos/%d/%02d/event_%03d/IMG_%06d.JPG",
+                  2000 + directory / 200, 1 + directory / 17 % 12, directory % 17, directory * FilesPerDirectory + file);
+    return path;
+}
+
+// Resident memory of the process, 0 where it can't be read
+size_t ResidentBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * 4096;
+#else
+    return 0;
+#endif
+}
+
+size_t StringBytes(const std::string& s) {
+    // Short strings live inside the object, longer ones add their heap block
+    const char* object = reinterpret_cast<const char*>(&s);
+    bool onHeap = s.data() < object || s.data() >= object + sizeof(std::string);
+    return sizeof(std::string) + (onHeap ? s.capacity() + 1 : 0);
+}
+
+template <typename F>
+double TimeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main() {
+    const size_t count = size_t(DirectoryCount) * FilesPerDirectory;
+
+    // Visit files in a shuffled order so neither layout benefits from insertion order when sorting
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    uint32_t state = 12345;
+    for (size_t i = count - 1; i > 0; i--) {
+        state = state * 1664525u + 1013904223u;
+        std::swap(order[i], order[state % (i + 1)]);
+    }
+
+    size_t before = ResidentBytes();
+    std::vector<std::string> strings;
+    double stringBuildMs = TimeMs([&] {
+        strings.reserve(count);
+        for (uint32_t i : order)
+            strings.push_back(SyntheticPath(int(i / FilesPerDirectory), int(i % FilesPerDirectory)));
+    });
+    size_t stringResident = ResidentBytes() - before;
+    size_t stringBytes = 0;
+    for (auto& s : strings)
+        stringBytes += StringBytes(s);
+
+    before = ResidentBytes();
+    PathArena arena;
+    std::vector<PathId> ids;
+    double internMs = TimeMs([&] {
+        ids.reserve(count);
+        for (uint32_t i : order)
+            ids.push_back(arena.Intern(SyntheticPath(int(i / FilesPerDirectory), int(i % FilesPerDirectory))));
+    });
+    size_t idResident = ResidentBytes() - before;
+    auto stats = arena.GetStats();
+    size_t idBytes = stats.bytes + ids.size() * sizeof(PathId);
+
+    // A catalog snapshot copies every path
+    std::vector<std::string> stringCopy;
+    std::vector<PathId> idCopy;
+    double stringCopyMs = TimeMs([&] { stringCopy = strings; });
+    double idCopyMs = TimeMs([&] { idCopy = ids; });
+
+    double stringSortMs = TimeMs([&] { std::sort(stringCopy.begin(), stringCopy.end()); });
+    double idSortMs = TimeMs([&] { std::sort(idCopy.begin(), idCopy.end(), [&](PathId a, PathId b) { return arena.Compare(a, b) < 0; }); });
+
+    // Both orders have to agree, interning mustn't change how the catalog breaks ties
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++)
+        mismatches += stringCopy[i] != arena.Path(idCopy[i]);
+
+    // Interning the same paths again finds them rather than adding them
+    double findMs = TimeMs([&] {
+        PathId id;
+        for (size_t i = 0; i < count; i += 5)
+            mismatches += !arena.Find(strings[i], id) || id != ids[i];
+    });
+
+    std::printf("%zu paths in %zu directories (%d distinct)\n\n", count, stats.directories, DirectoryCount);
+    std::printf("%-14s %12s %12s %12s %12s %12s\n", "", "bytes/path", "counted MB", "resident MB", "build", "copy");
+    std::printf("%-14s %12.1f %12.1f %12.1f %10.0fms %10.1fms\n", "std::string", double(stringBytes) / count, stringBytes / 1048576.0,
+                stringResident / 1048576.0, stringBuildMs, stringCopyMs);
+    std::printf("%-14s %12.1f %12.1f %12.1f %10.0fms %10.1fms\n", "interned", double(idBytes) / count, idBytes / 1048576.0,
+                idResident / 1048576.0, internMs, idCopyMs);
+    std::printf("\nsort: %.0fms as strings, %.0fms as ids\n", stringSortMs, idSortMs);
+    std::printf("find: %.0fns a path, %zu mismatches\n", findMs * 1e6 / (count / 5), mismatches);
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// Building the catalog order: std::set insertion against radix sorting a flat array
+// (quantised key, id) pairs at 100k, 1M and 10M entries, then 1% late arrivals merged in
+// Build the radix_sort_bench target and run it from a Release build
+
+#include "../sort_keys.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t Sizes[] = { 100000, 1000000, 10000000 };
+// Late arrivals as a fraction of the catalog
+constexpr size_t LateDivisor = 100;
+
+template <typename F>
+double TimeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Random keys with plenty of repeats, average colours only take so many values
+std::vector<KeyedId> MakeItems(size_t count, uint32_t firstId, uint32_t& state) {
+    std::vector<KeyedId> items(count);
+    for (size_t i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u;
+        items[i] = { state & 0xffffff00u, uint32_t(firstId + i) };
+    }
+    return items;
+}
+
+bool Less(const KeyedId& a, const KeyedId& b) {
+    return a.value != b.value ? a.value < b.value : a.id < b.id;
+}
+
+bool SameOrder(const std::set<std::pair<uint32_t, uint32_t>>& tree, const std::vector<KeyedId>& flat) {
+    if (tree.size() != flat.size())
+        return false;
+    size_t i = 0;
+    for (auto& entry : tree) {
+        if (entry.first != flat[i].value || entry.second != flat[i].id)
+            return false;
+        i++;
+    }
+    return true;
+}
+
+}
+
+int main() {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::printf("%u threads for the parallel sort\n\n", cores);
+    std::printf("%10s %12s %12s %12s %12s | %12s %12s %6s\n", "entries", "std::set", "std::sort", "radix 1", "radix all",
+                "late set", "late merge", "same");
+
+    bool allSame = true;
+    for (size_t count : Sizes) {
+        uint32_t state = 12345;
+        std::vector<KeyedId> items = MakeItems(count, 0, state);
+        std::vector<KeyedId> late = MakeItems(count / LateDivisor, uint32_t(count), state);
+
+        // One node allocation and a walk down the tree per result
+        std::set<std::pair<uint32_t, uint32_t>> tree;
+        double setMs = TimeMs([&] {
+            for (auto& item : items)
+                tree.emplace(item.value, item.id);
+        });
+
+        std::vector<KeyedId> compared = items;
+        double stdSortMs = TimeMs([&] { std::sort(compared.begin(), compared.end(), Less); });
+
+        // Ids go in ascending, so the stable radix sort breaks ties the same way the set does
+        std::vector<KeyedId> single = items, parallel = items, scratch;
+        double radixMs = TimeMs([&] { RadixSort(single, scratch, 1); });
+        double parallelMs = TimeMs([&] { RadixSort(parallel, scratch, cores); });
+
+        // Late arrivals: into the tree one at a time, or sorted on their own and merged into the array
+        double lateSetMs = TimeMs([&] {
+            for (auto& item : late)
+                tree.emplace(item.value, item.id);
+        });
+        double lateMergeMs = TimeMs([&] {
+            std::vector<KeyedId> tail = late;
+            RadixSort(tail, scratch, 1);
+            size_t middle = parallel.size();
+            parallel.insert(parallel.end(), tail.begin(), tail.end());
+            std::inplace_merge(parallel.begin(), parallel.begin() + middle, parallel.end(), Less);
+        });
+
+        bool same = std::equal(single.begin(), single.end(), compared.begin(), [](const KeyedId& a, const KeyedId& b) {
+            return a.value == b.value && a.id == b.id;
+        }) && SameOrder(tree, parallel);
+        allSame = allSame && same;
+
+        std::printf("%10zu %10.1fms %10.1fms %10.1fms %10.1fms | %10.1fms %10.1fms %6s\n", count, setMs, stdSortMs, radixMs,
+                    parallelMs, lateSetMs, lateMergeMs, same ? "yes" : "NO");
+    }
+
+    return allSame ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+// Benchmark for the display resampler on camera-sized inputs
+// Build the resample_bench target and run it from a Release build
+
+#include "../resample.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// Straightforward per-pixel box filter, the baseline the vectorised filter is measured against
+void ReferenceAreaAverage(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight) {
+    for (int y = 0; y < dstHeight; y++) {
+        int y0 = int(int64_t(y) * srcHeight / dstHeight);
+        int y1 = std::max(y0 + 1, int(int64_t(y + 1) * srcHeight / dstHeight));
+
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = int(int64_t(x) * srcWidth / dstWidth);
+            int x1 = std::max(x0 + 1, int(int64_t(x + 1) * srcWidth / dstWidth));
+
+            uint32_t sum[4] = {};
+            for (int sy = y0; sy < y1; sy++) {
+                for (int sx = x0; sx < x1; sx++) {
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += src[(size_t(sy) * srcWidth + sx) * 4 + c];
+                }
+            }
+
+            int count = (y1 - y0) * (x1 - x0);
+            for (int c = 0; c < 4; c++)
+                dst[(size_t(y) * dstWidth + x) * 4 + c] = (unsigned char)((sum[c] + count / 2) / count);
+        }
+    }
+}
+
+template <typename F>
+double BestOfMs(int runs, F run) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+}
+
+int main() {
+    struct Size { const char* name; int width; int height; };
+    const Size sizes[] = {
+        { "24MP", 6000, 4000 },
+        { "50MP", 8688, 5792 },
+        { "100MP", 11648, 8736 },
+    };
+    const int windowWidth = 800, windowHeight = 600;
+
+    std::printf("%-6s %-12s %-10s %12s %12s %12s %10s\n", "input", "output", "MB in/out", "reference", "area SSE", "bilinear", "max diff");
+
+    for (auto& size : sizes) {
+        std::vector<unsigned char> src(size_t(size.width) * size.height * 4);
+        uint32_t state = 12345;
+        for (auto& byte : src) {
+            state = state * 1664525u + 1013904223u;
+            byte = (unsigned char)(state >> 24);
+        }
+
+        int width, height;
+        FitWithin(size.width, size.height, windowWidth, windowHeight, width, height);
+        std::vector<unsigned char> reference(size_t(width) * height * 4), area(reference.size()), bilinear(reference.size());
+
+        double referenceMs = BestOfMs(3, [&] { ReferenceAreaAverage(src.data(), size.width, size.height, reference.data(), width, height); });
+        double areaMs = BestOfMs(3, [&] { AreaAverageRgba(src.data(), size.width, size.height, area.data(), width, height); });
+        double bilinearMs = BestOfMs(3, [&] { BilinearRgba(src.data(), size.width, size.height, bilinear.data(), width, height); });
+
+        int maxDiff = 0;
+        for (size_t i = 0; i < area.size(); i++)
+            maxDiff = std::max(maxDiff, std::abs(int(area[i]) - int(reference[i])));
+
+        char output[32], megabytes[32];
+        std::snprintf(output, sizeof(output), "%dx%d", width, height);
+        std::snprintf(megabytes, sizeof(megabytes), "%zu/%zu", src.size() >> 20, area.size() >> 20);
+        std::printf("%-6s %-12s %-10s %10.1fms %10.1fms %10.1fms %10d\n", size.name, output, megabytes, referenceMs, areaMs, bilinearMs, maxDiff);
+    }
+
+    return 0;
+}
@@ -0,0 +1,322 @@
+// Row at a time JPEG and PNG decoding, checked against stb and used to build the pyramid of an
+// image too large for stb to decode
+// PNG has to match stb exactly. JPEG differs by IDCT rounding, and for subsampled chroma by
+// upsampling, so only its mean difference is held to a limit.
+// Build the scanline_decoder_bench target and run it from a Release build, optionally with the
+// large image's width and height (default 30000 x 24000, 720 megapixels)
+
+#include "../decoder.h"
+#include "../mapped_file.h"
+#include "../tile_pyramid.h"
+
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Odd sizes, so partial MCUs, tiles and bit packed rows all come up
+constexpr int Width = 1501;
+constexpr int Height = 999;
+// Rows asked for at a time, deliberately not a multiple of an MCU
+constexpr int BandRows = 7;
+constexpr double MaxJpegMeanDifference = 2.0;
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Smooth shading with edges and a little noise, so both the filters and the DCT have work to do
+std::vector<unsigned char> Photographic(int channels) {
+    std::vector<unsigned char> pixels(size_t(Width) * Height * channels);
+    uint32_t state = 12345;
+    for (int y = 0; y < Height; y++) {
+        for (int x = 0; x < Width; x++) {
+            state = state * 1664525u + 1013904223u;
+            int noise = int(state >> 29) - 4;
+            bool edge = ((x / 97) + (y / 61)) % 2 == 0;
+            unsigned char* p = &pixels[(size_t(y) * Width + x) * channels];
+            int base[4] = { x * 255 / Width, y * 255 / Height, edge ? 200 : 40, (x + y) & 255 };
+            for (int c = 0; c < channels; c++)
+                p[c] = (unsigned char)std::clamp(base[c] + noise, 0, 255);
+        }
+    }
+    return pixels;
+}
+
+void AppendToVector(void* context, void* data, int size) {
+    auto* out = static_cast<std::vector<unsigned char>*>(context);
+    out->insert(out->end(), static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+}
+
+struct Sample {
+    std::string name;
+    ImageFormat format;
+    std::vector<unsigned char> encoded;
+};
+
+std::vector<Sample> Samples() {
+    std::vector<Sample> samples;
+    for (int channels = 1; channels <= 4; channels++) {
+        auto pixels = Photographic(channels);
+        int length = 0;
+        unsigned char* png = stbi_write_png_to_mem(pixels.data(), Width * channels, Width, Height, channels, &length);
+        samples.push_back({ "png " + std::to_string(channels) + " channel", ImageFormat::Png, std::vector<unsigned char>(png, png + length) });
+        STBIW_FREE(png);
+    }
+
+    // stb writes 4:2:0 at quality 90 and below, 4:4:4 above
+    const std::pair<int, int> jpegs[] = { { 1, 90 }, { 3, 95 }, { 3, 75 } };
+    for (auto [channels, quality] : jpegs) {
+        auto pixels = Photographic(channels);
+        Sample sample = { "jpeg " + std::to_string(channels) + " channel q" + std::to_string(quality), ImageFormat::Jpeg, {} };
+        stbi_write_jpg_to_func(AppendToVector, &sample.encoded, Width, Height, channels, pixels.data(), quality);
+        samples.push_back(std::move(sample));
+    }
+    return samples;
+}
+
+// Decode a sample both ways, false if the difference is more than its format allows
+bool Compare(const Sample& sample) {
+    auto start = std::chrono::steady_clock::now();
+    DecodedImage whole;
+    if (!DecodeImage(sample.encoded.data(), sample.encoded.size(), sample.format, whole, 3)) {
+        std::printf("%-22s stb failed\n", sample.name.c_str());
+        return false;
+    }
+    double stbMs = MsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    ScanlineDecoder rows;
+    std::vector<unsigned char> pixels(size_t(Width) * Height * 3);
+    bool decoded = rows.Open(sample.encoded.data(), sample.encoded.size(), sample.format) && rows.Width() == Width && rows.Height() == Height;
+    for (int y = 0; decoded && y < Height; y += BandRows)
+        decoded = rows.ReadRows(pixels.data() + size_t(y) * Width * 3, std::min(BandRows, Height - y));
+    double rowsMs = MsSince(start);
+    if (!decoded) {
+        std::printf("%-22s scanline decode failed\n", sample.name.c_str());
+        return false;
+    }
+
+    int maxDifference = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        int difference = std::abs(int(pixels[i]) - int(whole.pixels.get()[i]));
+        maxDifference = std::max(maxDifference, difference);
+        total += difference;
+    }
+    double mean = double(total) / pixels.size();
+    bool ok = sample.format == ImageFormat::Png ? maxDifference == 0 : mean <= MaxJpegMeanDifference;
+    std::printf("%-22s %8zuKB %8.1fms %8.1fms %8d %10.3f %s\n", sample.name.c_str(), sample.encoded.size() / 1024, stbMs, rowsMs,
+                maxDifference, mean, ok ? "" : "FAILED");
+    return ok;
+}
+
+// A baseline 4:2:0 JPEG whose blocks are each one flat colour, written without ever holding its
+// pixels. The decoded colour of every pixel is known, and it can be larger than stb will decode.
+class FlatJpegWriter {
+public:
+    FlatJpegWriter(const std::string& fileName, int width, int height) : out(fileName, std::ios::binary), width(width), height(height) {
+        // Standard luminance DC table (ITU T.81 K.3), and an AC table whose only code is end of block
+        const uint8_t dcCounts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+        for (int len = 1, code = 0, symbol = 0; len <= 16; len++, code <<= 1) {
+            for (int i = 0; i < dcCounts[len - 1]; i++, code++, symbol++) {
+                dcCode[symbol] = uint16_t(code);
+                dcLength[symbol] = uint8_t(len);
+            }
+        }
+
+        std::vector<uint8_t> header = { 0xFF, 0xD8 };
+        // Every coefficient quantised by 8, so a block's DC value is its level less 128
+        header.insert(header.end(), { 0xFF, 0xDB, 0, 67, 0 });
+        header.insert(header.end(), 64, 8);
+        header.insert(header.end(), { 0xFF, 0xC0, 0, 17, 8, uint8_t(height >> 8), uint8_t(height), uint8_t(width >> 8), uint8_t(width), 3,
+                                      1, 0x22, 0, 2, 0x11, 0, 3, 0x11, 0 });
+        header.insert(header.end(), { 0xFF, 0xC4, 0, 31, 0x00 });
+        header.insert(header.end(), dcCounts, dcCounts + 16);
+        for (uint8_t symbol = 0; symbol < 12; symbol++)
+            header.push_back(symbol);
+        header.insert(header.end(), { 0xFF, 0xC4, 0, 20, 0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 });
+        header.insert(header.end(), { 0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0 });
+        out.write(reinterpret_cast<const char*>(header.data()), std::streamsize(header.size()));
+    }
+
+    // Block levels, the same function the check uses
+    static int Luma(int blockX, int blockY) { return (blockX + blockY) & 255; }
+    static int Cb(int mcuX) { return (mcuX * 5) & 255; }
+    static int Cr(int mcuY) { return (mcuY * 3) & 255; }
+
+    bool Write() {
+        int mcuColumns = (width + 15) / 16, mcuRows = (height + 15) / 16;
+        for (int my = 0; my < mcuRows; my++) {
+            for (int mx = 0; mx < mcuColumns; mx++) {
+                for (int block = 0; block < 4; block++)
+                    Block(0, Luma(mx * 2 + block % 2, my * 2 + block / 2));
+                Block(1, Cb(mx));
+                Block(2, Cr(my));
+            }
+        }
+
+        // Pad the last byte with ones, then end the image
+        if (bitCount > 0)
+            Put(0x7F, 8 - bitCount);
+        buffer.push_back(0xFF);
+        buffer.push_back(0xD9);
+        out.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+        return bool(out);
+    }
+
+private:
+    void Block(int component, int level) {
+        int difference = (level - 128) - predictors[component];
+        predictors[component] = level - 128;
+
+        int size = 0;
+        for (int magnitude = std::abs(difference); magnitude > 0; magnitude >>= 1)
+            size++;
+        Put(dcCode[size], dcLength[size]);
+        if (size > 0)
+            Put(uint32_t(difference >= 0 ? difference : difference + (1 << size) - 1), size);
+        // End of block
+        Put(0, 1);
+    }
+
+    void Put(uint32_t value, int length) {
+        for (int i = length - 1; i >= 0; i--) {
+            current = uint8_t(current << 1 | (value >> i & 1));
+            if (++bitCount < 8)
+                continue;
+
+            buffer.push_back(current);
+            if (current == 0xFF)
+                buffer.push_back(0);
+            current = 0;
+            bitCount = 0;
+            if (buffer.size() >= 1 << 20) {
+                out.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+                buffer.clear();
+            }
+        }
+    }
+
+    std::ofstream out;
+    int width, height;
+    uint16_t dcCode[12];
+    uint8_t dcLength[12];
+    int predictors[3] = {};
+    std::vector<uint8_t> buffer;
+    uint8_t current = 0;
+    int bitCount = 0;
+};
+
+// The colour a flat block should decode to, in floating point
+void ExpectedRgb(int x, int y, int rgb[3]) {
+    double luma = FlatJpegWriter::Luma(x / 8, y / 8);
+    double cb = FlatJpegWriter::Cb(x / 16) - 128.0, cr = FlatJpegWriter::Cr(y / 16) - 128.0;
+    double channels[3] = { luma + 1.402 * cr, luma - 0.344136 * cb - 0.714136 * cr, luma + 1.772 * cb };
+    for (int c = 0; c < 3; c++)
+        rgb[c] = int(std::lround(std::clamp(channels[c], 0.0, 255.0)));
+}
+
+long PeakMegabytes() {
+#if defined(__unix__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+#else
+    return -1;
+#endif
+}
+
+bool LargeImage(int width, int height) {
+    fs::path folder = fs::temp_directory_path() / "scanline_decoder_bench";
+    fs::create_directories(folder);
+    std::string source = (folder / "large.jpg").u8string();
+    std::string pyramidFile = (folder / "large.pyr").u8string();
+
+    auto start = std::chrono::steady_clock::now();
+    if (!FlatJpegWriter(source, width, height).Write()) {
+        std::printf("couldn't write %s\n", source.c_str());
+        return false;
+    }
+    std::printf("\n%d x %d (%.0f megapixels, %.1fGB as RGB) written in %.1fs\n", width, height, width * double(height) / 1e6,
+                width * double(height) * 3 / (1u << 30), MsSince(start) / 1000);
+
+    DecodedImage whole;
+    bool stbDecoded = DecodeImage(source, ImageFormat::Jpeg, whole, 3);
+    std::printf("stb: %s\n", stbDecoded ? "decoded" : "refused");
+    whole.pixels.reset();
+
+    // Decode it a row at a time, checking every 97th row against the block levels
+    start = std::chrono::steady_clock::now();
+    MappedFile file;
+    ScanlineDecoder rows;
+    if (!file.Open(source) || !rows.Open(file.Data(), file.Size(), ImageFormat::Jpeg) || rows.Width() != width || rows.Height() != height) {
+        std::printf("scanline decoder couldn't open it\n");
+        return false;
+    }
+    std::vector<unsigned char> line(size_t(width) * 3);
+    int wrong = 0;
+    for (int y = 0; y < height; y++) {
+        if (!rows.ReadRows(line.data(), 1)) {
+            std::printf("scanline decode failed at row %d\n", y);
+            return false;
+        }
+        for (int x = 0; y % 97 == 0 && x < width; x++) {
+            int expected[3];
+            ExpectedRgb(x, y, expected);
+            for (int c = 0; c < 3; c++)
+                wrong += std::abs(expected[c] - line[size_t(x) * 3 + c]) > 1;
+        }
+    }
+    std::printf("scanline decode: %.1fs, %d samples off by more than 1\n", MsSince(start) / 1000, wrong);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t size = fs::file_size(source);
+    bool built = BuildTilePyramid(source, size, 0, pyramidFile);
+    TilePyramid pyramid;
+    bool opened = built && pyramid.Open(pyramidFile, size, 0) && pyramid.Width() == width && pyramid.Height() == height;
+    std::printf("pyramid: %s in %.1fs, %zu levels, %.0fMB, peak resident %ldMB\n", opened ? "built" : "FAILED", MsSince(start) / 1000,
+                opened ? pyramid.Levels().size() : size_t(0), opened ? fs::file_size(pyramidFile) / 1048576.0 : 0.0, PeakMegabytes());
+
+    pyramid = TilePyramid();
+    std::error_code error;
+    fs::remove_all(folder, error);
+    return wrong == 0 && opened;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::printf("%-22s %10s %10s %10s %8s %10s\n", "sample", "encoded", "stb", "rows", "max diff", "mean diff");
+    bool ok = true;
+    for (const Sample& sample : Samples())
+        ok = Compare(sample) && ok;
+
+    int width = argc > 2 ? std::atoi(argv[1]) : 30000;
+    int height = argc > 2 ? std::atoi(argv[2]) : 24000;
+    if (width < 1 || height < 1 || width > 65535 || height > 65535) {
+        std::printf("JPEG sizes run from 1 to 65535 a side\n");
+        return 1;
+    }
+    ok = LargeImage(width, height) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+// Time to re-sort a 1M image catalog when the sort key changes
+// Synthetic images with random average colours, 1000 directories of 1000 files
+// Build the sort_key_bench target and run it from a Release build
+
+#include "../catalog.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int DirectoryCount = 1000;
+constexpr int FilesPerDirectory = 1000;
+// Switching key has to feel immediate
+constexpr double TargetMs = 100;
+
+template <typename F>
+double TimeMs(F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Images out of order, or equal values not in path order
+size_t CountMisordered(const std::vector<Image>& images, SortKey key) {
+    size_t misordered = 0;
+    for (size_t i = 1; i < images.size(); i++) {
+        uint32_t a = SortValue(images[i - 1], key), b = SortValue(images[i], key);
+        misordered += a > b || (a == b && CatalogPaths().Compare(images[i - 1].path, images[i].path) >= 0);
+    }
+    return misordered;
+}
+
+}
+
+int main() {
+    const size_t count = size_t(DirectoryCount) * FilesPerDirectory;
+
+    Catalog catalog;
+    uint32_t state = 12345;
+    double addMs = TimeMs([&] {
+        for (size_t i = 0; i < count; i++) {
+            char path[64];
+            std::snprintf(path, sizeof(path), "/photos/%04d/IMG_%07zu.JPG", int(i % DirectoryCount), i);
+
+            Image img;
+            img.SetFileName(path);
+            state = state * 1664525u + 1013904223u;
+            img.averageRgb.r = uint8_t(state >> 24);
+            img.averageRgb.g = uint8_t(state >> 16);
+            img.averageRgb.b = uint8_t(state >> 8);
+            RgbToHsl(img.averageRgb, img.hsl);
+            catalog.Add(img);
+        }
+    });
+    double snapshotMs = TimeMs([&] { catalog.Snapshot(); });
+
+    std::printf("%zu images added in %.0fms (%.0fns each), snapshot %.1fms\n\n", count, addMs, addMs * 1e6 / count, snapshotMs);
+    std::printf("%-15s %10s %12s\n", "key", "re-sort", "misordered");
+
+    size_t misordered = 0;
+    double slowest = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < SortKeyCount; i++) {
+            SortKey key = SortKey(i);
+            double ms = catalog.SetKey(key);
+            size_t wrong = CountMisordered(catalog.Snapshot(), key);
+            misordered += wrong;
+            slowest = std::max(slowest, ms);
+            std::printf("%-15s %8.1fms %12zu\n", SortKeyName(key), ms, wrong);
+        }
+    }
+
+    std::printf("\nslowest switch %.1fms, target %.0fms\n", slowest, TargetMs);
+    return misordered == 0 ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+constexpr int SmallestClassShift = 6;
+
+// Huge pages are 2MB on x86-64 and most ARM systems, smaller blocks aren't worth one
+constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+// Sits in front of every block, 16 bytes so the memory handed out keeps malloc's alignment
+struct BlockHeader {
+    uint32_t sizeClass;
+    uint32_t hugePages;
+    uint64_t unused;
+};
+static_assert(sizeof(BlockHeader) == 16, "block header must keep blocks 16 byte aligned");
+
+size_t ClassSize(int sizeClass) {
+    int shift = SmallestClassShift + sizeClass / 4;
+    return (size_t(4 + sizeClass % 4) << shift) >> 2;
+}
+
+// The smallest class that holds bytes, or -1 if nothing does
+int ClassFor(size_t bytes, int classCount) {
+    if (bytes <= (size_t(1) << SmallestClassShift))
+        return 0;
+
+    int shift = 63;
+    while (((bytes - 1) >> shift) == 0)
+        shift--;
+
+    // Quarters of 2^shift past it, rounded up
+    size_t quarter = size_t(1) << (shift - 2);
+    int step = int((bytes - (size_t(1) << shift) + quarter - 1) / quarter);
+    int sizeClass = (shift - SmallestClassShift) * 4 + step;
+    return sizeClass < classCount ? sizeClass : -1;
+}
+
+BlockHeader* HeaderOf(void* block) {
+    return reinterpret_cast<BlockHeader*>(static_cast<unsigned char*>(block) - sizeof(BlockHeader));
+}
+
+size_t RoundUp(size_t bytes, size_t multiple) {
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+}
+
+BufferPool::~BufferPool() {
+    for (int sizeClass = 0; sizeClass < ClassCount; sizeClass++) {
+        void* block = freeLists[sizeClass].head;
+        while (block != nullptr) {
+            void* next;
+            std::memcpy(&next, block, sizeof(next));
+            SystemFree(block, sizeClass, HeaderOf(block)->hugePages != 0);
+            block = next;
+        }
+    }
+}
+
+void BufferPool::SetRetainLimit(size_t bytes) {
+    retainLimit = bytes;
+}
+
+void BufferPool::SetHugePages(bool enabled) {
+    hugePages = enabled;
+}
+
+void* BufferPool::Allocate(size_t bytes) {
+    int sizeClass = ClassFor(bytes + sizeof(BlockHeader), ClassCount);
+    if (sizeClass < 0)
+        return nullptr;
+    size_t size = ClassSize(sizeClass);
+
+    void* block = nullptr;
+    {
+        // The first bytes of a free block point at the next one
+        FreeList& list = freeLists[sizeClass];
+        std::lock_guard<std::mutex> guard(list.mutex);
+        if (list.head != nullptr) {
+            block = list.head;
+            std::memcpy(&list.head, block, sizeof(list.head));
+        }
+    }
+
+    if (block != nullptr) {
+        reused++;
+        retainedBytes -= size;
+    }
+    else {
+        bool huge = false;
+        block = SystemAllocate(sizeClass, huge);
+        if (block == nullptr)
+            return nullptr;
+        BlockHeader* header = HeaderOf(block);
+        header->sizeClass = uint32_t(sizeClass);
+        header->hugePages = huge;
+        systemAllocations++;
+        if (huge)
+            hugePageBlocks++;
+    }
+
+    liveBytes += size;
+    return block;
+}
+
+void BufferPool::Free(void* block) {
+    if (block == nullptr)
+        return;
+
+    BlockHeader* header = HeaderOf(block);
+    int sizeClass = int(header->sizeClass);
+    size_t size = ClassSize(sizeClass);
+    liveBytes -= size;
+
+    if (retainedBytes + size > retainLimit) {
+        SystemFree(block, sizeClass, header->hugePages != 0);
+        return;
+    }
+
+    retainedBytes += size;
+    FreeList& list = freeLists[sizeClass];
+    std::lock_guard<std::mutex> guard(list.mutex);
+    std::memcpy(block, &list.head, sizeof(list.head));
+    list.head = block;
+}
+
+void* BufferPool::Reallocate(void* block, size_t bytes) {
+    if (block == nullptr)
+        return Allocate(bytes);
+
+    size_t usable = ClassSize(int(HeaderOf(block)->sizeClass)) - sizeof(BlockHeader);
+    if (bytes <= usable)
+        return block;
+
+    void* grown = Allocate(bytes);
+    if (grown == nullptr)
+        return nullptr;
+    std::memcpy(grown, block, usable);
+    Free(block);
+    return grown;
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    Stats stats;
+    stats.systemAllocations = systemAllocations;
+    stats.reused = reused;
+    stats.hugePageBlocks = hugePageBlocks;
+    stats.liveBytes = liveBytes;
+    stats.retainedBytes = retainedBytes;
+    return stats;
+}
+
+#ifdef _WIN32
+
+void* BufferPool::SystemAllocate(int sizeClass, bool& huge) {
+    size_t size = ClassSize(sizeClass);
+    void* memory = nullptr;
+
+    // Large pages need the "Lock pages in memory" privilege, without it this fails and malloc is used
+    size_t largePage = GetLargePageMinimum();
+    if (hugePages && largePage > 0 && size >= HugePageSize) {
+        memory = VirtualAlloc(nullptr, RoundUp(size, largePage), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        huge = memory != nullptr;
+    }
+    if (memory == nullptr)
+        memory = std::malloc(size);
+
+    return memory == nullptr ? nullptr : static_cast<unsigned char*>(memory) + sizeof(BlockHeader);
+}
+
+void BufferPool::SystemFree(void* block, int, bool huge) {
+    void* memory = HeaderOf(block);
+    if (huge)
+        VirtualFree(memory, 0, MEM_RELEASE);
+    else
+        std::free(memory);
+}
+
+#else
+
+void* BufferPool::SystemAllocate(int sizeClass, bool& huge) {
+    size_t size = ClassSize(sizeClass);
+    void* memory = nullptr;
+
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages, the kernel backs the mapping with 2MB pages when it has them free
+    if (hugePages && size >= HugePageSize) {
+        memory = mmap(nullptr, RoundUp(size, HugePageSize), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            memory = nullptr;
+        }
+        else {
+            madvise(memory, RoundUp(size, HugePageSize), MADV_HUGEPAGE);
+            huge = true;
+        }
+    }
+#endif
+    if (memory == nullptr)
+        memory = std::malloc(size);
+
+    return memory == nullptr ? nullptr : static_cast<unsigned char*>(memory) + sizeof(BlockHeader);
+}
+
+void BufferPool::SystemFree(void* block, int sizeClass, bool huge) {
+    void* memory = HeaderOf(block);
+    if (huge)
+        munmap(memory, RoundUp(ClassSize(sizeClass), HugePageSize));
+    else
+        std::free(memory);
+}
+
+#endif
+
+BufferPool& PixelBufferPool() {
+    // Never destroyed, stb_image buffers can still be freed while the program exits
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// Recycles the pixel buffers every decode allocates and frees
+//
+// Blocks are bucketed into size classes a quarter of a power of two apart, so a block is
+// never more than 25% bigger than asked for. A freed block goes on its class's free list and
+// is handed out again to the next allocation of that class, so once the pipeline has seen a
+// few images of each size it stops going to the system. Blocks of 2MB and over can be backed
+// by huge pages. Every block starts with a 16 byte header holding its class, so it can be
+// freed without knowing its size, which is all stb_image's STBI_FREE gets.
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t systemAllocations = 0;
+        uint64_t reused = 0;
+        uint64_t hugePageBlocks = 0;
+        // Bytes handed out and not yet freed, and bytes waiting on free lists
+        size_t liveBytes = 0;
+        size_t retainedBytes = 0;
+    };
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Stop keeping freed blocks once this many bytes are waiting, they go back to the system instead
+    void SetRetainLimit(size_t bytes);
+    // Back large blocks with huge pages where the system allows it
+    void SetHugePages(bool enabled);
+
+    void* Allocate(size_t bytes);
+    void Free(void* block);
+    // Grows into a new block only when the old one's class is too small
+    void* Reallocate(void* block, size_t bytes);
+
+    Stats GetStats() const;
+
+private:
+    // 64 byte blocks up to 256TB, four classes per power of two
+    static constexpr int ClassCount = (48 - 6) * 4;
+
+    struct FreeList {
+        std::mutex mutex;
+        void* head = nullptr;
+    };
+
+    void* SystemAllocate(int sizeClass, bool& huge);
+    void SystemFree(void* block, int sizeClass, bool huge);
+
+    std::array<FreeList, ClassCount> freeLists;
+    std::atomic<size_t> retainLimit{ 256 * 1024 * 1024 };
+    std::atomic<bool> hugePages{ false };
+
+    std::atomic<uint64_t> systemAllocations{ 0 };
+    std::atomic<uint64_t> reused{ 0 };
+    std::atomic<uint64_t> hugePageBlocks{ 0 };
+    std::atomic<size_t> liveBytes{ 0 };
+    std::atomic<size_t> retainedBytes{ 0 };
+};
+
+// The pool every decode shares, stb_image's allocations go through it too
+BufferPool& PixelBufferPool();
+
+// Standard allocator over PixelBufferPool, for containers that hold pixels
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        void* block = PixelBufferPool().Allocate(count * sizeof(T));
+        if (block == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(block);
+    }
+
+    void deallocate(T* block, size_t) { PixelBufferPool().Free(block); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
@@ -0,0 +1,215 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// The unsorted tail is merged once it's this long plus an eighth of the order, so merging
+// costs a few operations per image however big the catalog gets
+constexpr size_t MergeThreshold = 1024;
+// A tail at least this fraction of the order is a batch, the whole order is radix sorted again
+// rather than merging it in by comparisons
+constexpr size_t BatchFraction = 8;
+
+}
+
+Catalog::Catalog(SortKey key) : key(key) {}
+
+bool Catalog::Before(uint32_t a, uint32_t b) const {
+    if (values[a] != values[b])
+        return values[a] < values[b];
+    return PathBefore(a, b);
+}
+
+bool Catalog::PathBefore(uint32_t a, uint32_t b) const {
+    return CatalogPaths().Compare(images[a].path, images[b].path) < 0;
+}
+
+size_t Catalog::Position(uint32_t id) const {
+    auto it = std::lower_bound(order.begin(), order.end(), id, [this](uint32_t a, uint32_t b) { return Before(a, b); });
+    return size_t(it - order.begin());
+}
+
+size_t Catalog::PathPosition(uint32_t id) const {
+    auto it = std::lower_bound(byPath.begin(), byPath.end(), id, [this](uint32_t a, uint32_t b) { return PathBefore(a, b); });
+    return size_t(it - byPath.begin());
+}
+
+void Catalog::MergePaths() const {
+    auto pathBefore = [this](uint32_t a, uint32_t b) { return PathBefore(a, b); };
+    std::sort(pending.begin(), pending.end(), pathBefore);
+    size_t middle = byPath.size();
+    byPath.insert(byPath.end(), pending.begin(), pending.end());
+    std::inplace_merge(byPath.begin(), byPath.begin() + middle, byPath.end(), pathBefore);
+}
+
+void Catalog::Merge() const {
+    if (pending.empty())
+        return;
+
+    MergePaths();
+    if (pending.size() * BatchFraction >= order.size()) {
+        SortByValue();
+    }
+    else {
+        // A few late arrivals, already in path order so a stable sort by value finishes the job
+        std::stable_sort(pending.begin(), pending.end(), [this](uint32_t a, uint32_t b) { return values[a] < values[b]; });
+        size_t middle = order.size();
+        order.insert(order.end(), pending.begin(), pending.end());
+        std::inplace_merge(order.begin(), order.begin() + middle, order.end(), [this](uint32_t a, uint32_t b) { return Before(a, b); });
+    }
+    pending.clear();
+}
+
+void Catalog::SortByValue() const {
+    // Fed in path order, the stable sort leaves equal values in path order too
+    std::vector<KeyedId> keyed(byPath.size()), scratch;
+    for (size_t i = 0; i < byPath.size(); i++)
+        keyed[i] = { values[byPath[i]], byPath[i] };
+    RadixSort(keyed, scratch);
+
+    order.resize(keyed.size());
+    for (size_t i = 0; i < keyed.size(); i++)
+        order[i] = keyed[i].id;
+}
+
+bool Catalog::Erase(PathId path) {
+    auto it = ids.find(Pack(path));
+    if (it == ids.end())
+        return false;
+
+    Merge();
+    uint32_t id = it->second;
+    ids.erase(it);
+    order.erase(order.begin() + Position(id));
+    byPath.erase(byPath.begin() + PathPosition(id));
+
+    // Move the last record into the hole so ids stay dense
+    uint32_t last = uint32_t(images.size() - 1);
+    if (id != last) {
+        order[Position(last)] = id;
+        byPath[PathPosition(last)] = id;
+        images[id] = images[last];
+        values[id] = values[last];
+        ids[Pack(images[id].path)] = id;
+    }
+    images.pop_back();
+    values.pop_back();
+    return true;
+}
+
+bool Catalog::Add(const Image& img) {
+    std::lock_guard<std::mutex> guard(mutex);
+    bool replaced = Erase(img.path);
+
+    uint32_t id = uint32_t(images.size());
+    images.push_back(img);
+    values.push_back(SortValue(img, key));
+    ids.emplace(Pack(img.path), id);
+    pending.push_back(id);
+
+    if (pending.size() > MergeThreshold + order.size() / 8)
+        Merge();
+    return replaced;
+}
+
+bool Catalog::Remove(PathId path) {
+    std::lock_guard<std::mutex> guard(mutex);
+    return Erase(path);
+}
+
+size_t Catalog::Size() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return images.size();
+}
+
+std::vector<Image> Catalog::Snapshot() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    Merge();
+
+    std::vector<Image> snapshot;
+    snapshot.reserve(order.size());
+    for (uint32_t id : order)
+        snapshot.push_back(images[id]);
+    return snapshot;
+}
+
+std::vector<std::string> Catalog::FileNames(size_t first, size_t last) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    Merge();
+
+    std::vector<std::string> names;
+    last = std::min(last, order.size());
+    for (size_t i = first; i < last; i++)
+        names.push_back(images[order[i]].FileName());
+    return names;
+}
+
+bool Catalog::Find(PathId path, size_t& position) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto found = ids.find(Pack(path));
+    if (found == ids.end())
+        return false;
+
+    Merge();
+    position = Position(found->second);
+    return true;
+}
+
+bool Catalog::Near(PathId centre, PathId candidate, int window) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto found = ids.find(Pack(candidate));
+    if (found == ids.end())
+        return false;
+
+    Merge();
+    size_t position = Position(found->second);
+    size_t start = 0;
+    auto viewing = ids.find(Pack(centre));
+    if (viewing != ids.end())
+        start = Position(viewing->second);
+
+    // Centred on the viewer, or shifted forward where the order starts
+    size_t span = size_t(std::max(window, 0));
+    start = start > span ? start - span : 0;
+    return position >= start && position <= start + 2 * span;
+}
+
+void Catalog::Export(std::vector<Image>& records, std::array<std::vector<uint32_t>, SortKeyCount>& orders) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    Merge();
+    records = images;
+
+    std::vector<uint32_t> keyValues(images.size());
+    std::vector<KeyedId> keyed(byPath.size()), scratch;
+    for (int k = 0; k < SortKeyCount; k++) {
+        SortValues(images.data(), images.size(), SortKey(k), keyValues.data());
+        for (size_t i = 0; i < byPath.size(); i++)
+            keyed[i] = { keyValues[byPath[i]], byPath[i] };
+        RadixSort(keyed, scratch);
+
+        orders[k].resize(keyed.size());
+        for (size_t i = 0; i < keyed.size(); i++)
+            orders[k][i] = keyed[i].id;
+    }
+}
+
+SortKey Catalog::Key() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return key;
+}
+
+double Catalog::SetKey(SortKey newKey) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto start = std::chrono::steady_clock::now();
+    key = newKey;
+    SortValues(images.data(), images.size(), key, values.data());
+
+    // The tail only needs to join the path order, everything is sorted by value again anyway
+    MergePaths();
+    pending.clear();
+    SortByValue();
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
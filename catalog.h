@@ -0,0 +1,81 @@
+#pragma once
+
+#include "image.h"
+#include "sort_keys.h"
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Every processed image, in the order of the current sort key
+//
+// Images are stored once in a flat array indexed by id, and the order is a separate list of
+// ids. Each image's sort value for the current key is kept next to it, so switching key only
+// recomputes those in one batch from the colours already in the records and radix sorts
+// (value, id) pairs.
+// Equal values fall back to the path, so the order doesn't depend on arrival order; a second
+// list of ids in path order is fed to the stable radix sort so ties come out that way without
+// comparing any paths. New images go on an unsorted tail that's merged into both lists when it
+// grows or the order is read: a batch by sorting everything again, late arrivals by merging.
+class Catalog {
+public:
+    explicit Catalog(SortKey key = SortKey::Hue);
+
+    // Insert img, replacing the entry for the same path, true if it replaced one
+    bool Add(const Image& img);
+    // Remove the entry for path, false if there wasn't one
+    bool Remove(PathId path);
+
+    size_t Size() const;
+    // Images in order
+    std::vector<Image> Snapshot() const;
+    // File names at positions [first, last) of the order, fewer if it's shorter
+    std::vector<std::string> FileNames(size_t first, size_t last) const;
+    // Where path is in the order, false if it isn't in the catalog
+    bool Find(PathId path, size_t& position) const;
+
+    // True if candidate is within window places of centre in the order, or of the start of the
+    // order if centre isn't in the catalog
+    bool Near(PathId centre, PathId candidate, int window) const;
+
+    // Every record by id and the ids in order under each key, for saving the catalog
+    void Export(std::vector<Image>& records, std::array<std::vector<uint32_t>, SortKeyCount>& orders) const;
+
+    SortKey Key() const;
+    // Re-sort everything by key, returns how long it took in milliseconds
+    double SetKey(SortKey key);
+
+private:
+    static uint64_t Pack(PathId path) { return uint64_t(path.directory) << 32 | path.name; }
+
+    // Order of two ids under the current key
+    bool Before(uint32_t a, uint32_t b) const;
+    bool PathBefore(uint32_t a, uint32_t b) const;
+    // Where id is in order and in byPath, which must hold it
+    size_t Position(uint32_t id) const;
+    size_t PathPosition(uint32_t id) const;
+    // Sort the tail into order
+    void Merge() const;
+    // Sort the tail by path into byPath, leaving it in pending
+    void MergePaths() const;
+    // Rebuild order from byPath with a radix sort on the values
+    void SortByValue() const;
+    // Remove without taking the lock
+    bool Erase(PathId path);
+
+    mutable std::mutex mutex;
+    SortKey key;
+
+    // By id, the record and its value under key
+    std::vector<Image> images;
+    std::vector<uint32_t> values;
+    std::unordered_map<uint64_t, uint32_t> ids;
+
+    // Ids in sort order and in path order, then ids added since the last merge
+    mutable std::vector<uint32_t> order;
+    mutable std::vector<uint32_t> byPath;
+    mutable std::vector<uint32_t> pending;
+};
@@ -0,0 +1,291 @@
+#include "catalog_file.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char CatalogMagic[4] = { 'I', 'V', 'C', 'F' };
+// 2 added the perceptual sort keys, so an order for each of them, and 3 the HSV saturation key
+constexpr uint32_t CatalogVersion = 3;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    uint64_t recordsOffset;
+    uint64_t ordersOffset;
+    uint64_t indexOffset;
+    uint64_t indexSlots;
+    uint64_t pathsOffset;
+    uint64_t pathsSize;
+};
+static_assert(sizeof(FileHeader) == 64, "catalog header must stay packed");
+
+struct CatalogRecord {
+    // From the start of the paths section
+    uint64_t pathOffset;
+    uint64_t fileSize;
+    int64_t modifiedTime;
+    uint64_t contentHash;
+    int32_t width;
+    int32_t height;
+    uint8_t r, g, b;
+    uint8_t format;
+    float h, s, l;
+};
+static_assert(sizeof(CatalogRecord) == 56, "catalog record must stay packed");
+
+uint64_t Align(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+// Power of two at least twice count, so probes stay short
+uint64_t IndexSlots(uint64_t count) {
+    uint64_t slots = 16;
+    while (slots < count * 2)
+        slots *= 2;
+    return slots;
+}
+
+void Pad(std::ofstream& out, uint64_t& offset) {
+    static const char zeros[8] = {};
+    uint64_t aligned = Align(offset);
+    out.write(zeros, std::streamsize(aligned - offset));
+    offset = aligned;
+}
+
+}
+
+bool SavedCatalog::Open(const std::string& fileName) {
+    Close();
+    if (!mapping.Open(fileName) || mapping.Size() < sizeof(FileHeader))
+        return false;
+
+    FileHeader header;
+    std::memcpy(&header, mapping.Data(), sizeof(header));
+    uint64_t size = mapping.Size();
+    if (std::memcmp(header.magic, CatalogMagic, sizeof(CatalogMagic)) != 0 || header.version != CatalogVersion)
+        return false;
+
+    // Every section has to lie inside the file, an older or torn file is ignored rather than read past its end
+    auto fits = [size](uint64_t offset, uint64_t count, uint64_t itemSize) {
+        return offset <= size && count <= (size - offset) / itemSize;
+    };
+    if (header.count > UINT32_MAX || !fits(header.recordsOffset, header.count, sizeof(CatalogRecord)) ||
+        !fits(header.ordersOffset, header.count * SortKeyCount, sizeof(uint32_t)) ||
+        !fits(header.indexOffset, header.indexSlots, sizeof(uint32_t)) || !fits(header.pathsOffset, header.pathsSize, 1) ||
+        header.indexSlots == 0 || (header.indexSlots & (header.indexSlots - 1)) != 0) {
+        mapping.Close();
+        return false;
+    }
+
+    const unsigned char* data = mapping.Data();
+    records = data + header.recordsOffset;
+    orders = data + header.ordersOffset;
+    index = data + header.indexOffset;
+    indexSlots = header.indexSlots;
+    paths = data + header.pathsOffset;
+    pathsSize = header.pathsSize;
+    count = header.count;
+    return true;
+}
+
+void SavedCatalog::Close() {
+    mapping.Close();
+    count = 0;
+    records = orders = index = paths = nullptr;
+    indexSlots = pathsSize = 0;
+}
+
+uint32_t SavedCatalog::At(SortKey key, uint64_t position) const {
+    uint32_t record = 0;
+    if (position < count && key < SortKey::Count)
+        std::memcpy(&record, orders + (uint64_t(key) * count + position) * sizeof(uint32_t), sizeof(record));
+    return record < count ? record : 0;
+}
+
+std::string_view SavedCatalog::PathView(uint32_t record) const {
+    if (record >= count)
+        return {};
+
+    uint64_t offset;
+    std::memcpy(&offset, records + uint64_t(record) * sizeof(CatalogRecord) + offsetof(CatalogRecord, pathOffset), sizeof(offset));
+    uint16_t length;
+    if (offset + sizeof(length) > pathsSize)
+        return {};
+    std::memcpy(&length, paths + offset, sizeof(length));
+    if (offset + sizeof(length) + length > pathsSize)
+        return {};
+    return { reinterpret_cast<const char*>(paths + offset + sizeof(length)), length };
+}
+
+std::string SavedCatalog::Path(uint32_t record) const {
+    return std::string(PathView(record));
+}
+
+bool SavedCatalog::Find(std::string_view path, uint32_t& record) const {
+    if (count == 0)
+        return false;
+
+    uint64_t mask = indexSlots - 1;
+    for (uint64_t slot = HashBytes(path.data(), path.size()) & mask, probes = 0; probes < indexSlots; slot = (slot + 1) & mask, probes++) {
+        uint32_t entry;
+        std::memcpy(&entry, index + slot * sizeof(uint32_t), sizeof(entry));
+        if (entry == 0)
+            return false;
+        if (PathView(entry - 1) == path) {
+            record = entry - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t SavedCatalog::Value(SortKey key, uint32_t record) const {
+    CatalogRecord saved;
+    std::memcpy(&saved, records + uint64_t(record) * sizeof(CatalogRecord), sizeof(saved));
+
+    Image img;
+    img.averageRgb.r = saved.r;
+    img.averageRgb.g = saved.g;
+    img.averageRgb.b = saved.b;
+    RgbToHsl(img.averageRgb, img.hsl);
+    return SortValue(img, key);
+}
+
+bool SavedCatalog::Position(SortKey key, uint32_t record, uint64_t& position) const {
+    if (record >= count || key >= SortKey::Count)
+        return false;
+
+    uint32_t value = Value(key, record);
+    std::string_view path = PathView(record);
+    uint64_t low = 0, high = count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        uint32_t other = At(key, middle);
+        uint32_t otherValue = Value(key, other);
+        if (otherValue < value || (otherValue == value && PathView(other) < path))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low == count || At(key, low) != record)
+        return false;
+    position = low;
+    return true;
+}
+
+bool SavedCatalog::Lookup(Image& img) const {
+    uint32_t found;
+    if (!Find(img.FileName(), found))
+        return false;
+
+    CatalogRecord record;
+    std::memcpy(&record, records + uint64_t(found) * sizeof(CatalogRecord), sizeof(record));
+    if (uint64_t(record.fileSize) != img.fileSize || record.modifiedTime != img.modifiedTime)
+        return false;
+
+    img.contentHash = record.contentHash;
+    img.width = record.width;
+    img.height = record.height;
+    img.format = ImageFormat(record.format);
+    img.averageRgb.r = record.r;
+    img.averageRgb.g = record.g;
+    img.averageRgb.b = record.b;
+    RgbToHsl(img.averageRgb, img.hsl);
+    img.cached = true;
+    return true;
+}
+
+bool SaveCatalog(const std::string& fileName, const std::vector<Image>& images,
+                 const std::array<std::vector<uint32_t>, SortKeyCount>& orders) {
+    uint64_t count = images.size();
+    for (auto& order : orders) {
+        if (order.size() != count)
+            return false;
+    }
+
+    // Paths first, the records need their offsets
+    std::vector<char> pathBlob;
+    std::vector<CatalogRecord> records(count);
+    std::vector<uint32_t> index(IndexSlots(count), 0);
+    uint64_t mask = index.size() - 1;
+    for (uint64_t i = 0; i < count; i++) {
+        const Image& img = images[i];
+        std::string path = img.FileName();
+        uint16_t length = uint16_t(std::min(path.size(), size_t(UINT16_MAX)));
+
+        CatalogRecord& record = records[i];
+        record = {};
+        record.pathOffset = pathBlob.size();
+        record.fileSize = img.fileSize;
+        record.modifiedTime = img.modifiedTime;
+        record.contentHash = img.contentHash;
+        record.width = img.width;
+        record.height = img.height;
+        record.r = img.averageRgb.r;
+        record.g = img.averageRgb.g;
+        record.b = img.averageRgb.b;
+        record.format = uint8_t(img.format);
+        record.h = img.hsl.h;
+        record.s = img.hsl.s;
+        record.l = img.hsl.l;
+
+        const char* lengthBytes = reinterpret_cast<const char*>(&length);
+        pathBlob.insert(pathBlob.end(), lengthBytes, lengthBytes + sizeof(length));
+        pathBlob.insert(pathBlob.end(), path.data(), path.data() + length);
+
+        uint64_t slot = HashBytes(path.data(), length) & mask;
+        while (index[slot] != 0)
+            slot = (slot + 1) & mask;
+        index[slot] = uint32_t(i + 1);
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, CatalogMagic, sizeof(CatalogMagic));
+    header.version = CatalogVersion;
+    header.count = count;
+    header.recordsOffset = sizeof(FileHeader);
+    header.ordersOffset = Align(header.recordsOffset + count * sizeof(CatalogRecord));
+    header.indexOffset = Align(header.ordersOffset + count * SortKeyCount * sizeof(uint32_t));
+    header.indexSlots = index.size();
+    header.pathsOffset = Align(header.indexOffset + index.size() * sizeof(uint32_t));
+    header.pathsSize = pathBlob.size();
+
+    fs::path target = fs::u8path(fileName);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        uint64_t offset = 0;
+        auto write = [&](const void* data, uint64_t length) {
+            out.write(static_cast<const char*>(data), std::streamsize(length));
+            offset += length;
+        };
+
+        write(&header, sizeof(header));
+        write(records.data(), records.size() * sizeof(CatalogRecord));
+        Pad(out, offset);
+        for (auto& order : orders)
+            write(order.data(), order.size() * sizeof(uint32_t));
+        Pad(out, offset);
+        write(index.data(), index.size() * sizeof(uint32_t));
+        Pad(out, offset);
+        write(pathBlob.data(), pathBlob.size());
+
+        out.flush();
+        if (!out)
+            return false;
+    }
+
+    std::error_code error;
+    fs::rename(temp, target, error);
+    return !error;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "image.h"
+#include "mapped_file.h"
+#include "sort_keys.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The catalog as the last run left it, saved so the next one can browse before it has scanned anything
+//
+// Version 3 is a header and four sections, each 8 byte aligned and located from the header:
+//   records  a fixed 56 byte record per image: path offset, size, mtime, content hash,
+//            dimensions, average RGB, format and HSL
+//   orders   for every SortKey, the record indices in that order
+//   index    open addressed table of record index + 1 by path hash, 0 for an empty slot
+//   paths    a 2 byte length and the bytes of each path
+// Opening maps the file and checks the header and section bounds, nothing more. Records,
+// orders and paths are read in place, so opening costs the same for any size of catalog.
+class SavedCatalog {
+public:
+    bool Open(const std::string& fileName);
+    void Close();
+    // Mapped and holding at least one image
+    bool IsOpen() const { return count > 0; }
+
+    uint64_t Size() const { return count; }
+    // Record at position in key's order
+    uint32_t At(SortKey key, uint64_t position) const;
+    std::string Path(uint32_t record) const;
+    // Record saved for path, false if there isn't one
+    bool Find(std::string_view path, uint32_t& record) const;
+    // Where record is in key's order, a binary search on its sort value then its path the way
+    // the order was sorted, false if it isn't found there
+    bool Position(SortKey key, uint32_t record, uint64_t& position) const;
+
+    // Fill img's results from the saved record if its size and mtime still match
+    bool Lookup(Image& img) const;
+
+private:
+    std::string_view PathView(uint32_t record) const;
+    // record's value under key, from its average colour
+    uint32_t Value(SortKey key, uint32_t record) const;
+
+    MappedFile mapping;
+    uint64_t count = 0;
+    const unsigned char* records = nullptr;
+    const unsigned char* orders = nullptr;
+    const unsigned char* index = nullptr;
+    uint64_t indexSlots = 0;
+    const unsigned char* paths = nullptr;
+    uint64_t pathsSize = 0;
+};
+
+// Save records (by id) and their order under every key, written to a temporary file and renamed
+// over fileName so a reader never maps half a catalog
+bool SaveCatalog(const std::string& fileName, const std::vector<Image>& records,
+                 const std::array<std::vector<uint32_t>, SortKeyCount>& orders);
@@ -0,0 +1,220 @@
+#include "colour_space.h"
+#include "average_colour.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLOUR_SPACE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr float Pi = 3.14159265358979f;
+constexpr float Degrees = 180 / Pi;
+
+// Linear RGB to responses, the nonlinearity, then responses to lightness and opponent axes
+struct SpaceMatrices {
+    float toResponse[3][3];
+    // CIELAB's linear toe: below threshold, t * slope + offset instead of the cube root
+    bool toe;
+    float toLab[3][3];
+    float lightnessOffset;
+};
+
+// Bjorn Ottosson's matrices, linear sRGB to LMS cone responses and cube roots to Lab
+constexpr SpaceMatrices OklabMatrices = {
+    { { 0.4122214708f, 0.5363325363f, 0.0514459929f },
+      { 0.2119034982f, 0.6806995451f, 0.1073969566f },
+      { 0.0883024619f, 0.2817188376f, 0.6299787005f } },
+    false,
+    { { 0.2104542553f, 0.7936177850f, -0.0040720468f },
+      { 1.9779984951f, -2.4285922050f, 0.4505937099f },
+      { 0.0259040371f, 0.7827717662f, -0.8086757660f } },
+    0,
+};
+
+// Linear sRGB to XYZ divided by the D65 white point, then L = 116 fy - 16, a = 500 (fx - fy),
+// b = 200 (fy - fz)
+constexpr SpaceMatrices CielabMatrices = {
+    { { 0.4124564f / 0.95047f, 0.3575761f / 0.95047f, 0.1804375f / 0.95047f },
+      { 0.2126729f, 0.7151522f, 0.0721750f },
+      { 0.0193339f / 1.08883f, 0.1191920f / 1.08883f, 0.9503041f / 1.08883f } },
+    true,
+    { { 0, 116, 0 },
+      { 500, -500, 0 },
+      { 0, 200, -200 } },
+    -16,
+};
+
+constexpr float ToeThreshold = 216.f / 24389;
+constexpr float ToeSlope = 24389.f / 27 / 116;
+constexpr float ToeOffset = 16.f / 116;
+
+const SpaceMatrices& Matrices(ColourSpace space) {
+    return space == ColourSpace::Cielab ? CielabMatrices : OklabMatrices;
+}
+
+// Linear light of each sRGB value
+struct LinearTable {
+    float values[256];
+    LinearTable() {
+        for (int v = 0; v < 256; v++)
+            values[v] = float(DecodeSrgb(v / 255.0));
+    }
+};
+
+const float* Linear() {
+    static const LinearTable table;
+    return table.values;
+}
+
+// Four colours as columns of linear light
+struct Four {
+    alignas(16) float r[4], g[4], b[4];
+};
+
+// Four results, written out to the columns by the caller
+struct FourLab {
+    alignas(16) float l[4], a[4], b[4], chroma[4], hue[4];
+};
+
+#ifdef COLOUR_SPACE_SSE2
+
+__m128 MultiplyAdd(const float row[3], __m128 x, __m128 y, __m128 z) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), x), _mm_mul_ps(_mm_set1_ps(row[1]), y)),
+                      _mm_mul_ps(_mm_set1_ps(row[2]), z));
+}
+
+// Cube root of x >= 0: a guess from the exponent bits, then two Newton steps
+__m128 CubeRoot(__m128 x) {
+    __m128i bits = _mm_castps_si128(x);
+    __m128i third = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.f / 3)));
+    __m128 y = _mm_castsi128_ps(_mm_add_epi32(third, _mm_set1_epi32(0x2a5137a0)));
+
+    const __m128 oneThird = _mm_set1_ps(1.f / 3);
+    for (int step = 0; step < 2; step++)
+        y = _mm_mul_ps(oneThird, _mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))));
+
+    // Zero and anything below stay zero rather than whatever the guess was
+    return _mm_and_ps(y, _mm_cmpgt_ps(x, _mm_setzero_ps()));
+}
+
+__m128 Compress(__m128 t, bool toe) {
+    __m128 root = CubeRoot(t);
+    if (!toe)
+        return root;
+    __m128 linear = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(ToeSlope)), _mm_set1_ps(ToeOffset));
+    __m128 above = _mm_cmpgt_ps(t, _mm_set1_ps(ToeThreshold));
+    return _mm_or_ps(_mm_and_ps(above, root), _mm_andnot_ps(above, linear));
+}
+
+// atan2(y, x) in degrees from 0 to 360, by a polynomial for atan on [0, 1] and the octant
+__m128 HueAngle(__m128 y, __m128 x) {
+    const __m128 sign = _mm_set1_ps(-0.f);
+    __m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+    __m128 high = _mm_max_ps(ax, ay), low = _mm_min_ps(ax, ay);
+    __m128 t = _mm_div_ps(low, _mm_max_ps(high, _mm_set1_ps(1e-30f)));
+    __m128 s = _mm_mul_ps(t, t);
+
+    __m128 p = _mm_set1_ps(-0.0464964749f);
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(0.15931422f));
+    p = _mm_add_ps(_mm_mul_ps(p, s), _mm_set1_ps(-0.327622764f));
+    __m128 angle = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, s), t), t);
+
+    auto flip = [](__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+    angle = flip(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(Pi / 2), angle), angle);
+    angle = flip(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(Pi), angle), angle);
+    angle = flip(_mm_cmplt_ps(y, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(2 * Pi), angle), angle);
+    return _mm_mul_ps(angle, _mm_set1_ps(Degrees));
+}
+
+void ConvertFour(const SpaceMatrices& m, const Four& in, FourLab& out, bool polar) {
+    __m128 r = _mm_load_ps(in.r), g = _mm_load_ps(in.g), b = _mm_load_ps(in.b);
+    __m128 x = Compress(MultiplyAdd(m.toResponse[0], r, g, b), m.toe);
+    __m128 y = Compress(MultiplyAdd(m.toResponse[1], r, g, b), m.toe);
+    __m128 z = Compress(MultiplyAdd(m.toResponse[2], r, g, b), m.toe);
+
+    __m128 l = _mm_add_ps(MultiplyAdd(m.toLab[0], x, y, z), _mm_set1_ps(m.lightnessOffset));
+    __m128 a = MultiplyAdd(m.toLab[1], x, y, z);
+    __m128 bb = MultiplyAdd(m.toLab[2], x, y, z);
+    _mm_store_ps(out.l, l);
+    _mm_store_ps(out.a, a);
+    _mm_store_ps(out.b, bb);
+    if (!polar)
+        return;
+    _mm_store_ps(out.chroma, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(bb, bb))));
+    _mm_store_ps(out.hue, HueAngle(bb, a));
+}
+
+#else
+
+float MultiplyAdd(const float row[3], float x, float y, float z) {
+    return row[0] * x + row[1] * y + row[2] * z;
+}
+
+float Compress(float t, bool toe) {
+    if (toe && t <= ToeThreshold)
+        return t * ToeSlope + ToeOffset;
+    return t > 0 ? std::cbrt(t) : 0.f;
+}
+
+void ConvertFour(const SpaceMatrices& m, const Four& in, FourLab& out, bool polar) {
+    for (int i = 0; i < 4; i++) {
+        float x = Compress(MultiplyAdd(m.toResponse[0], in.r[i], in.g[i], in.b[i]), m.toe);
+        float y = Compress(MultiplyAdd(m.toResponse[1], in.r[i], in.g[i], in.b[i]), m.toe);
+        float z = Compress(MultiplyAdd(m.toResponse[2], in.r[i], in.g[i], in.b[i]), m.toe);
+
+        out.l[i] = MultiplyAdd(m.toLab[0], x, y, z) + m.lightnessOffset;
+        out.a[i] = MultiplyAdd(m.toLab[1], x, y, z);
+        out.b[i] = MultiplyAdd(m.toLab[2], x, y, z);
+        if (!polar)
+            continue;
+        out.chroma[i] = std::sqrt(out.a[i] * out.a[i] + out.b[i] * out.b[i]);
+        float hue = std::atan2(out.b[i], out.a[i]) * Degrees;
+        out.hue[i] = hue < 0 ? hue + 360 : hue;
+    }
+}
+
+#endif
+
+}
+
+void ConvertColours(ColourSpace space, const RGB* colours, size_t count, LabColumns& out, bool polar) {
+    out.l.resize(count);
+    out.a.resize(count);
+    out.b.resize(count);
+    out.chroma.resize(polar ? count : 0);
+    out.hue.resize(polar ? count : 0);
+
+    const SpaceMatrices& m = Matrices(space);
+    const float* linear = Linear();
+    Four in;
+    FourLab lab;
+    for (size_t i = 0; i < count; i += 4) {
+        // The last few go through padded with black, so any count gets the same arithmetic
+        size_t n = std::min<size_t>(4, count - i);
+        for (size_t k = 0; k < 4; k++) {
+            RGB c = k < n ? colours[i + k] : RGB();
+            in.r[k] = linear[c.r];
+            in.g[k] = linear[c.g];
+            in.b[k] = linear[c.b];
+        }
+
+        ConvertFour(m, in, lab, polar);
+        std::memcpy(&out.l[i], lab.l, n * sizeof(float));
+        std::memcpy(&out.a[i], lab.a, n * sizeof(float));
+        std::memcpy(&out.b[i], lab.b, n * sizeof(float));
+        if (!polar)
+            continue;
+        std::memcpy(&out.chroma[i], lab.chroma, n * sizeof(float));
+        std::memcpy(&out.hue[i], lab.hue, n * sizeof(float));
+    }
+}
+
+float AchromaticChroma(ColourSpace space) {
+    // Well under a just noticeable difference in either, but above rounding in the matrices
+    return space == ColourSpace::Cielab ? 0.05f : 0.0005f;
+}
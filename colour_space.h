@@ -0,0 +1,34 @@
+#pragma once
+
+#include "image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Perceptual colour spaces for ordering images by their average colour
+//
+// Both take sRGB to linear light, through a 3x3 matrix to three responses, compress each
+// (OKLab by a cube root, CIELAB by a cube root with a linear toe) and mix them with a second
+// matrix into lightness and two opponent axes. Distances there track what people see far better
+// than HSL's, which puts a dark grey-brown and a bright orange on the same hue.
+enum class ColourSpace : uint8_t {
+    Oklab,
+    Cielab,
+};
+
+// Lightness, the opponent axes and their polar form, hue in degrees from 0 to 360
+// Oklab lightness runs 0 to 1 and CIELAB's 0 to 100
+struct LabColumns {
+    std::vector<float> l, a, b, chroma, hue;
+};
+
+// Convert count colours into columns resized to match, four at a time with SSE2 where the target
+// has it. The cube root and hue angle are then approximations, leaving Oklab within 2e-6 of
+// double precision, CIELAB within 4e-4 and hue within 0.02 degrees. Converting a single colour
+// goes through the same code, so it gets the same answer as it would in a batch.
+// Without polar, chroma and hue are left empty and not worked out.
+void ConvertColours(ColourSpace space, const RGB* colours, size_t count, LabColumns& out, bool polar = true);
+
+// Chroma under which a colour is a grey and its hue means nothing, in space's units
+float AchromaticChroma(ColourSpace space);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit XXH64 hash of a byte range, used to recognise identical file contents
+uint64_t HashBytes(const void* data, size_t length, uint64_t seed = 0);
@@ -0,0 +1,63 @@
+#include "decoded_lru.h"
+
+DecodedImageCache::DecodedImageCache(size_t budgetBytes) : budget(budgetBytes) {
+}
+
+void DecodedImageCache::SetBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> guard(mutex);
+    budget = budgetBytes;
+}
+
+std::shared_ptr<const sf::Image> DecodedImageCache::Get(const std::string& fileName) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = lookup.find(fileName);
+    if (it == lookup.end()) {
+        stats.misses++;
+        return nullptr;
+    }
+
+    stats.hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->image;
+}
+
+bool DecodedImageCache::Contains(const std::string& fileName) {
+    std::lock_guard<std::mutex> guard(mutex);
+    return lookup.count(fileName) > 0;
+}
+
+void DecodedImageCache::Put(const std::string& fileName, std::shared_ptr<const sf::Image> image) {
+    size_t bytes = size_t(image->getSize().x) * image->getSize().y * 4;
+    // Something bigger than the whole budget would only flush everything else out
+    if (bytes > budget)
+        return;
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = lookup.find(fileName);
+    if (it != lookup.end()) {
+        stats.bytes -= it->second->bytes;
+        entries.erase(it->second);
+        lookup.erase(it);
+    }
+
+    entries.push_front({ fileName, std::move(image), bytes });
+    lookup[fileName] = entries.begin();
+    stats.bytes += bytes;
+
+    while (stats.bytes > budget) {
+        Entry& oldest = entries.back();
+        stats.bytes -= oldest.bytes;
+        stats.evictions++;
+        lookup.erase(oldest.fileName);
+        entries.pop_back();
+    }
+
+    stats.entries = entries.size();
+}
+
+DecodedImageCache::Stats DecodedImageCache::GetStats() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return stats;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Least recently used cache of decoded images, bounded by the bytes of pixels it holds
+class DecodedImageCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit DecodedImageCache(size_t budgetBytes);
+
+    // Change the budget, for a cache created before the options were read
+    void SetBudget(size_t budgetBytes);
+
+    // Look up an image the viewer wants to show, counted as a hit or a miss
+    std::shared_ptr<const sf::Image> Get(const std::string& fileName);
+
+    // True if the image is cached, without touching the counters or recency
+    bool Contains(const std::string& fileName);
+
+    // Insert or refresh an image, evicting the least recently used ones to fit the budget
+    void Put(const std::string& fileName, std::shared_ptr<const sf::Image> image);
+
+    Stats GetStats();
+
+private:
+    struct Entry {
+        std::string fileName;
+        std::shared_ptr<const sf::Image> image;
+        size_t bytes;
+    };
+
+    std::mutex mutex;
+    size_t budget;
+    // Most recently used at the front
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+    Stats stats;
+};
@@ -0,0 +1,118 @@
+#include "decoder.h"
+#include "buffer_pool.h"
+#include "mapped_file.h"
+
+#include <array>
+#include <climits>
+
+// SFML ships its own copy of stb_image, keep ours private to this file
+// Its buffers come from the pixel pool, so decoding doesn't go to the system once the pool is warm
+#define STBI_MALLOC(size) PixelBufferPool().Allocate(size)
+#define STBI_REALLOC(block, size) PixelBufferPool().Reallocate(block, size)
+#define STBI_FREE(block) PixelBufferPool().Free(block)
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+namespace {
+
+using DecodeFn = bool(*)(const unsigned char*, size_t, DecodedImage&, int);
+
+// All stb backed formats share one entry point, stb picks the codec from the same signature we sniffed
+bool DecodeWithStb(const unsigned char* bytes, size_t length, DecodedImage& out, int channels) {
+    if (length > size_t(INT_MAX))
+        return false;
+
+    int channelsInFile = 0;
+    stbi_uc* data = stbi_load_from_memory(bytes, int(length), &out.width, &out.height, &channelsInFile, channels);
+    if (data == nullptr)
+        return false;
+
+    out.channels = channels;
+    out.pixels = { data, stbi_image_free };
+    return true;
+}
+
+// Decoder per format, nullptr means the format is recognised but can't be decoded
+const std::array<DecodeFn, ImageFormatCount> decoders = [] {
+    std::array<DecodeFn, ImageFormatCount> table{};
+    table[int(ImageFormat::Jpeg)] = DecodeWithStb;
+    table[int(ImageFormat::Png)] = DecodeWithStb;
+    table[int(ImageFormat::Gif)] = DecodeWithStb;
+    table[int(ImageFormat::Bmp)] = DecodeWithStb;
+    table[int(ImageFormat::Psd)] = DecodeWithStb;
+    table[int(ImageFormat::Hdr)] = DecodeWithStb;
+    table[int(ImageFormat::Pic)] = DecodeWithStb;
+    table[int(ImageFormat::Pnm)] = DecodeWithStb;
+    table[int(ImageFormat::Tga)] = DecodeWithStb;
+    return table;
+}();
+
+}
+
+bool HasDecoder(ImageFormat format) {
+    return decoders[int(format)] != nullptr;
+}
+
+bool DecodeImage(const unsigned char* data, size_t length, ImageFormat format, DecodedImage& out, int channels) {
+    DecodeFn decode = decoders[int(format)];
+    if (decode == nullptr || data == nullptr)
+        return false;
+
+    return decode(data, length, out, channels);
+}
+
+bool ReadImageSize(const std::string& fileName, int& width, int& height) {
+    MappedFile file;
+    return file.Open(fileName) && ReadImageSize(file.Data(), file.Size(), width, height);
+}
+
+bool ReadImageSize(const unsigned char* data, size_t length, int& width, int& height) {
+    if (data == nullptr)
+        return false;
+
+    int channels = 0;
+    if (length <= size_t(INT_MAX) && stbi_info_from_memory(data, int(length), &width, &height, &channels) != 0)
+        return true;
+
+    // stb won't report a size it couldn't decode, the scanline decoders read past that
+    ScanlineDecoder rows;
+    if (!rows.Open(data, length, ImageFormat::Jpeg) && !rows.Open(data, length, ImageFormat::Png))
+        return false;
+    width = rows.Width();
+    height = rows.Height();
+    return true;
+}
+
+bool ScanlineDecoder::Open(const unsigned char* data, size_t length, ImageFormat type) {
+    format = type;
+    if (format == ImageFormat::Jpeg)
+        return jpeg.Open(data, length);
+    if (format == ImageFormat::Png)
+        return png.Open(data, length);
+    return false;
+}
+
+int ScanlineDecoder::Width() const {
+    return format == ImageFormat::Jpeg ? jpeg.Width() : png.Width();
+}
+
+int ScanlineDecoder::Height() const {
+    return format == ImageFormat::Jpeg ? jpeg.Height() : png.Height();
+}
+
+bool ScanlineDecoder::ReadRows(unsigned char* rgb, int count) {
+    if (format == ImageFormat::Jpeg)
+        return jpeg.ReadRows(rgb, count);
+    if (format == ImageFormat::Png)
+        return png.ReadRows(rgb, count);
+    return false;
+}
+
+bool DecodeImage(const std::string& fileName, ImageFormat format, DecodedImage& out, int channels) {
+    MappedFile file;
+    if (!HasDecoder(format) || !file.Open(fileName))
+        return false;
+
+    return DecodeImage(file.Data(), file.Size(), format, out, channels);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "image_format.h"
+#include "jpeg_scanlines.h"
+#include "png_scanlines.h"
+
+#include <memory>
+#include <string>
+
+// Pixels produced by a decoder, packed 8 bit rows of RGB or RGBA
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int channels = 3;
+    std::unique_ptr<unsigned char, void(*)(void*)> pixels{ nullptr, nullptr };
+};
+
+// True if a decoder is registered for this format
+bool HasDecoder(ImageFormat format);
+
+// Decode a file with the decoder registered for its sniffed format
+// Returns false if the format has no decoder or the file is corrupt
+// channels is 3 for RGB or 4 for RGBA
+bool DecodeImage(const std::string& fileName, ImageFormat format, DecodedImage& out, int channels = 3);
+
+// Read an image's size from its header without decoding the pixels
+bool ReadImageSize(const std::string& fileName, int& width, int& height);
+bool ReadImageSize(const unsigned char* data, size_t length, int& width, int& height);
+
+// Decode an encoded image already in memory, such as a mapped file
+bool DecodeImage(const unsigned char* data, size_t length, ImageFormat format, DecodedImage& out, int channels = 3);
+
+// Decodes an image a few rows at a time, for images too large to decode whole
+// Only baseline JPEG and non-interlaced PNG can be read this way, Open fails for anything else
+class ScanlineDecoder {
+public:
+    // data has to outlive the decoder
+    bool Open(const unsigned char* data, size_t length, ImageFormat format);
+
+    int Width() const;
+    int Height() const;
+
+    // Decode the next count rows as packed RGB, false if the file is damaged
+    bool ReadRows(unsigned char* rgb, int count);
+
+private:
+    ImageFormat format = ImageFormat::Unknown;
+    JpegScanlines jpeg;
+    PngScanlines png;
+};
@@ -0,0 +1,84 @@
+#include "dedup_index.h"
+
+DedupIndex::Claim DedupIndex::ClaimContent(Image& img) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = entries.find(img.contentHash);
+    if (it == entries.end()) {
+        Entry& entry = entries[img.contentHash];
+        entry.fileSize = img.fileSize;
+        entry.path = img.path;
+        return Claim::New;
+    }
+
+    Entry& entry = it->second;
+    // Same hash but a different length is a collision, not a copy
+    if (entry.fileSize != img.fileSize)
+        return Claim::New;
+
+    // The same file coming back through watch mode isn't a copy of itself
+    if (entry.path != img.path)
+        duplicates.emplace_back(img.FileName(), CatalogPaths().Path(entry.path));
+
+    if (!entry.known) {
+        entry.waiting.push_back(img);
+        return Claim::Waiting;
+    }
+
+    img.format = entry.format;
+    img.averageRgb = entry.averageRgb;
+    img.hsl = entry.hsl;
+    return Claim::Known;
+}
+
+std::vector<Image> DedupIndex::Complete(const Image& img) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = entries.find(img.contentHash);
+    if (it == entries.end()) {
+        it = entries.emplace(img.contentHash, Entry()).first;
+        it->second.fileSize = img.fileSize;
+        it->second.path = img.path;
+    }
+
+    Entry& entry = it->second;
+    if (entry.known || entry.fileSize != img.fileSize)
+        return {};
+
+    entry.known = true;
+    entry.format = img.format;
+    entry.averageRgb = img.averageRgb;
+    entry.hsl = img.hsl;
+
+    std::vector<Image> released = std::move(entry.waiting);
+    entry.waiting.clear();
+    for (auto& copy : released) {
+        copy.format = entry.format;
+        copy.averageRgb = entry.averageRgb;
+        copy.hsl = entry.hsl;
+    }
+
+    return released;
+}
+
+std::vector<Image> DedupIndex::Abandon(const Image& img) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = entries.find(img.contentHash);
+    if (it == entries.end() || it->second.path != img.path)
+        return {};
+
+    std::vector<Image> released = std::move(it->second.waiting);
+    entries.erase(it);
+    return released;
+}
+
+void DedupIndex::AddDuplicate(const std::string& copy, const std::string& original) {
+    std::lock_guard<std::mutex> guard(mutex);
+    duplicates.emplace_back(copy, original);
+}
+
+std::vector<std::pair<std::string, std::string>> DedupIndex::Duplicates() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return duplicates;
+}
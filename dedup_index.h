@@ -0,0 +1,54 @@
+#pragma once
+
+#include "image.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Results computed this run keyed by content hash, so identical files are only decoded once
+//
+// The first file with a given hash claims it and is decoded. Copies that arrive while it
+// is still in the pipeline are parked on its entry and released by Complete once the
+// results are known.
+class DedupIndex {
+public:
+    enum class Claim {
+        // No results for this content yet, the caller must decode it
+        New,
+        // Results were copied into img
+        Known,
+        // img was parked until the first copy completes
+        Waiting
+    };
+
+    Claim ClaimContent(Image& img);
+
+    // Record the results for img's content and return any parked copies, filled in
+    std::vector<Image> Complete(const Image& img);
+
+    // The first copy failed to decode, return the parked copies so they can be dropped
+    std::vector<Image> Abandon(const Image& img);
+
+    void AddDuplicate(const std::string& copy, const std::string& original);
+
+    // (copy, original) pairs found so far
+    std::vector<std::pair<std::string, std::string>> Duplicates() const;
+
+private:
+    struct Entry {
+        bool known = false;
+        uint64_t fileSize = 0;
+        PathId path;
+        ImageFormat format = ImageFormat::Unknown;
+        RGB averageRgb;
+        HSL hsl;
+        std::vector<Image> waiting;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::vector<std::pair<std::string, std::string>> duplicates;
+};
@@ -0,0 +1,321 @@
+#include "deep_zoom.h"
+#include "decoder.h"
+
+#include <SFML/Graphics/Sprite.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// How far past 100% (or past fitting, for small images) the view can zoom in
+constexpr double MaxZoom = 4;
+
+// Tile textures kept on the GPU, 256x256 RGBA each so about 48MB
+constexpr size_t MaxResidentTiles = 192;
+
+constexpr int MaxUploadsPerFrame = 16;
+
+}
+
+DeepZoomView::DeepZoomView(int viewWidth, int viewHeight, const std::string& pyramidFolder)
+    : viewWidth(viewWidth), viewHeight(viewHeight), folder(pyramidFolder) {
+    worker = std::thread(&DeepZoomView::Run, this);
+}
+
+DeepZoomView::~DeepZoomView() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+bool DeepZoomView::Open(const std::string& fileName) {
+    int width, height;
+    if (!ReadImageSize(fileName, width, height) || width <= 0 || height <= 0)
+        return false;
+
+    file = fileName;
+    imageWidth = width;
+    imageHeight = height;
+    fitScale = std::min(viewWidth / double(width), viewHeight / double(height));
+    scale = fitScale;
+    centreX = width / 2.0;
+    centreY = height / 2.0;
+    levels.clear();
+    tiles.clear();
+    lastWanted.clear();
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        generation++;
+        requestedFile = fileName;
+        queue.clear();
+        results.clear();
+    }
+    wake.notify_all();
+    return true;
+}
+
+void DeepZoomView::Close() {
+    file.clear();
+    levels.clear();
+    tiles.clear();
+    lastWanted.clear();
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        generation++;
+        requestedFile.clear();
+        queue.clear();
+        results.clear();
+    }
+    // The worker has to see the new generation too, Busy() is true until it does
+    wake.notify_all();
+}
+
+void DeepZoomView::ZoomAt(float factor, float x, float y) {
+    // Image point under (x, y)
+    double imageX = centreX + (x - viewWidth / 2.0) / scale;
+    double imageY = centreY + (y - viewHeight / 2.0) / scale;
+
+    scale = std::clamp(scale * factor, fitScale, std::max(1.0, fitScale) * MaxZoom);
+    centreX = imageX - (x - viewWidth / 2.0) / scale;
+    centreY = imageY - (y - viewHeight / 2.0) / scale;
+    ClampCentre();
+}
+
+void DeepZoomView::Pan(float dx, float dy) {
+    centreX += dx / scale;
+    centreY += dy / scale;
+    ClampCentre();
+}
+
+bool DeepZoomView::Zoomed() const {
+    return scale > fitScale * 1.0001;
+}
+
+void DeepZoomView::ClampCentre() {
+    // Keep the image against the window edges, or centred along an axis where it's smaller
+    double halfWidth = viewWidth / (2 * scale), halfHeight = viewHeight / (2 * scale);
+    centreX = imageWidth <= 2 * halfWidth ? imageWidth / 2.0 : std::clamp(centreX, halfWidth, imageWidth - halfWidth);
+    centreY = imageHeight <= 2 * halfHeight ? imageHeight / 2.0 : std::clamp(centreY, halfHeight, imageHeight - halfHeight);
+}
+
+int DeepZoomView::Level() const {
+    // The smallest level that still has at least one pixel per screen pixel
+    if (scale >= 1)
+        return 0;
+    return std::min(int(levels.size()) - 1, int(std::floor(std::log2(1 / scale))));
+}
+
+void DeepZoomView::VisibleTiles(int level, std::vector<TileKey>& out) const {
+    const auto& l = levels[level];
+    double levelX = double(l.width) / imageWidth, levelY = double(l.height) / imageHeight;
+
+    double left = (centreX - viewWidth / (2 * scale)) * levelX;
+    double right = (centreX + viewWidth / (2 * scale)) * levelX;
+    double top = (centreY - viewHeight / (2 * scale)) * levelY;
+    double bottom = (centreY + viewHeight / (2 * scale)) * levelY;
+
+    int firstColumn = std::max(0, int(left / PyramidTileSize));
+    int lastColumn = std::min(l.columns - 1, int(std::ceil(right / PyramidTileSize)) - 1);
+    int firstRow = std::max(0, int(top / PyramidTileSize));
+    int lastRow = std::min(l.rows - 1, int(std::ceil(bottom / PyramidTileSize)) - 1);
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int column = firstColumn; column <= lastColumn; column++)
+            out.push_back({ level, column, row });
+    }
+}
+
+bool DeepZoomView::Update() {
+    frame++;
+    if (!IsOpen())
+        return false;
+
+    bool changed = false;
+    std::vector<DecodedTile> arrived;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (levels.empty() && preparedGeneration == generation && !preparedLevels.empty()) {
+            levels = preparedLevels;
+            changed = true;
+        }
+
+        while (!results.empty() && int(arrived.size()) < MaxUploadsPerFrame) {
+            if (results.front().generation == generation)
+                arrived.push_back(std::move(results.front()));
+            results.pop_front();
+        }
+    }
+
+    // A tile that failed to decode is kept without a texture so it isn't asked for again
+    for (auto& tile : arrived) {
+        ResidentTile resident;
+        if (tile.width > 0) {
+            resident.texture = std::make_unique<sf::Texture>();
+            resident.texture->create(unsigned(tile.width), unsigned(tile.height));
+            resident.texture->update(tile.pixels.data(), unsigned(tile.width), unsigned(tile.height), 0, 0);
+            resident.texture->setSmooth(true);
+        }
+        resident.lastUsed = frame;
+        tiles[tile.key.Packed()] = std::move(resident);
+        changed = true;
+    }
+
+    if (levels.empty())
+        return changed;
+
+    std::vector<TileKey> visible, wanted;
+    VisibleTiles(Level(), visible);
+    for (auto& key : visible) {
+        auto it = tiles.find(key.Packed());
+        if (it != tiles.end())
+            it->second.lastUsed = frame;
+        else
+            wanted.push_back(key);
+    }
+
+    if (wanted != lastWanted) {
+        RequestTiles(wanted);
+        lastWanted = std::move(wanted);
+    }
+
+    // Drop the tiles that have gone longest without being on screen
+    while (tiles.size() > MaxResidentTiles) {
+        auto oldest = tiles.end();
+        for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+            if (it->second.lastUsed < frame && (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+                oldest = it;
+        }
+        if (oldest == tiles.end())
+            break;
+        tiles.erase(oldest);
+    }
+
+    return changed;
+}
+
+bool DeepZoomView::Busy() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return preparedGeneration != generation || !queue.empty() || decoding || !results.empty();
+}
+
+void DeepZoomView::Draw(sf::RenderTarget& target, const sf::Texture* fallback) {
+    float left = float(viewWidth / 2.0 - centreX * scale);
+    float top = float(viewHeight / 2.0 - centreY * scale);
+
+    if (fallback != nullptr && fallback->getSize().x > 0 && fallback->getSize().y > 0) {
+        sf::Sprite sprite(*fallback);
+        sprite.setPosition(left, top);
+        sprite.setScale(float(imageWidth * scale / fallback->getSize().x), float(imageHeight * scale / fallback->getSize().y));
+        target.draw(sprite);
+    }
+
+    if (levels.empty())
+        return;
+
+    int level = Level();
+    const auto& l = levels[level];
+    // Screen pixels per level pixel
+    double tileScaleX = scale * imageWidth / l.width, tileScaleY = scale * imageHeight / l.height;
+
+    std::vector<TileKey> visible;
+    VisibleTiles(level, visible);
+    for (auto& key : visible) {
+        auto it = tiles.find(key.Packed());
+        if (it == tiles.end() || !it->second.texture)
+            continue;
+
+        sf::Sprite sprite(*it->second.texture);
+        sprite.setPosition(float(left + key.column * PyramidTileSize * tileScaleX), float(top + key.row * PyramidTileSize * tileScaleY));
+        sprite.setScale(float(tileScaleX), float(tileScaleY));
+        target.draw(sprite);
+    }
+}
+
+void DeepZoomView::RequestTiles(const std::vector<TileKey>& wanted) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        queue.clear();
+        for (auto& key : wanted) {
+            // Already on its way
+            if (decoding && key == decodingKey)
+                continue;
+            if (std::any_of(results.begin(), results.end(), [&](const DecodedTile& t) { return t.key == key; }))
+                continue;
+            queue.push_back(key);
+        }
+    }
+    wake.notify_all();
+}
+
+bool DeepZoomView::PreparePyramid(const std::string& fileName, TilePyramid& out) {
+    std::error_code error;
+    fs::path path = fs::u8path(fileName);
+    uint64_t size = fs::file_size(path, error);
+    if (error)
+        return false;
+    int64_t modified = fs::last_write_time(path, error).time_since_epoch().count();
+
+    std::string pyramidFile = PyramidFileName(folder, fileName);
+    if (out.Open(pyramidFile, size, modified))
+        return true;
+
+    return BuildTilePyramid(fileName, size, modified, pyramidFile) && out.Open(pyramidFile, size, modified);
+}
+
+void DeepZoomView::Run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stop || preparedGeneration != generation || !queue.empty(); });
+        if (stop)
+            return;
+
+        // A newly opened image: map its pyramid, building it first if there isn't a current one
+        if (preparedGeneration != generation) {
+            uint64_t opened = generation;
+            std::string fileName = requestedFile;
+            lock.unlock();
+
+            // Unmap the last pyramid first, it may be the stale one about to be replaced
+            pyramid = TilePyramid();
+            TilePyramid fresh;
+            bool ready = !fileName.empty() && PreparePyramid(fileName, fresh);
+
+            lock.lock();
+            pyramid = std::move(fresh);
+            preparedGeneration = opened;
+            preparedLevels = ready ? pyramid.Levels() : std::vector<TilePyramid::Level>();
+            continue;
+        }
+
+        DecodedTile tile;
+        tile.generation = generation;
+        tile.key = queue.front();
+        queue.pop_front();
+        decoding = true;
+        decodingKey = tile.key;
+        lock.unlock();
+
+        const unsigned char* data;
+        size_t length;
+        DecodedImage decoded;
+        if (pyramid.Tile(tile.key.level, tile.key.column, tile.key.row, data, length) &&
+            DecodeImage(data, length, ImageFormat::Jpeg, decoded, 4)) {
+            tile.width = decoded.width;
+            tile.height = decoded.height;
+            tile.pixels.assign(decoded.pixels.get(), decoded.pixels.get() + size_t(decoded.width) * decoded.height * 4);
+        }
+
+        lock.lock();
+        decoding = false;
+        results.push_back(std::move(tile));
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "tile_pyramid.h"
+
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Texture.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Zoom and pan over one image using its tile pyramid
+//
+// Opening an image maps its cached pyramid, or builds one on a background thread the first time.
+// Only the tiles under the window are decoded and uploaded, from the level closest to the
+// screen resolution, and a bounded number of tile textures is kept, so memory doesn't grow with
+// the size of the image. Until the tiles arrive the image the viewer already has is stretched
+// underneath.
+class DeepZoomView {
+public:
+    DeepZoomView(int viewWidth, int viewHeight, const std::string& pyramidFolder);
+    ~DeepZoomView();
+
+    DeepZoomView(const DeepZoomView&) = delete;
+    DeepZoomView& operator=(const DeepZoomView&) = delete;
+
+    // Start viewing fileName fitted to the window, false if its size can't be read
+    bool Open(const std::string& fileName);
+    void Close();
+    bool IsOpen() const { return !file.empty(); }
+    const std::string& FileName() const { return file; }
+
+    // Scale by factor keeping the image point under (x, y) in place
+    void ZoomAt(float factor, float x, float y);
+    // Move the view by screen pixels
+    void Pan(float dx, float dy);
+    // True while zoomed in past fitting the window
+    bool Zoomed() const;
+
+    // Upload tiles that have arrived and queue the visible ones that are missing
+    // Returns true if anything new needs drawing
+    bool Update();
+
+    // True while a pyramid is being built or tiles are on their way
+    bool Busy();
+
+    // Draw the visible tiles over fallback, a smaller copy of the whole image stretched to fit
+    void Draw(sf::RenderTarget& target, const sf::Texture* fallback);
+
+private:
+    struct TileKey {
+        int level;
+        int column;
+        int row;
+
+        bool operator==(const TileKey& other) const { return level == other.level && column == other.column && row == other.row; }
+        uint64_t Packed() const { return uint64_t(level) << 48 | uint64_t(row) << 24 | uint64_t(column); }
+    };
+
+    struct DecodedTile {
+        uint64_t generation;
+        TileKey key;
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct ResidentTile {
+        std::unique_ptr<sf::Texture> texture;
+        uint64_t lastUsed = 0;
+    };
+
+    int Level() const;
+    void VisibleTiles(int level, std::vector<TileKey>& out) const;
+    void ClampCentre();
+    void RequestTiles(const std::vector<TileKey>& wanted);
+
+    // Background thread
+    void Run();
+    bool PreparePyramid(const std::string& fileName, TilePyramid& out);
+
+    int viewWidth;
+    int viewHeight;
+    std::string folder;
+
+    // Main thread view state, in full resolution image pixels
+    std::string file;
+    int imageWidth = 0;
+    int imageHeight = 0;
+    double scale = 1;
+    double fitScale = 1;
+    double centreX = 0;
+    double centreY = 0;
+    std::vector<TilePyramid::Level> levels;
+
+    uint64_t frame = 0;
+    std::unordered_map<uint64_t, ResidentTile> tiles;
+    std::vector<TileKey> lastWanted;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+    bool stop = false;
+    // Bumped by every Open, the worker drops work for older generations
+    uint64_t generation = 0;
+    uint64_t preparedGeneration = 0;
+    std::string requestedFile;
+    // Levels of the prepared pyramid, empty if it couldn't be built
+    std::vector<TilePyramid::Level> preparedLevels;
+    TilePyramid pyramid;
+    std::deque<TileKey> queue;
+    bool decoding = false;
+    TileKey decodingKey = {};
+    std::deque<DecodedTile> results;
+};
@@ -0,0 +1,158 @@
+#include "dir_watcher.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+DirectoryWatcher::DirectoryWatcher(std::chrono::milliseconds debounce) : debounce(debounce) {
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+#ifdef __linux__
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+#endif
+}
+
+void DirectoryWatcher::CollectSettled(std::vector<FileChange>& ready) {
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto it = pending.begin(); it != pending.end();) {
+        if (now - it->second.lastEvent >= debounce) {
+            ready.push_back({ it->first, it->second.removed });
+            it = pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+#ifdef __linux__
+
+bool DirectoryWatcher::Watch(const std::string& folder) {
+    if (inotifyFd < 0)
+        return false;
+
+    uint32_t mask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+    int wd = inotify_add_watch(inotifyFd, folder.c_str(), mask);
+    if (wd < 0)
+        return false;
+
+    watchedFolders[wd] = folder;
+    return true;
+}
+
+std::vector<FileChange> DirectoryWatcher::Wait(const std::atomic<bool>& stop) {
+    std::vector<FileChange> ready;
+    alignas(inotify_event) char buffer[16 * 1024];
+
+    while (ready.empty() && !stop) {
+        // Sleep until the oldest pending change could have settled
+        auto timeout = std::chrono::milliseconds(250);
+        if (!pending.empty()) {
+            auto now = std::chrono::steady_clock::now();
+            for (auto& entry : pending) {
+                auto due = std::chrono::duration_cast<std::chrono::milliseconds>(entry.second.lastEvent + debounce - now);
+                timeout = std::min(timeout, std::max(due, std::chrono::milliseconds(1)));
+            }
+        }
+
+        pollfd fd = { inotifyFd, POLLIN, 0 };
+        if (poll(&fd, 1, int(timeout.count())) > 0) {
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                auto now = std::chrono::steady_clock::now();
+
+                for (char* p = buffer; p < buffer + length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(p);
+                    p += sizeof(inotify_event) + event->len;
+
+                    // The kernel's queue filled up and dropped events, every folder has to be looked at again
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        for (auto& watched : watchedFolders)
+                            ready.push_back({ watched.second, false, true });
+                        continue;
+                    }
+
+                    auto folder = watchedFolders.find(event->wd);
+                    if (event->len == 0 || (event->mask & IN_ISDIR) || folder == watchedFolders.end())
+                        continue;
+
+                    auto& change = pending[(fs::path(folder->second) / event->name).u8string()];
+                    change.removed = (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+                    change.lastEvent = now;
+                }
+            }
+        }
+
+        CollectSettled(ready);
+    }
+
+    return ready;
+}
+
+#else
+
+bool DirectoryWatcher::Watch(const std::string& folder) {
+    std::error_code error;
+    if (!fs::is_directory(folder, error))
+        return false;
+
+    folders.push_back(folder);
+    for (auto& p : fs::directory_iterator(folder, error)) {
+        if (p.is_regular_file(error))
+            known[p.path().u8string()] = { p.file_size(error), p.last_write_time(error).time_since_epoch().count() };
+    }
+    return true;
+}
+
+std::vector<FileChange> DirectoryWatcher::Wait(const std::atomic<bool>& stop) {
+    std::vector<FileChange> ready;
+
+    while (ready.empty() && !stop) {
+        std::this_thread::sleep_for(debounce);
+
+        auto now = std::chrono::steady_clock::now();
+        std::unordered_map<std::string, Snapshot> current;
+        std::error_code error;
+
+        for (auto& folder : folders) {
+            for (auto& p : fs::directory_iterator(folder, error)) {
+                if (!p.is_regular_file(error))
+                    continue;
+
+                std::string fileName = p.path().u8string();
+                Snapshot snapshot = { p.file_size(error), p.last_write_time(error).time_since_epoch().count() };
+
+                auto it = known.find(fileName);
+                if (it == known.end() || it->second.size != snapshot.size || it->second.modifiedTime != snapshot.modifiedTime)
+                    pending[fileName] = { false, now };
+                current[fileName] = snapshot;
+            }
+        }
+
+        for (auto& entry : known) {
+            if (current.find(entry.first) == current.end())
+                pending[entry.first] = { true, now };
+        }
+        known = std::move(current);
+
+        CollectSettled(ready);
+    }
+
+    return ready;
+}
+
+#endif
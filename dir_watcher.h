@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A file that was created, modified or removed in a watched folder
+// With rescan set fileName is a watched folder whose events were lost, anything in it may have changed
+struct FileChange {
+    std::string fileName;
+    bool removed = false;
+    bool rescan = false;
+};
+
+// Reports changes to the files in a set of folders, with bursts of events on one file
+// coalesced until it has been quiet for the debounce interval
+//
+// Uses inotify on Linux. Elsewhere the folders are polled and a file is reported once
+// its size and mtime have stopped changing between two polls.
+class DirectoryWatcher {
+public:
+    explicit DirectoryWatcher(std::chrono::milliseconds debounce = std::chrono::milliseconds(500));
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    bool Watch(const std::string& folder);
+
+    // Block until at least one debounced change is ready or stop is set
+    std::vector<FileChange> Wait(const std::atomic<bool>& stop);
+
+private:
+    struct Pending {
+        bool removed = false;
+        std::chrono::steady_clock::time_point lastEvent;
+    };
+
+    // Move changes that have been quiet for the debounce interval into ready
+    void CollectSettled(std::vector<FileChange>& ready);
+
+    std::chrono::milliseconds debounce;
+    std::unordered_map<std::string, Pending> pending;
+
+#ifdef __linux__
+    int inotifyFd = -1;
+    std::unordered_map<int, std::string> watchedFolders;
+#else
+    struct Snapshot {
+        uint64_t size = 0;
+        int64_t modifiedTime = 0;
+    };
+
+    std::vector<std::string> folders;
+    std::unordered_map<std::string, Snapshot> known;
+#endif
+};
@@ -0,0 +1,104 @@
+#include "exif_thumbnail.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr uint16_t ThumbnailOffsetTag = 0x0201;
+constexpr uint16_t ThumbnailLengthTag = 0x0202;
+constexpr size_t IfdEntrySize = 12;
+
+// Reads TIFF integers in the byte order the Exif block declares
+struct TiffReader {
+    const unsigned char* base;
+    size_t length;
+    bool bigEndian;
+
+    bool Read16(size_t offset, uint16_t& out) const {
+        if (offset + 2 > length)
+            return false;
+        const unsigned char* p = base + offset;
+        out = bigEndian ? uint16_t(p[0] << 8 | p[1]) : uint16_t(p[1] << 8 | p[0]);
+        return true;
+    }
+
+    bool Read32(size_t offset, uint32_t& out) const {
+        if (offset + 4 > length)
+            return false;
+        const unsigned char* p = base + offset;
+        out = bigEndian ? uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3]
+                        : uint32_t(p[3]) << 24 | uint32_t(p[2]) << 16 | uint32_t(p[1]) << 8 | p[0];
+        return true;
+    }
+};
+
+// Look for the thumbnail in the TIFF structure of an Exif APP1 payload
+bool FindInTiff(const unsigned char* tiff, size_t length, const unsigned char*& jpeg, size_t& jpegLength) {
+    if (length < 8)
+        return false;
+
+    TiffReader reader{ tiff, length, false };
+    if (std::memcmp(tiff, "MM", 2) == 0)
+        reader.bigEndian = true;
+    else if (std::memcmp(tiff, "II", 2) != 0)
+        return false;
+
+    // IFD0 describes the main image, the thumbnail is in IFD1 which follows it
+    uint32_t ifd0, ifd1;
+    uint16_t entries;
+    if (!reader.Read32(4, ifd0) || !reader.Read16(ifd0, entries) || !reader.Read32(ifd0 + 2 + size_t(entries) * IfdEntrySize, ifd1) || ifd1 == 0)
+        return false;
+    if (!reader.Read16(ifd1, entries))
+        return false;
+
+    uint32_t offset = 0, size = 0;
+    for (uint16_t i = 0; i < entries; i++) {
+        size_t entry = ifd1 + 2 + size_t(i) * IfdEntrySize;
+        uint16_t tag;
+        uint32_t value;
+        if (!reader.Read16(entry, tag) || !reader.Read32(entry + 8, value))
+            return false;
+
+        if (tag == ThumbnailOffsetTag)
+            offset = value;
+        else if (tag == ThumbnailLengthTag)
+            size = value;
+    }
+
+    if (offset == 0 || size < 4 || offset > length || size > length - offset)
+        return false;
+    if (tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8)
+        return false;
+
+    jpeg = tiff + offset;
+    jpegLength = size;
+    return true;
+}
+
+}
+
+bool FindExifThumbnail(const unsigned char* data, size_t length, const unsigned char*& jpeg, size_t& jpegLength) {
+    if (data == nullptr || length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    // Walk the marker segments up to the start of the image data, Exif is one of the first
+    size_t position = 2;
+    while (position + 4 <= length && data[position] == 0xFF) {
+        unsigned char marker = data[position + 1];
+        if (marker == 0xDA || marker == 0xD9)
+            return false;
+
+        size_t segmentLength = size_t(data[position + 2]) << 8 | data[position + 3];
+        if (segmentLength < 2 || position + 2 + segmentLength > length)
+            return false;
+
+        const unsigned char* payload = data + position + 4;
+        size_t payloadLength = segmentLength - 2;
+        if (marker == 0xE1 && payloadLength > 6 && std::memcmp(payload, "Exif\0\0", 6) == 0)
+            return FindInTiff(payload + 6, payloadLength - 6, jpeg, jpegLength);
+
+        position += 2 + segmentLength;
+    }
+    return false;
+}
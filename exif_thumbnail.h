@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Find the JPEG thumbnail most cameras embed in the Exif block of a JPEG
+// Points jpeg into data, returns false if the file has no Exif thumbnail
+bool FindExifThumbnail(const unsigned char* data, size_t length, const unsigned char*& jpeg, size_t& jpegLength);
@@ -0,0 +1,282 @@
+#include "external_sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char OrderMagic[4] = { 'I', 'V', 'S', 'O' };
+constexpr char PathsMagic[4] = { 'I', 'V', 'S', 'P' };
+constexpr uint32_t OrderVersion = 1;
+constexpr size_t PathsHeaderSize = 8;
+
+struct OrderHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+};
+static_assert(sizeof(OrderHeader) == sizeof(OrderRecord), "records start aligned after the header");
+
+constexpr const char* OrderFile = "order.bin";
+constexpr const char* PathsFile = "paths.bin";
+// Records written or read at a time, and the fewest a merge buffer holds however many runs there are
+constexpr size_t BlockRecords = 4096;
+// Below this the buffer is too small to be worth a run file each
+constexpr size_t MinimumBufferRecords = 1 << 16;
+
+std::string Join(const std::string& folder, const char* name) {
+    return (fs::u8path(folder) / name).u8string();
+}
+
+// A run file read a block at a time
+struct RunReader {
+    std::ifstream in;
+    std::vector<OrderRecord> block;
+    size_t next = 0;
+    size_t filled = 0;
+
+    bool Refill() {
+        in.read(reinterpret_cast<char*>(block.data()), std::streamsize(block.size() * sizeof(OrderRecord)));
+        filled = size_t(in.gcount()) / sizeof(OrderRecord);
+        next = 0;
+        return filled > 0;
+    }
+};
+
+// Buffered writes of records
+class RecordWriter {
+public:
+    explicit RecordWriter(std::ofstream& out) : out(out) { block.reserve(BlockRecords); }
+    ~RecordWriter() { Flush(); }
+
+    void Put(const OrderRecord& record) {
+        block.push_back(record);
+        if (block.size() == BlockRecords)
+            Flush();
+    }
+
+    void Flush() {
+        out.write(reinterpret_cast<const char*>(block.data()), std::streamsize(block.size() * sizeof(OrderRecord)));
+        block.clear();
+    }
+
+private:
+    std::ofstream& out;
+    std::vector<OrderRecord> block;
+};
+
+bool WriteOrderHeader(std::ofstream& out, uint64_t count) {
+    OrderHeader header;
+    std::memcpy(header.magic, OrderMagic, sizeof(OrderMagic));
+    header.version = OrderVersion;
+    header.count = count;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return bool(out);
+}
+
+// Write to a temporary name and rename over the order, so a reader never maps half of one
+bool ReplaceOrder(const std::string& folder, const std::function<bool(std::ofstream&)>& write) {
+    fs::path target = fs::u8path(Join(folder, OrderFile));
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out || !write(out))
+            return false;
+        out.flush();
+        if (!out)
+            return false;
+    }
+
+    std::error_code error;
+    fs::rename(temp, target, error);
+    return !error;
+}
+
+}
+
+bool ExternalSorter::Open(const std::string& outputFolder, size_t memoryBytes) {
+    folder = outputFolder;
+    std::error_code error;
+    fs::create_directories(fs::u8path(folder), error);
+
+    // Each buffered record also needs a (key, index) pair and its scratch copy to be sorted
+    bufferRecords = std::max(memoryBytes / (sizeof(OrderRecord) + 2 * sizeof(KeyedId)), MinimumBufferRecords);
+    mergeBytes = std::max(memoryBytes, MinimumBufferRecords * sizeof(OrderRecord));
+    buffer.clear();
+    buffer.reserve(bufferRecords);
+    stats = {};
+
+    paths.open(fs::u8path(Join(folder, PathsFile)), std::ios::binary | std::ios::trunc);
+    paths.write(PathsMagic, sizeof(PathsMagic));
+    paths.write(reinterpret_cast<const char*>(&OrderVersion), sizeof(OrderVersion));
+    stats.pathBytes = PathsHeaderSize;
+    return bool(paths);
+}
+
+void ExternalSorter::Add(uint32_t key, std::string_view path) {
+    // Lengths are 16 bit like the path arena's, no file system allows longer names
+    uint16_t length = uint16_t(std::min(path.size(), size_t(UINT16_MAX)));
+    paths.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    paths.write(path.data(), length);
+
+    buffer.push_back({ key, 0, stats.pathBytes });
+    stats.pathBytes += sizeof(length) + length;
+    stats.records++;
+
+    if (buffer.size() >= bufferRecords)
+        SpillRun();
+}
+
+void ExternalSorter::SortBuffer() {
+    keyed.resize(buffer.size());
+    for (size_t i = 0; i < buffer.size(); i++)
+        keyed[i] = { buffer[i].key, uint32_t(i) };
+    RadixSort(keyed, scratch);
+}
+
+std::string ExternalSorter::RunFile(int run) const {
+    std::string name = "run_" + std::to_string(run) + ".bin";
+    return Join(folder, name.c_str());
+}
+
+bool ExternalSorter::SpillRun() {
+    SortBuffer();
+    std::ofstream out(fs::u8path(RunFile(stats.runs)), std::ios::binary | std::ios::trunc);
+    {
+        RecordWriter writer(out);
+        for (const KeyedId& item : keyed)
+            writer.Put(buffer[item.id]);
+    }
+
+    stats.runs++;
+    buffer.clear();
+    return bool(out);
+}
+
+bool ExternalSorter::MergeRuns() {
+    // Memory is split between one buffer per run and the output
+    size_t perRun = std::max(mergeBytes / sizeof(OrderRecord) / size_t(stats.runs + 1), BlockRecords);
+    std::vector<std::unique_ptr<RunReader>> runs;
+    for (int run = 0; run < stats.runs; run++) {
+        auto reader = std::make_unique<RunReader>();
+        reader->in.open(fs::u8path(RunFile(run)), std::ios::binary);
+        reader->block.resize(perRun);
+        if (!reader->in)
+            return false;
+        reader->Refill();
+        runs.push_back(std::move(reader));
+    }
+
+    // Smallest key first, then the earlier run so equal keys stay in arrival order
+    using Head = std::pair<uint32_t, int>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (int run = 0; run < stats.runs; run++) {
+        if (runs[run]->filled > 0)
+            heads.emplace(runs[run]->block[0].key, run);
+    }
+
+    bool written = ReplaceOrder(folder, [&](std::ofstream& out) {
+        if (!WriteOrderHeader(out, stats.records))
+            return false;
+
+        RecordWriter writer(out);
+        while (!heads.empty()) {
+            int run = heads.top().second;
+            heads.pop();
+
+            RunReader& reader = *runs[run];
+            writer.Put(reader.block[reader.next++]);
+            if (reader.next < reader.filled || reader.Refill())
+                heads.emplace(reader.block[reader.next].key, run);
+        }
+        writer.Flush();
+        return bool(out);
+    });
+
+    runs.clear();
+    for (int run = 0; run < stats.runs; run++) {
+        std::error_code error;
+        fs::remove(fs::u8path(RunFile(run)), error);
+    }
+    return written;
+}
+
+bool ExternalSorter::Finish() {
+    paths.close();
+
+    // Everything fitted in memory, it goes straight to the order
+    if (stats.runs == 0) {
+        SortBuffer();
+        bool written = ReplaceOrder(folder, [&](std::ofstream& out) {
+            if (!WriteOrderHeader(out, stats.records))
+                return false;
+            RecordWriter writer(out);
+            for (const KeyedId& item : keyed)
+                writer.Put(buffer[item.id]);
+            writer.Flush();
+            return bool(out);
+        });
+        buffer.clear();
+        return written;
+    }
+
+    if (!buffer.empty() && !SpillRun())
+        return false;
+
+    // The merge buffers get the memory the sort buffers had
+    std::vector<OrderRecord>().swap(buffer);
+    std::vector<KeyedId>().swap(keyed);
+    std::vector<KeyedId>().swap(scratch);
+    return MergeRuns();
+}
+
+bool SortedOrder::Open(const std::string& folder) {
+    order.Close();
+    paths.Close();
+    count = 0;
+    if (!order.Open(Join(folder, OrderFile)) || !paths.Open(Join(folder, PathsFile)))
+        return false;
+
+    OrderHeader header;
+    if (order.Size() < sizeof(header))
+        return false;
+    std::memcpy(&header, order.Data(), sizeof(header));
+    if (std::memcmp(header.magic, OrderMagic, sizeof(OrderMagic)) != 0 || header.version != OrderVersion ||
+        header.count > (order.Size() - sizeof(header)) / sizeof(OrderRecord))
+        return false;
+
+    count = header.count;
+    return true;
+}
+
+OrderRecord SortedOrder::Record(uint64_t index) const {
+    OrderRecord record;
+    std::memcpy(&record, order.Data() + sizeof(OrderHeader) + index * sizeof(OrderRecord), sizeof(record));
+    return record;
+}
+
+uint32_t SortedOrder::Key(uint64_t index) const {
+    return index < count ? Record(index).key : 0;
+}
+
+std::string SortedOrder::Path(uint64_t index) const {
+    if (index >= count)
+        return {};
+
+    uint64_t offset = Record(index).pathOffset;
+    uint16_t length;
+    if (offset + sizeof(length) > paths.Size())
+        return {};
+    std::memcpy(&length, paths.Data() + offset, sizeof(length));
+    if (offset + sizeof(length) + length > paths.Size())
+        return {};
+    return std::string(reinterpret_cast<const char*>(paths.Data() + offset + sizeof(length)), length);
+}
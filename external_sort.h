@@ -0,0 +1,80 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "sort_keys.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One image in the external order: its sort value and where its path is in the path file
+struct OrderRecord {
+    uint32_t key;
+    uint32_t unused;
+    uint64_t pathOffset;
+};
+static_assert(sizeof(OrderRecord) == 16, "order records are written to disk as they are");
+
+// Sorts more images than fit in memory
+//
+// Paths are appended to a path file as results arrive and only a compact (key, path offset)
+// record is kept. Once the records reach the memory limit they're radix sorted and spilled to
+// a run file. Finish merges the runs k ways, reading each through a buffer sized so the merge
+// stays within the same limit, into an order file that SortedOrder maps. Equal keys keep the
+// order the results arrived in.
+class ExternalSorter {
+public:
+    struct Stats {
+        uint64_t records = 0;
+        int runs = 0;
+        uint64_t pathBytes = 0;
+    };
+
+    // Runs, paths and the order go in folder, memoryBytes bounds the records held at once
+    bool Open(const std::string& folder, size_t memoryBytes);
+    bool IsOpen() const { return paths.is_open(); }
+
+    void Add(uint32_t key, std::string_view path);
+    uint64_t Count() const { return stats.records; }
+
+    // Merge everything added into the order file, false if a file couldn't be written
+    bool Finish();
+
+    Stats GetStats() const { return stats; }
+
+private:
+    // Sort the buffered records by key, stable so arrival order breaks ties
+    void SortBuffer();
+    bool SpillRun();
+    bool MergeRuns();
+    std::string RunFile(int run) const;
+
+    std::string folder;
+    size_t bufferRecords = 0;
+    size_t mergeBytes = 0;
+    std::vector<OrderRecord> buffer;
+    std::vector<KeyedId> keyed;
+    std::vector<KeyedId> scratch;
+    std::ofstream paths;
+    Stats stats;
+};
+
+// The order an ExternalSorter wrote, mapped so the viewer can page through it without loading it
+class SortedOrder {
+public:
+    bool Open(const std::string& folder);
+    bool IsOpen() const { return order.IsOpen(); }
+
+    uint64_t Size() const { return count; }
+    uint32_t Key(uint64_t index) const;
+    std::string Path(uint64_t index) const;
+
+private:
+    OrderRecord Record(uint64_t index) const;
+
+    MappedFile order;
+    MappedFile paths;
+    uint64_t count = 0;
+};
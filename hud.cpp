@@ -0,0 +1,117 @@
+#include "hud.h"
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <SFML/Graphics/Vertex.hpp>
+
+#include <iostream>
+
+namespace {
+
+// Tried in order when no font is given or it won't load
+const char* const SystemFonts[] = {
+    "C:/Windows/Fonts/consola.ttf",
+    "C:/Windows/Fonts/arial.ttf",
+    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+    "/System/Library/Fonts/Menlo.ttc",
+};
+
+constexpr unsigned CharacterSize = 14;
+constexpr float Margin = 8;
+constexpr auto RefreshInterval = std::chrono::milliseconds(250);
+
+}
+
+bool Hud::LoadFont(const std::string& preferred) {
+    hasFont = !preferred.empty() && font.loadFromFile(preferred);
+    for (auto path : SystemFonts) {
+        if (hasFont)
+            break;
+        hasFont = font.loadFromFile(path);
+    }
+
+    if (hasFont) {
+        text.setFont(font);
+        text.setCharacterSize(CharacterSize);
+        text.setFillColor(sf::Color::White);
+        text.setPosition(Margin * 2, Margin * 2);
+    }
+    return hasFont;
+}
+
+void Hud::Toggle() {
+    if (!hasFont) {
+        std::cout << "No font for the HUD, pass one with --font <ttf>" << std::endl;
+        return;
+    }
+
+    visible = !visible;
+    rateStarted = false;
+    imagesPerSecond = 0;
+}
+
+bool Hud::Due() const {
+    return visible && std::chrono::steady_clock::now() - lastDrawn >= RefreshInterval;
+}
+
+void Hud::Draw(sf::RenderTarget& target, const HudStats& stats) {
+    if (!visible)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    lastDrawn = now;
+
+    // The first sample only sets the baseline
+    std::chrono::duration<double> sinceSample = now - rateStart;
+    if (!rateStarted || stats.processed < rateProcessed) {
+        rateStarted = true;
+        rateStart = now;
+        rateProcessed = stats.processed;
+    }
+    else if (sinceSample.count() >= 1) {
+        imagesPerSecond = (stats.processed - rateProcessed) / sinceSample.count();
+        rateStart = now;
+        rateProcessed = stats.processed;
+    }
+
+    fmt::memory_buffer out;
+    fmt::format_to(out, "frame      {:6.2f} ms\n", stats.frameMs);
+    fmt::format_to(out, "proxy      {:6.1f} ms{}\n", stats.proxyMs, stats.proxyShown ? " (showing)" : "");
+    if (stats.proxyShown)
+        fmt::format_to(out, "decode      pending\n");
+    else if (stats.fromCache)
+        fmt::format_to(out, "decode       cached\n");
+    else
+        fmt::format_to(out, "decode     {:6.1f} ms\n", stats.decodeMs);
+    fmt::format_to(out, "upload     {:6.2f} ms\n", stats.uploadMs);
+
+    fmt::format_to(out, "\npipeline   {} / {}{}\n", stats.processed, stats.total, stats.scanning ? " (scanning)" : "");
+    fmt::format_to(out, "rate       {:.0f} images/s\n", imagesPerSecond);
+    fmt::format_to(out, "sorted by  {} ({:.1f} ms)\n", stats.sortKey, stats.sortMs);
+    for (auto& queue : stats.queues)
+        fmt::format_to(out, "  {:<14}{:>6}\n", queue.first, queue.second);
+    fmt::format_to(out, "in flight  {} / {} MB, peak {} MB\n", stats.inFlightBytes >> 20, stats.inFlightLimit >> 20, stats.inFlightPeak >> 20);
+
+    uint64_t lookups = stats.navigationHits + stats.navigationMisses;
+    fmt::format_to(out, "\nnav cache  {:.0f}% of {} views\n", lookups ? 100.0 * stats.navigationHits / lookups : 0.0, lookups);
+    fmt::format_to(out, "results    {:.0f}% from cache", stats.total > 0 ? 100.0 * stats.resultCacheHits / stats.total : 0.0);
+
+    text.setString(fmt::to_string(out));
+
+    // Darken the image behind the text so it stays readable
+    sf::FloatRect bounds = text.getGlobalBounds();
+    float left = bounds.left - Margin, top = bounds.top - Margin;
+    float right = bounds.left + bounds.width + Margin, bottom = bounds.top + bounds.height + Margin;
+    sf::Color shade(0, 0, 0, 160);
+    sf::Vertex panel[] = {
+        sf::Vertex({ left, top }, shade),
+        sf::Vertex({ right, top }, shade),
+        sf::Vertex({ right, bottom }, shade),
+        sf::Vertex({ left, bottom }, shade),
+    };
+
+    target.draw(panel, 4, sf::Quads);
+    target.draw(text);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Text.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What the viewer and pipeline report to the HUD each time it's drawn
+struct HudStats {
+    // Time of the last frame, from uploading new pixels to display() returning
+    double frameMs = 0;
+    double decodeMs = 0;
+    double uploadMs = 0;
+    // Time to find and decode the low resolution stand-in, and whether it's on screen now
+    double proxyMs = 0;
+    bool proxyShown = false;
+    // The current image came out of the navigation cache, so it wasn't decoded for this view
+    bool fromCache = false;
+
+    size_t processed = 0;
+    int total = 0;
+    // Still enumerating files, total will grow
+    bool scanning = false;
+    // (stage, items waiting) for each pipeline pile
+    std::vector<std::pair<const char*, int>> queues;
+    // Pixel bytes between decode and average colour, against the budget that holds the decoder back
+    size_t inFlightBytes = 0;
+    size_t inFlightPeak = 0;
+    size_t inFlightLimit = 0;
+    // Key the catalog is ordered by, and how long the last switch took to re-sort it
+    const char* sortKey = "";
+    double sortMs = 0;
+
+    uint64_t navigationHits = 0;
+    uint64_t navigationMisses = 0;
+    int resultCacheHits = 0;
+};
+
+// Toggleable overlay of frame, navigation and pipeline statistics in the top left corner
+// Shows whether the background pipeline or the navigation path is holding things up
+class Hud {
+public:
+    // Use the font at preferred, falling back to common system fonts
+    bool LoadFont(const std::string& preferred);
+
+    void Toggle();
+    bool Visible() const { return visible; }
+
+    // True when the figures are due a refresh, a few times a second while visible
+    bool Due() const;
+
+    void Draw(sf::RenderTarget& target, const HudStats& stats);
+
+private:
+    sf::Font font;
+    bool hasFont = false;
+    bool visible = false;
+    sf::Text text;
+
+    // Pipeline throughput over the last second or so
+    bool rateStarted = false;
+    std::chrono::steady_clock::time_point rateStart;
+    size_t rateProcessed = 0;
+    double imagesPerSecond = 0;
+    std::chrono::steady_clock::time_point lastDrawn;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "image_format.h"
+#include "path_arena.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sf {
+class Image;
+}
+
+// Class to hold RGB values
+class RGB {
+public:
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+};
+
+// Class to hold HSL values
+class HSL {
+public:
+    float h = -1;
+    float s = -1;
+    float l = -1;
+};
+
+// Class to hold relative image values
+// This is what the catalog keeps for every image, so it holds no pixels and its path is interned
+class Image {
+public:
+    std::string FileName() const { return CatalogPaths().Path(path); }
+    void SetFileName(const std::string& fileName) { path = CatalogPaths().Intern(fileName); }
+
+    PathId path;
+    uint64_t fileSize = 0;
+    int64_t modifiedTime = 0;
+    // Hash of the file bytes, 0 until the I/O stage has read the file
+    uint64_t contentHash = 0;
+
+    int width = 0;
+    int height = 0;
+    HSL hsl;
+    RGB averageRgb;
+    ImageFormat format = ImageFormat::Unknown;
+    // True if averageRgb and hsl came from the result cache rather than a decode
+    bool cached = false;
+};
+
+// Bytes each catalog entry costs, the path's text is shared in CatalogPaths()
+constexpr size_t ImageRecordBytes = sizeof(Image);
+static_assert(ImageRecordBytes <= 64, "keep the catalog record small, it's held for every image");
+
+// Decoded pixels of an image on its way through the pipeline, freed once its colour is known
+class ImagePixels {
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<RGB, PoolAllocator<RGB>> rgb;
+
+    // Window sized copy of the decoded pixels, carried to the sort stage for the viewer's cache
+    std::shared_ptr<const sf::Image> display;
+};
+
+// What the pipeline's piles hold, the record being filled in and the pixels it's worked out from
+class PipelineImage {
+public:
+    PipelineImage() = default;
+    PipelineImage(Image image, std::string fileName) : image(std::move(image)), fileName(std::move(fileName)) {}
+
+    Image image;
+    // The file's path. The external sort keeps its paths on disk, so there image.path is never interned.
+    std::string fileName;
+    ImagePixels pixels;
+};
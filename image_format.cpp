@@ -0,0 +1,100 @@
+#include "image_format.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+bool StartsWith(const unsigned char* header, size_t len, const char* magic, size_t magicLen, size_t offset = 0) {
+    return len >= offset + magicLen && std::memcmp(header + offset, magic, magicLen) == 0;
+}
+
+bool HasExtension(const std::string& fileName, const char* ext) {
+    auto dot = fileName.find_last_of('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string actual = fileName.substr(dot + 1);
+    std::transform(actual.begin(), actual.end(), actual.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return actual == ext;
+}
+
+// TGA has no signature, so only trust the extension if the header is plausible
+bool LooksLikeTga(const unsigned char* header, size_t len) {
+    if (len < SniffLength)
+        return false;
+
+    int colourMapType = header[1];
+    int imageType = header[2];
+    int width = header[12] | (header[13] << 8);
+    int height = header[14] | (header[15] << 8);
+
+    bool validType = imageType == 1 || imageType == 2 || imageType == 3 ||
+                     imageType == 9 || imageType == 10 || imageType == 11;
+
+    return colourMapType <= 1 && validType && width > 0 && height > 0;
+}
+
+}
+
+ImageFormat SniffImageFormat(const unsigned char* header, size_t len, const std::string& fileName) {
+    if (StartsWith(header, len, "\xFF\xD8\xFF", 3))
+        return ImageFormat::Jpeg;
+    if (StartsWith(header, len, "\x89PNG\r\n\x1A\n", 8))
+        return ImageFormat::Png;
+    if (StartsWith(header, len, "GIF87a", 6) || StartsWith(header, len, "GIF89a", 6))
+        return ImageFormat::Gif;
+    if (StartsWith(header, len, "BM", 2))
+        return ImageFormat::Bmp;
+    if (StartsWith(header, len, "8BPS", 4))
+        return ImageFormat::Psd;
+    if (StartsWith(header, len, "#?RADIANCE", 10) || StartsWith(header, len, "#?RGBE", 6))
+        return ImageFormat::Hdr;
+    if (StartsWith(header, len, "\x53\x80\xF6\x34", 4))
+        return ImageFormat::Pic;
+    if (len >= 2 && header[0] == 'P' && (header[1] == '5' || header[1] == '6'))
+        return ImageFormat::Pnm;
+    if (StartsWith(header, len, "II*\0", 4) || StartsWith(header, len, "MM\0*", 4))
+        return ImageFormat::Tiff;
+    if (StartsWith(header, len, "RIFF", 4) && StartsWith(header, len, "WEBP", 4, 8))
+        return ImageFormat::WebP;
+    if (StartsWith(header, len, "ftyp", 4, 4) &&
+        (StartsWith(header, len, "heic", 4, 8) || StartsWith(header, len, "heix", 4, 8) ||
+         StartsWith(header, len, "mif1", 4, 8) || StartsWith(header, len, "avif", 4, 8)))
+        return ImageFormat::Heif;
+    if (HasExtension(fileName, "tga") && LooksLikeTga(header, len))
+        return ImageFormat::Tga;
+
+    return ImageFormat::Unknown;
+}
+
+ImageFormat SniffImageFormat(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+        return ImageFormat::Unknown;
+
+    unsigned char header[SniffLength] = {};
+    file.read(reinterpret_cast<char*>(header), SniffLength);
+
+    return SniffImageFormat(header, size_t(file.gcount()), fileName);
+}
+
+const char* FormatName(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::Jpeg: return "jpeg";
+    case ImageFormat::Png:  return "png";
+    case ImageFormat::Gif:  return "gif";
+    case ImageFormat::Bmp:  return "bmp";
+    case ImageFormat::Psd:  return "psd";
+    case ImageFormat::Hdr:  return "hdr";
+    case ImageFormat::Pic:  return "pic";
+    case ImageFormat::Pnm:  return "pnm";
+    case ImageFormat::Tga:  return "tga";
+    case ImageFormat::Tiff: return "tiff";
+    case ImageFormat::WebP: return "webp";
+    case ImageFormat::Heif: return "heif";
+    default:                return "unknown";
+    }
+}
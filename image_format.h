@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Container formats recognised from the first bytes of a file
+enum class ImageFormat : uint8_t {
+    Unknown = 0,
+    Jpeg,
+    Png,
+    Gif,
+    Bmp,
+    Psd,
+    Hdr,
+    Pic,
+    Pnm,
+    Tga,
+    // Recognised, but there is no decoder for them
+    Tiff,
+    WebP,
+    Heif,
+    Count
+};
+
+constexpr int ImageFormatCount = int(ImageFormat::Count);
+
+// Number of bytes read from the head of a file to classify it
+constexpr int SniffLength = 16;
+
+// Classify a file from its first SniffLength bytes (and extension for headerless TGA)
+ImageFormat SniffImageFormat(const std::string& fileName);
+
+// Classify an in-memory header, len may be shorter than SniffLength
+ImageFormat SniffImageFormat(const unsigned char* header, size_t len, const std::string& fileName);
+
+// Short lower case name, used in the run summary
+const char* FormatName(ImageFormat format);
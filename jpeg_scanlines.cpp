@@ -0,0 +1,536 @@
+#include "jpeg_scanlines.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Zigzag position -> position in the row major 8x8 block
+constexpr uint8_t Natural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// 12 bit fixed point, rounded the way stb rounds so both decoders agree closely
+constexpr int Fixed(float x) {
+    return int(x * 4096 + 0.5f);
+}
+
+uint8_t Clamp(int x) {
+    if (unsigned(x) > 255)
+        return x < 0 ? 0 : 255;
+    return uint8_t(x);
+}
+
+// One dimension of the inverse DCT, the LLM factorisation libjpeg's jidctint uses: the even half
+// ends up in x, the odd half in t, and outputs i and 7 - i are x[i] +- t[3 - i]
+struct Idct1D {
+    int x0, x1, x2, x3;
+    int t0, t1, t2, t3;
+
+    Idct1D(int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7) {
+        int p1 = (s2 + s6) * Fixed(0.5411961f);
+        int even2 = p1 + s6 * Fixed(-1.847759065f);
+        int even3 = p1 + s2 * Fixed(0.765366865f);
+        int even0 = (s0 + s4) * 4096;
+        int even1 = (s0 - s4) * 4096;
+        x0 = even0 + even3;
+        x3 = even0 - even3;
+        x1 = even1 + even2;
+        x2 = even1 - even2;
+
+        int p3 = s7 + s3;
+        int p4 = s5 + s1;
+        int p5 = (p3 + p4) * Fixed(1.175875602f);
+        int q1 = p5 + (s7 + s1) * Fixed(-0.899976223f);
+        int q2 = p5 + (s5 + s3) * Fixed(-2.562915447f);
+        p3 *= Fixed(-1.961570560f);
+        p4 *= Fixed(-0.390180644f);
+        t0 = s7 * Fixed(0.298631336f) + q1 + p3;
+        t1 = s5 * Fixed(2.053119869f) + q2 + p4;
+        t2 = s3 * Fixed(3.072711026f) + q2 + p3;
+        t3 = s1 * Fixed(1.501321110f) + q1 + p4;
+    }
+
+    void Add(int bias) {
+        x0 += bias;
+        x1 += bias;
+        x2 += bias;
+        x3 += bias;
+    }
+};
+
+// Dequantised coefficients to 8x8 samples, columns then rows
+void InverseDct(const short* in, uint8_t* out, int stride) {
+    int columns[64];
+    for (int i = 0; i < 8; i++) {
+        const short* d = in + i;
+        // Blocks are mostly zeros below the first row, those columns are flat
+        if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[32] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+            for (int row = 0; row < 8; row++)
+                columns[row * 8 + i] = d[0] * 4;
+            continue;
+        }
+
+        Idct1D p(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56]);
+        // The constants are scaled by 1 << 12, keep 2 bits of that for the second pass
+        p.Add(512);
+        columns[i] = (p.x0 + p.t3) >> 10;
+        columns[56 + i] = (p.x0 - p.t3) >> 10;
+        columns[8 + i] = (p.x1 + p.t2) >> 10;
+        columns[48 + i] = (p.x1 - p.t2) >> 10;
+        columns[16 + i] = (p.x2 + p.t1) >> 10;
+        columns[40 + i] = (p.x2 - p.t1) >> 10;
+        columns[24 + i] = (p.x3 + p.t0) >> 10;
+        columns[32 + i] = (p.x3 - p.t0) >> 10;
+    }
+
+    for (int row = 0; row < 8; row++) {
+        const int* v = columns + row * 8;
+        Idct1D p(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+        // 12 bits from the constants, 2 kept from the first pass and 3 from the two sqrt(8)
+        // scalings: round them away along with the level shift back to 0-255
+        p.Add(65536 + (128 << 17));
+        uint8_t* o = out + size_t(row) * stride;
+        o[0] = Clamp((p.x0 + p.t3) >> 17);
+        o[7] = Clamp((p.x0 - p.t3) >> 17);
+        o[1] = Clamp((p.x1 + p.t2) >> 17);
+        o[6] = Clamp((p.x1 - p.t2) >> 17);
+        o[2] = Clamp((p.x2 + p.t1) >> 17);
+        o[5] = Clamp((p.x2 - p.t1) >> 17);
+        o[3] = Clamp((p.x3 + p.t0) >> 17);
+        o[4] = Clamp((p.x3 - p.t0) >> 17);
+    }
+}
+
+// YCbCr to RGB in 20 bit fixed point, the JFIF coefficients
+constexpr int ColourFixed(float x) {
+    return int(x * 4096 + 0.5f) << 8;
+}
+
+void YCbCrToRgb(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, int count, unsigned char* rgb) {
+    for (int i = 0; i < count; i++, rgb += 3) {
+        int luma = (y[i] << 20) + (1 << 19);
+        int red = cr[i] - 128;
+        int blue = cb[i] - 128;
+        rgb[0] = Clamp((luma + red * ColourFixed(1.40200f)) >> 20);
+        int green = luma - red * ColourFixed(0.71414f) + int((blue * -ColourFixed(0.34414f)) & 0xffff0000);
+        rgb[1] = Clamp(green >> 20);
+        rgb[2] = Clamp((luma + blue * ColourFixed(1.77200f)) >> 20);
+    }
+}
+
+uint16_t BigEndian16(const unsigned char* bytes) {
+    return uint16_t(bytes[0] << 8 | bytes[1]);
+}
+
+}
+
+bool JpegScanlines::Open(const unsigned char* bytes, size_t size) {
+    *this = JpegScanlines();
+    data = bytes;
+    length = size;
+    if (data == nullptr || length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    position = 2;
+    return ReadHeaders();
+}
+
+bool JpegScanlines::ReadHeaders() {
+    while (position + 4 <= length) {
+        if (data[position] != 0xFF)
+            return false;
+        uint8_t marker = data[position + 1];
+        // Any number of fill bytes can come before a marker
+        if (marker == 0xFF) {
+            position++;
+            continue;
+        }
+        position += 2;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+            continue;
+        if (marker == 0xD9)
+            return false;
+
+        size_t segmentLength = BigEndian16(data + position);
+        if (segmentLength < 2 || segmentLength > length - position)
+            return false;
+        const unsigned char* segment = data + position + 2;
+        size_t size = segmentLength - 2;
+        position += segmentLength;
+
+        switch (marker) {
+        case 0xDB:
+            if (!ReadQuantTables(segment, size))
+                return false;
+            break;
+        case 0xC4:
+            if (!ReadHuffmanTables(segment, size))
+                return false;
+            break;
+        // Baseline and extended sequential, both Huffman coded
+        case 0xC0:
+        case 0xC1:
+            if (!ReadFrame(segment, size))
+                return false;
+            break;
+        case 0xDD:
+            if (size < 2)
+                return false;
+            restartInterval = BigEndian16(segment);
+            break;
+        case 0xE0:
+            jfif = jfif || (size >= 5 && std::memcmp(segment, "JFIF", 5) == 0);
+            break;
+        case 0xEE:
+            if (size >= 12 && std::memcmp(segment, "Adobe", 5) == 0)
+                adobeTransform = segment[11];
+            break;
+        // The entropy coded data starts right after the scan header
+        case 0xDA:
+            return ReadScan(segment, size);
+        default:
+            // Progressive, lossless, hierarchical and arithmetic coded frames
+            if (marker >= 0xC2 && marker <= 0xCF)
+                return false;
+            break;
+        }
+    }
+    return false;
+}
+
+bool JpegScanlines::ReadQuantTables(const unsigned char* segment, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        int precision = segment[i] >> 4, table = segment[i] & 15;
+        size_t bytes = precision == 0 ? 64 : 128;
+        if (precision > 1 || table > 3 || size - i - 1 < bytes)
+            return false;
+        i++;
+
+        for (int k = 0; k < 64; k++)
+            quant[table][k] = precision == 0 ? segment[i + k] : BigEndian16(segment + i + 2 * k);
+        quantDefined[table] = true;
+        i += bytes;
+    }
+    return true;
+}
+
+bool JpegScanlines::ReadHuffmanTables(const unsigned char* segment, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        if (size - i < 17)
+            return false;
+        int tableClass = segment[i] >> 4, index = segment[i] & 15;
+        if (tableClass > 1 || index > 3)
+            return false;
+
+        const unsigned char* counts = segment + i + 1;
+        size_t total = 0;
+        for (int len = 0; len < 16; len++)
+            total += counts[len];
+        if (total > 256 || size - i - 17 < total)
+            return false;
+
+        Huffman& table = tableClass == 0 ? dc[index] : ac[index];
+        std::memcpy(table.symbols, segment + i + 17, total);
+        std::memset(table.fast, 0, sizeof(table.fast));
+
+        // Canonical codes: each length continues from the last code of the one before, doubled
+        int code = 0, symbol = 0;
+        for (int len = 1; len <= 16; len++) {
+            table.firstCode[len] = code;
+            table.firstSymbol[len] = symbol;
+            table.count[len] = counts[len - 1];
+            for (int n = 0; n < table.count[len]; n++, code++, symbol++) {
+                // More codes than the length has room for
+                if (code >= 1 << len)
+                    return false;
+                if (len > FastBits)
+                    continue;
+                int shift = FastBits - len;
+                for (int suffix = 0; suffix < 1 << shift; suffix++)
+                    table.fast[code << shift | suffix] = uint16_t(table.symbols[symbol] | len << 8);
+            }
+            code <<= 1;
+        }
+        table.defined = true;
+        i += 17 + total;
+    }
+    return true;
+}
+
+bool JpegScanlines::ReadFrame(const unsigned char* segment, size_t size) {
+    if (size < 6 || segment[0] != 8 || !components.empty())
+        return false;
+
+    height = BigEndian16(segment + 1);
+    width = BigEndian16(segment + 3);
+    int count = segment[5];
+    // A height of 0 means it comes after the scan in a DNL marker, nothing writes those
+    if (width == 0 || height == 0 || (count != 1 && count != 3) || size < 6 + size_t(count) * 3)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char* c = segment + 6 + i * 3;
+        Component component = {};
+        component.id = c[0];
+        component.h = c[1] >> 4;
+        component.v = c[1] & 15;
+        component.quantTable = c[2];
+        if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3)
+            return false;
+        components.push_back(component);
+    }
+
+    // A single component scan isn't interleaved, its MCU is one block whatever the sampling says
+    if (count == 1) {
+        components[0].h = 1;
+        components[0].v = 1;
+    }
+    for (auto& c : components) {
+        maxH = std::max(maxH, c.h);
+        maxV = std::max(maxV, c.v);
+    }
+    for (auto& c : components) {
+        if (maxH % c.h != 0 || maxV % c.v != 0)
+            return false;
+    }
+    return true;
+}
+
+bool JpegScanlines::ReadScan(const unsigned char* segment, size_t size) {
+    if (components.empty() || size < 1)
+        return false;
+
+    // Every component in one scan, in frame order: a file that sends them in separate scans
+    // needs the whole of one before the next, which is what this is avoiding
+    size_t count = segment[0];
+    if (count != components.size() || size < 1 + count * 2 + 3)
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        Component& c = components[i];
+        if (segment[1 + i * 2] != c.id)
+            return false;
+        c.dcTable = segment[2 + i * 2] >> 4;
+        c.acTable = segment[2 + i * 2] & 15;
+        if (c.dcTable > 3 || c.acTable > 3 || !dc[c.dcTable].defined || !ac[c.acTable].defined || !quantDefined[c.quantTable])
+            return false;
+    }
+    const unsigned char* spectral = segment + 1 + count * 2;
+    if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0)
+        return false;
+
+    rgbComponents = count == 3 && ((components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B') ||
+                                   (adobeTransform == 0 && !jfif));
+
+    mcuColumns = (width + 8 * maxH - 1) / (8 * maxH);
+    for (auto& c : components) {
+        c.stride = mcuColumns * c.h * 8;
+        c.samples.assign(size_t(c.stride) * c.v * 8, 0);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (components[i].h != maxH)
+            upsampled[i].resize(size_t(mcuColumns) * maxH * 8);
+    }
+
+    nextRestart = restartInterval;
+    rowInMcu = 8 * maxV;
+    rowsLeft = height;
+    return true;
+}
+
+void JpegScanlines::FillBits() {
+    while (bitCount <= 24) {
+        uint32_t byte = 0;
+        if (!hitMarker && position < length) {
+            byte = data[position];
+            if (byte != 0xFF) {
+                position++;
+            }
+            else if (position + 1 < length && data[position + 1] == 0) {
+                // A stuffed zero after FF, the FF is data
+                position += 2;
+            }
+            else {
+                // Leave the marker for Restart to find
+                hitMarker = true;
+                byte = 0;
+            }
+        }
+        bits |= byte << (24 - bitCount);
+        bitCount += 8;
+    }
+}
+
+int JpegScanlines::DecodeSymbol(const Huffman& table) {
+    FillBits();
+    uint16_t entry = table.fast[bits >> (32 - FastBits)];
+    if (entry != 0) {
+        int len = entry >> 8;
+        bits <<= len;
+        bitCount -= len;
+        return entry & 255;
+    }
+
+    for (int len = FastBits + 1; len <= 16; len++) {
+        int offset = int(bits >> (32 - len)) - table.firstCode[len];
+        if (offset >= 0 && offset < table.count[len]) {
+            bits <<= len;
+            bitCount -= len;
+            return table.symbols[table.firstSymbol[len] + offset];
+        }
+    }
+    return -1;
+}
+
+int JpegScanlines::ReceiveExtend(int n) {
+    if (n == 0)
+        return 0;
+
+    FillBits();
+    int value = int(bits >> (32 - n));
+    bits <<= n;
+    bitCount -= n;
+    // The top bit clear means a negative value, stored offset by 2^n - 1
+    if (value < 1 << (n - 1))
+        value -= (1 << n) - 1;
+    return value;
+}
+
+bool JpegScanlines::DecodeBlock(Component& c, uint8_t* out, int stride) {
+    short coefficients[64] = {};
+    const uint16_t* q = quant[c.quantTable];
+
+    int size = DecodeSymbol(dc[c.dcTable]);
+    if (size < 0 || size > 16)
+        return false;
+    c.dcPredictor += ReceiveExtend(size);
+    coefficients[0] = short(c.dcPredictor * q[0]);
+
+    const Huffman& table = ac[c.acTable];
+    for (int k = 1; k < 64;) {
+        int symbol = DecodeSymbol(table);
+        if (symbol < 0)
+            return false;
+        int run = symbol >> 4;
+        size = symbol & 15;
+        if (size == 0) {
+            // End of block, or a run of 16 zeros
+            if (run != 15)
+                break;
+            k += 16;
+            continue;
+        }
+
+        k += run;
+        if (k > 63)
+            return false;
+        coefficients[Natural[k]] = short(ReceiveExtend(size) * q[k]);
+        k++;
+    }
+
+    InverseDct(coefficients, out, stride);
+    return true;
+}
+
+bool JpegScanlines::Restart() {
+    bits = 0;
+    bitCount = 0;
+    hitMarker = false;
+
+    // The decoder stops in front of the marker, but step over any junk before it rather than give up
+    while (position + 1 < length && !(data[position] == 0xFF && data[position + 1] >= 0xD0 && data[position + 1] <= 0xD7))
+        position++;
+    if (position + 1 >= length)
+        return false;
+    position += 2;
+
+    for (auto& c : components)
+        c.dcPredictor = 0;
+    return true;
+}
+
+bool JpegScanlines::DecodeMcuRow() {
+    for (int column = 0; column < mcuColumns; column++) {
+        if (restartInterval > 0) {
+            if (nextRestart == 0) {
+                if (!Restart())
+                    return false;
+                nextRestart = restartInterval;
+            }
+            nextRestart--;
+        }
+
+        for (auto& c : components) {
+            for (int y = 0; y < c.v; y++) {
+                for (int x = 0; x < c.h; x++) {
+                    uint8_t* block = c.samples.data() + size_t(y) * 8 * c.stride + (size_t(column) * c.h + x) * 8;
+                    if (!DecodeBlock(c, block, c.stride))
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void JpegScanlines::ConvertRow(int row, unsigned char* rgb) {
+    if (components.size() == 1) {
+        const uint8_t* grey = components[0].samples.data() + size_t(row) * components[0].stride;
+        for (int x = 0; x < width; x++, rgb += 3)
+            rgb[0] = rgb[1] = rgb[2] = grey[x];
+        return;
+    }
+
+    const uint8_t* planes[3];
+    for (int i = 0; i < 3; i++) {
+        const Component& c = components[i];
+        const uint8_t* line = c.samples.data() + size_t(row / (maxV / c.v)) * c.stride;
+        int repeat = maxH / c.h;
+        if (repeat == 1) {
+            planes[i] = line;
+            continue;
+        }
+
+        uint8_t* wide = upsampled[i].data();
+        for (int x = 0, sample = 0; x < width; sample++) {
+            for (int r = 0; r < repeat && x < width; r++)
+                wide[x++] = line[sample];
+        }
+        planes[i] = wide;
+    }
+
+    if (!rgbComponents) {
+        YCbCrToRgb(planes[0], planes[1], planes[2], width, rgb);
+        return;
+    }
+    for (int x = 0; x < width; x++, rgb += 3) {
+        rgb[0] = planes[0][x];
+        rgb[1] = planes[1][x];
+        rgb[2] = planes[2][x];
+    }
+}
+
+bool JpegScanlines::ReadRows(unsigned char* rgb, int count) {
+    if (count < 0 || count > rowsLeft)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        if (rowInMcu == 8 * maxV) {
+            if (!DecodeMcuRow())
+                return false;
+            rowInMcu = 0;
+        }
+        ConvertRow(rowInMcu++, rgb + size_t(i) * width * 3);
+        rowsLeft--;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Baseline JPEG decoded one MCU row at a time
+//
+// stb decodes a whole image into one buffer and refuses any that wouldn't fit in 2GB. This holds
+// just the MCU row being decoded, 16 rows for 4:2:0, so the largest images JPEG allows (65535 a
+// side) decode in a few MB. It reads sequential Huffman coded files with one or three components
+// in a single scan; progressive, arithmetic coded, 12 bit and CMYK files are left to stb. Chroma
+// is upsampled by repeating samples rather than stb's interpolation.
+class JpegScanlines {
+public:
+    // Parse the headers up to the start of the scan, data has to outlive the decoder
+    bool Open(const unsigned char* data, size_t length);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // Decode the next count rows as packed RGB, false if the data is damaged or runs out of rows
+    bool ReadRows(unsigned char* rgb, int count);
+
+private:
+    static constexpr int FastBits = 9;
+
+    struct Huffman {
+        // Codes of up to FastBits bits looked up straight from the next bits: symbol | length << 8, 0 if longer
+        uint16_t fast[1 << FastBits];
+        // Canonical decoding of longer codes: first code and count of each length
+        int firstCode[17];
+        int count[17];
+        int firstSymbol[17];
+        uint8_t symbols[256];
+        bool defined = false;
+    };
+
+    struct Component {
+        int id;
+        int h, v;
+        int quantTable;
+        int dcTable, acTable;
+        int dcPredictor;
+        // This component's samples for the current MCU row, stride samples wide and 8v rows tall
+        std::vector<uint8_t> samples;
+        int stride;
+    };
+
+    bool ReadHeaders();
+    bool ReadQuantTables(const unsigned char* segment, size_t length);
+    bool ReadHuffmanTables(const unsigned char* segment, size_t length);
+    bool ReadFrame(const unsigned char* segment, size_t length);
+    bool ReadScan(const unsigned char* segment, size_t length);
+
+    void FillBits();
+    int DecodeSymbol(const Huffman& table);
+    int ReceiveExtend(int bits);
+    bool DecodeBlock(Component& component, uint8_t* out, int stride);
+    bool Restart();
+    bool DecodeMcuRow();
+    void ConvertRow(int row, unsigned char* rgb);
+
+    const unsigned char* data = nullptr;
+    size_t length = 0;
+    size_t position = 0;
+
+    int width = 0;
+    int height = 0;
+    // Quantisation tables in zigzag order
+    uint16_t quant[4][64];
+    bool quantDefined[4] = {};
+    Huffman dc[4], ac[4];
+    std::vector<Component> components;
+    // Three components that are already RGB (Adobe transform 0 without JFIF, or named R, G, B) rather than YCbCr
+    bool rgbComponents = false;
+    bool jfif = false;
+    int adobeTransform = -1;
+    int restartInterval = 0;
+
+    int maxH = 1, maxV = 1;
+    int mcuColumns = 0;
+    // MCUs until the next restart marker
+    int nextRestart = 0;
+
+    // Entropy coded bits, most significant first
+    uint32_t bits = 0;
+    int bitCount = 0;
+    // A marker was reached, the rest of the data reads as zeros
+    bool hitMarker = false;
+
+    // Rows of the current MCU row already handed out, and rows of the image left to decode
+    int rowInMcu = 0;
+    int rowsLeft = 0;
+    // One row of each chroma component upsampled to full width
+    std::vector<uint8_t> upsampled[3];
+};
@@ -7,64 +7,121 @@
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
+#include <climits>
 #include <filesystem>
 #include <iostream>
 #include <string>
 #include <float.h>
 #include <mutex>
+#include <condition_variable>
 #include <array>
 #include <thread>
-#include <set>
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+
+#include "image.h"
+#include "average_colour.h"
+#include "catalog.h"
+#include "catalog_file.h"
+#include "external_sort.h"
+#include "sort_keys.h"
+#include "decoder.h"
+#include "result_cache.h"
+#include "dedup_index.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "dir_watcher.h"
+#include "options.h"
+#include "thumbnail_pack.h"
+#include "decoded_lru.h"
+#include "texture_loader.h"
+#include "thumbnail_grid.h"
+#include "hud.h"
+#include "deep_zoom.h"
+#include "resample.h"
+#include "buffer_pool.h"
+#include "memory_budget.h"
+#include "process_time.h"
 
 namespace fs = std::filesystem;
 
-// Class to hold RGB values
-class RGB {
-public:
-    int r = -1;
-    int g = -1;
-    int b = -1;
-};
+// Struct to hold the Image objects at a specified point in the pipeline
+struct pile_t {
 
-// Class to hold HSL values
-class HSL {
-public:
-    double h = -1;
-    double s = -1;
-    int l = -1;
-};
+    // Wait for an item and remove the last one
+    // False without one once the pile is closed, or if Wake was called while it was empty
+    bool Pop(PipelineImage& work_item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return !data.empty() || closed || wakes > 0; });
+        if (data.empty()) {
+            if (wakes > 0)
+                wakes--;
+            return false;
+        }
 
-// Class to hold relative image values
-class Image {
-public:
-    std::string fileName;
+        work_item = std::move(data.back());
+        data.pop_back();
+        lock.unlock();
+        taken.notify_one();
+        return true;
+    }
 
-    std::vector<RGB> rgb;
-    RGB averageRgb;
-    HSL hsl;
-};
+    // Pop, but give up after timeout
+    bool Pop(PipelineImage& work_item, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait_for(lock, timeout, [this] { return !data.empty() || closed || wakes > 0; });
+        if (data.empty()) {
+            if (wakes > 0)
+                wakes--;
+            return false;
+        }
 
-// Struct to hold the Image objects at a specified point in the pipeline
-struct pile_t {
+        work_item = std::move(data.back());
+        data.pop_back();
+        lock.unlock();
+        taken.notify_one();
+        return true;
+    }
 
-    // Remove and return last item
-    Image Pop() {
-        std::lock_guard<std::mutex> guard(mutex);
-        Image work_item;
+    // Put item into vector and wake a waiting stage
+    void Put(PipelineImage work_item) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            data.push_back(std::move(work_item));
+        }
+        ready.notify_one();
+    }
 
-        if (!data.empty()) {
-            work_item = data.back();
-            data.pop_back();
+    // Put, but first wait until the pile holds fewer than limit items, so a producer can't run
+    // further ahead of the stage draining it than that. Returns at once after Close.
+    void Put(PipelineImage work_item, size_t limit) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taken.wait(lock, [&] { return data.size() < limit || closed; });
+            data.push_back(std::move(work_item));
         }
+        ready.notify_one();
+    }
 
-        return work_item;
+    // Return from one Pop without an item, so its stage can look at the pipeline's progress
+    void Wake() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            wakes++;
+        }
+        ready.notify_one();
     }
 
-    // Put item into vector
-    void Put(Image work_item) {
-        std::lock_guard<std::mutex> guard(mutex);
-        data.push_back(work_item);
+    // No more items are coming, every waiting stage returns
+    void Close() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+        taken.notify_all();
     }
 
     // Return size of vector
@@ -74,7 +131,7 @@ struct pile_t {
     }
 
     // Return tge data vector
-    std::vector<Image>& GetData() {
+    std::vector<PipelineImage>& GetData() {
         std::lock_guard<std::mutex> guard(mutex);
         return data;
     }
@@ -82,25 +139,116 @@ struct pile_t {
 private:
     // Mutex to lock to a thread
     std::mutex mutex;
+    // Signalled on Put, Wake and Close
+    std::condition_variable ready;
+    // Signalled when Pop takes an item, for a bounded Put
+    std::condition_variable taken;
     // Data vector
-    std::vector<Image> data;
-};
-
-// Custom compare lambda
-struct image_cmp {
-    bool operator()(const Image& a, const Image& b) const {
-        return a.hsl.h < b.hsl.h;
-    }
+    std::vector<PipelineImage> data;
+    bool closed = false;
+    int wakes = 0;
 };
 
 constexpr char* image_folder = "par_images/unsorted";
-std::set<Image, image_cmp> sortedImages;
-int imageCount = 999999;
+constexpr const char* cache_file = "par_images/results.cache";
+constexpr const char* catalog_file = "par_images/catalog.bin";
+// Linear light averages differ from sRGB ones, so they keep their own cache and catalog
+constexpr const char* linear_cache_file = "par_images/results_linear.cache";
+constexpr const char* linear_catalog_file = "par_images/catalog_linear.bin";
+constexpr const char* duplicates_file = "par_images/duplicates.txt";
+constexpr const char* pyramid_folder = "par_images/pyramids";
+// Window size, also the size the pipeline keeps display copies at
+const int gameWidth = 800;
+const int gameHeight = 600;
+// Memory for display copies on their way through the pipeline, images decoded past this don't get one
+constexpr size_t display_copy_budget = 64 * 1024 * 1024;
+// How long the viewer waits for a sorted result before showing whatever was found first
+constexpr auto first_frame_budget = std::chrono::milliseconds(100);
+// Files enumeration may queue ahead of the stage reading them. Without a limit the scan queues
+// the whole tree at once, a path string per file, before the decode stage has caught up.
+constexpr size_t enqueue_limit = 4096;
+// In watch mode the catalog is saved again once it has gone this long without changing
+constexpr auto catalog_save_quiet = std::chrono::seconds(5);
+// Nap between passes of the loop while it waits on work, and while the grid only watches for new files.
+// The watch nap is about a frame: input stays prompt and new files show up long before the grid's next refresh.
+constexpr auto busy_poll_interval = std::chrono::milliseconds(5);
+constexpr auto watch_poll_interval = std::chrono::milliseconds(16);
+// Sorted results, the viewer reads it while the pipeline and watcher change it
+Catalog catalog;
+// Bumped on every change to the catalog or its order, so the viewer can tell when its copy is stale
+std::atomic<uint64_t> catalogVersion = 0;
+// With --external results go to disk instead of the catalog, and the viewer pages through the
+// merged order once the pipeline has finished
+ExternalSorter externalSorter;
+std::atomic<size_t> externalCount = 0;
+SortedOrder externalOrder;
+std::atomic<bool> externalReady = false;
+// Catalog saved by the last run, browsed until this run's has caught up and closed when it's replaced
+SavedCatalog savedCatalog;
+std::mutex savedCatalogMutex;
+std::atomic<int> imageCount = 999999;
+// Set once LoadImages has enumerated every file, so imageCount is final
+std::atomic<bool> loadingComplete = false;
+// Images sent down the pipeline, and those that have left it sorted or dropped
+std::atomic<int> enumeratedCount = 0;
+std::atomic<int> processedCount = 0;
+std::atomic<int> droppedCount = 0;
+// Files the watcher saw deleted while they were still in the pipeline, dropped when they reach the catalog
+std::unordered_set<std::string> removedInFlight;
+// Set when the watcher lost events, so deletes of files in flight went unseen: until the pipeline
+// drains, each file is checked for on disk before it's added
+bool checkInFlight = false;
+std::mutex removedMutex;
+// First file sent down the pipeline, so the viewer has something to show before anything is sorted
+std::string firstEnumerated;
+std::mutex firstEnumeratedMutex;
+
+// Run summary counters
+std::array<std::atomic<int>, ImageFormatCount> formatCounts = {};
+std::atomic<int> failedDecodes = 0;
+std::atomic<int> cacheHits = 0;
+std::atomic<int> thumbnailsWritten = 0;
+std::atomic<int> displayCopiesKept = 0;
+std::atomic<size_t> displayCopyBytes = 0;
+
+ResultCache resultCache;
+DedupIndex dedupIndex;
+ThumbnailPackWriter thumbnailWriter;
+// Bumped each time the pack's index is written, so the viewer's loader maps it again
+std::atomic<uint64_t> thumbnailPackVersion = 0;
+// Decoded images for navigation, shared by the viewer's loader and the pipeline's display copies
+DecodedImageCache decodedCache(0);
+// Pixels between the decode and average colour stages, the decode stage waits when it's spent
+MemoryBudget inFlightBudget(0);
+// What the viewer is showing, so the sort stage can tell which display copies it will want
+std::mutex viewerMutex;
+PathId viewerPath;
+auto startTime = std::chrono::steady_clock::now();
+Options options;
+// Frames presented, and the count, time and CPU time when the pipeline drained, to report what the viewer costs idle
+std::atomic<uint64_t> framesDrawn{ 0 };
+std::mutex drainedMutex;
+bool drained = false;
+std::chrono::steady_clock::time_point drainedAt;
+double drainedCpuSeconds = 0;
+uint64_t drainedFrames = 0;
+
+// Result cache and saved catalog for the averaging mode in use
+const char* CacheFile() {
+    return options.linearLight ? linear_cache_file : cache_file;
+}
+
+const char* CatalogFile() {
+    return options.linearLight ? linear_catalog_file : catalog_file;
+}
 
-pile_t to_get_pixels;
-pile_t to_get_average_color;
-pile_t to_convert_rgb_to_hsl;
-pile_t done;
+// Never destroyed: in watch mode the detached stages are still waiting in Pop when main returns,
+// and destroying a condition variable with waiters blocks
+pile_t& to_get_pixels = *new pile_t;
+pile_t& to_make_thumbnail = *new pile_t;
+pile_t& to_get_average_color = *new pile_t;
+pile_t& to_convert_rgb_to_hsl = *new pile_t;
+pile_t& done = *new pile_t;
 
 sf::Vector2f ScaleFromDimensions(const sf::Vector2u& textureSize, int screenWidth, int screenHeight)
 {
@@ -110,175 +258,747 @@ sf::Vector2f ScaleFromDimensions(const sf::Vector2u& textureSize, int screenWidt
     return { scale, scale };
 }
 
+size_t CatalogSize() {
+    if (!options.external.empty())
+        return externalCount;
+    return catalog.Size();
+}
+
+// Copy of the sorted images for the viewer
+std::vector<Image> CatalogSnapshot() {
+    return catalog.Snapshot();
+}
+
+// Remove the entry for a file, returns false if it wasn't in the catalog
+bool RemoveFromCatalog(const std::string& fileName) {
+    PathId path;
+    if (!CatalogPaths().Find(fileName, path))
+        return false;
+
+    if (!catalog.Remove(path))
+        return false;
+    catalogVersion++;
+    return true;
+}
+
+// Position of a file in a catalog snapshot, -1 if it isn't there (yet)
+int CatalogIndex(const std::vector<Image>& images, const std::string& fileName) {
+    PathId path;
+    if (!CatalogPaths().Find(fileName, path))
+        return -1;
+
+    for (size_t i = 0; i < images.size(); i++) {
+        if (images[i].path == path)
+            return int(i);
+    }
+    return -1;
+}
+
+std::string FirstEnumeratedFile() {
+    std::lock_guard<std::mutex> guard(firstEnumeratedMutex);
+    return firstEnumerated;
+}
+
+void SetFirstEnumeratedFile(const std::string& fileName) {
+    std::lock_guard<std::mutex> guard(firstEnumeratedMutex);
+    if (firstEnumerated.empty())
+        firstEnumerated = fileName;
+}
+
+// Tell the pipeline which file the viewer has moved to
+void ViewerMoved(const std::string& fileName) {
+    // The external sort has no catalog to be near, and interning every path shown would grow without bound
+    if (!options.external.empty())
+        return;
+    PathId path = CatalogPaths().Intern(fileName);
+    std::lock_guard<std::mutex> guard(viewerMutex);
+    viewerPath = path;
+}
+
+// True if img has sorted within a few places of the image being viewed, or of the start of
+// the order while the viewer isn't on a sorted image, so it's likely to be shown soon
+bool NearViewer(const Image& img) {
+    PathId viewing;
+    {
+        std::lock_guard<std::mutex> guard(viewerMutex);
+        viewing = viewerPath;
+    }
+    return catalog.Near(viewing, img.path, options.prefetch + 1);
+}
+
+// True once every enumerated image has left the pipeline, sorted or dropped
+// Also true when none were found or none could be decoded, so the run still finishes
+bool PipelineFinished() {
+    if (!loadingComplete)
+        return false;
+    // Enumerated last, an image can't leave before it's counted in
+    int settled = processedCount + droppedCount;
+    return settled == enumeratedCount;
+}
+
+// True while the viewer pages through an order by position rather than copying the catalog: the
+// external order once it's written, or the catalog saved by the last run until this run's is complete
+bool PagedBrowsing() {
+    if (externalReady)
+        return true;
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    return savedCatalog.IsOpen() && !PipelineFinished();
+}
+
+uint64_t PagedCount() {
+    if (externalReady)
+        return externalOrder.Size();
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    return savedCatalog.Size();
+}
+
+std::string PagedPath(uint64_t position) {
+    if (externalReady)
+        return externalOrder.Path(position);
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    return savedCatalog.Path(savedCatalog.At(catalog.Key(), position));
+}
+
+// Paths at positions [first, last) of the paged order, read in place from its mapping
+std::vector<std::string> PagedPaths(uint64_t first, uint64_t last) {
+    std::vector<std::string> names;
+    if (externalReady) {
+        for (uint64_t i = first; i < std::min(last, externalOrder.Size()); i++)
+            names.push_back(externalOrder.Path(i));
+        return names;
+    }
+
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    SortKey key = catalog.Key();
+    for (uint64_t i = first; i < std::min(last, savedCatalog.Size()); i++)
+        names.push_back(savedCatalog.Path(savedCatalog.At(key, i)));
+    return names;
+}
+
+// Position of a file in the saved catalog's order, -1 if it isn't in it
+int SavedPosition(const std::string& fileName) {
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    uint32_t record;
+    uint64_t position;
+    if (!savedCatalog.Find(fileName, record) || !savedCatalog.Position(catalog.Key(), record, position) || position > INT_MAX)
+        return -1;
+    return int(position);
+}
+
+// The order the viewer browses, for the thumbnail grid, which reads it a screen at a time
+// pagedIndex is where the viewer is in a paged order
+GridFiles BrowseFiles(int pagedIndex) {
+    GridFiles files;
+    if (PagedBrowsing()) {
+        files.count = int(std::min<uint64_t>(PagedCount(), INT_MAX));
+        files.names = [](int first, int last) { return PagedPaths(uint64_t(first), uint64_t(last)); };
+        // The external order has no index by path, only the position the viewer is on is known
+        files.find = [pagedIndex](const std::string& fileName) {
+            if (!externalReady)
+                return SavedPosition(fileName);
+            return pagedIndex >= 0 && PagedPath(uint64_t(pagedIndex)) == fileName ? pagedIndex : -1;
+        };
+        return files;
+    }
+
+    files.count = int(std::min<size_t>(catalog.Size(), INT_MAX));
+    files.names = [](int first, int last) { return catalog.FileNames(size_t(first), size_t(last)); };
+    files.find = [](const std::string& fileName) {
+        PathId path;
+        size_t position;
+        if (!CatalogPaths().Find(fileName, path) || !catalog.Find(path, position))
+            return -1;
+        return int(position);
+    };
+    return files;
+}
+
+// Fill img from the saved catalog if the file hasn't changed since it was saved
+bool LookupSaved(Image& img) {
+    std::lock_guard<std::mutex> guard(savedCatalogMutex);
+    return savedCatalog.Lookup(img);
+}
+
+// True if thumbnails are being written and this file doesn't have one yet, or only one made
+// before its size or mtime changed
+// Such files have to be decoded even when their results are already known
+bool NeedsThumbnail(const std::string& fileName, const Image& img) {
+    return thumbnailWriter.IsOpen() && !thumbnailWriter.Contains(fileName, img.fileSize, img.modifiedTime);
+}
+
+// Add one file to the pipeline
+// Files are classified from their first bytes so non-images never reach the decode stage
+// Files whose size and mtime match the result cache skip straight to the sort stage
+void EnqueueFile(const fs::directory_entry& p) {
+    std::error_code error;
+    if (!p.is_regular_file(error))
+        return;
+
+    PipelineImage item;
+    item.fileName = p.path().u8string();
+    const std::string& fileName = item.fileName;
+    Image& img = item.image;
+    // Only the in memory catalog interns paths, the external sort's memory is bounded by --external-mb
+    if (options.external.empty())
+        img.SetFileName(fileName);
+    img.fileSize = p.file_size(error);
+    img.modifiedTime = p.last_write_time(error).time_since_epoch().count();
+
+    if (!NeedsThumbnail(fileName, img) && ((options.external.empty() && LookupSaved(img)) || resultCache.Lookup(img, fileName))) {
+        formatCounts[int(img.format)]++;
+        cacheHits++;
+        SetFirstEnumeratedFile(fileName);
+        // Counted before it's queued, so the pipeline can't look drained with it on the way
+        imageCount++;
+        enumeratedCount++;
+        done.Put(std::move(item), enqueue_limit);
+        return;
+    }
+
+    img.format = SniffImageFormat(fileName);
+
+    formatCounts[int(img.format)]++;
+    if (!HasDecoder(img.format))
+        return;
+
+    SetFirstEnumeratedFile(fileName);
+    imageCount++;
+    enumeratedCount++;
+    to_get_pixels.Put(std::move(item), enqueue_limit);
+}
+
 // Load all image filenames and add them to the beginning of the pipeline
 void LoadImages()
 {   
     imageCount = 0;
-    for (auto& p : fs::directory_iterator(image_folder))
+    // The external sort keeps the cache's indexes on disk too, they'd grow with the image count
+    bool cacheLoaded = options.external.empty() ? resultCache.Load(CacheFile())
+                                                : resultCache.Load(CacheFile(), options.external, options.externalMegabytes * 1024 * 1024);
+    if (!cacheLoaded)
+        std::cout << "Result cache " << CacheFile() << " unavailable, every image will be decoded" << std::endl;
+    if (!options.thumbnails.empty() && !thumbnailWriter.Open(options.thumbnails))
+        std::cout << "Can't open thumbnail pack " << options.thumbnails << std::endl;
+
+    for (auto& folder : options.folders)
     {
-        Image img;
-        img.fileName = p.path().u8string();
+        std::error_code error;
+        for (auto& p : fs::directory_iterator(folder, error))
+            EnqueueFile(p);
 
-        to_get_pixels.Put(img);
-        imageCount++;
+        if (error)
+            std::cout << "Can't read " << folder << ": " << error.message() << std::endl;
     }
+    loadingComplete = true;
+    done.Wake();
 }
 
-// Load image based on object, gather all pixels RGB values storing them in RGB object and add it to the object.
-void GetPixels(Image &img) {
-    sf::Texture texture;
-    if (!texture.loadFromFile(img.fileName)) {
-        std::cout << "Failed" << std::endl;
-        return;
+// A file the watcher saw go. If it isn't in the catalog it may still be on its way through the
+// pipeline, it's remembered so AddToCatalog drops it rather than adding a file that's gone.
+void RemoveWatchedFile(const std::string& fileName) {
+    std::lock_guard<std::mutex> guard(removedMutex);
+    if (RemoveFromCatalog(fileName))
+        imageCount--;
+    else if (!PipelineFinished())
+        removedInFlight.insert(fileName);
+}
+
+// A file the watcher saw created or changed
+void EnqueueWatchedFile(const fs::directory_entry& p) {
+    {
+        std::lock_guard<std::mutex> guard(removedMutex);
+        removedInFlight.erase(p.path().u8string());
     }
-    sf::Sprite sprite(texture);
+    EnqueueFile(p);
+}
 
-    auto image = sprite.getTexture()->copyToImage();
+// The watcher lost events for folder: queue everything in it again, which the caches answer
+// for the files that haven't changed, and drop catalog entries whose files have gone. Files
+// already in the pipeline are checked as they arrive.
+void RescanWatchedFolder(const std::string& folder) {
+    {
+        std::lock_guard<std::mutex> guard(removedMutex);
+        checkInFlight = true;
+    }
 
-    for (int y = 0; y < image.getSize().y; y++) {
-        for (int x = 0; x < image.getSize().x; x++) {
-            RGB rgb;
+    std::error_code error;
+    for (auto& p : fs::directory_iterator(fs::u8path(folder), error))
+        EnqueueWatchedFile(p);
 
-            rgb.r = image.getPixel(x, y).r;
-            rgb.g = image.getPixel(x, y).g;
-            rgb.b = image.getPixel(x, y).b;
+    for (const Image& img : CatalogSnapshot()) {
+        std::string fileName = img.FileName();
+        if (!fs::exists(fs::u8path(fileName), error))
+            RemoveWatchedFile(fileName);
+    }
+}
+
+// Driver for watch mode, constantly running on seperate thread
+// New and modified files go back through the pipeline, deleted files leave the catalog
+void WatchDriver() {
+    DirectoryWatcher watcher;
+    for (auto& folder : options.folders) {
+        if (!watcher.Watch(folder))
+            std::cout << "Can't watch " << folder << std::endl;
+    }
+
+    // Changes queue up in the watcher until the initial scan has loaded the cache
+    while (!loadingComplete)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-            img.rgb.push_back(rgb);
+    std::atomic<bool> stop = false;
+    while (true) {
+        for (auto& change : watcher.Wait(stop)) {
+            if (change.rescan)
+                RescanWatchedFolder(change.fileName);
+            else if (change.removed)
+                RemoveWatchedFile(change.fileName);
+            else
+                EnqueueWatchedFile(fs::directory_entry(fs::u8path(change.fileName)));
         }
     }
 }
 
-// Get the Average RGB value from a list of RGBs
-void AverageRgbColour(Image &img) {
-    int r = 0, g = 0, b = 0;
-    for (RGB c : img.rgb) {
-        r += c.r;
-        g += c.g;
-        b += c.b;
-    }
+// Remove an image that couldn't be processed from the pipeline
+void DropImage() {
+    failedDecodes++;
+    imageCount--;
+    droppedCount++;
+    done.Wake();
+}
 
-    RGB average;
-    average.r = (r / img.rgb.size());
-    average.g = (g / img.rgb.size());
-    average.b = (b / img.rgb.size());
+// Look for identical content that already has results
+// Returns true if item was dealt with without decoding: sent on to be sorted, or parked behind its first copy
+bool IsDuplicate(PipelineImage &item) {
+    Image& img = item.image;
+    std::string original;
+    if (resultCache.LookupContent(img, original)) {
+        if (original != item.fileName)
+            dedupIndex.AddDuplicate(item.fileName, original);
+        done.Put(std::move(item));
+        return true;
+    }
 
-    img.averageRgb = average;
+    // The index keeps an entry for every image, more than the external sort's memory budget allows
+    if (!options.external.empty())
+        return false;
+
+    switch (dedupIndex.ClaimContent(img)) {
+    case DedupIndex::Claim::Known:
+        done.Put(std::move(item));
+        return true;
+    case DedupIndex::Claim::Waiting:
+        return true;
+    default:
+        return false;
+    }
 }
 
-// Convert RGB to HSL
-void RgbToHsl(Image &img) {
-    HSL hsl;
+// Load image based on object, gather all pixels RGB values storing them in RGB object and add it to the object.
+// Keep a window sized copy of freshly decoded pixels while the in-flight budget allows
+// If the image sorts near what the viewer is showing, the viewer uses it instead of decoding again
+void MakeDisplayCopy(const std::string &fileName, ImagePixels &pixels, const DecodedImage &decoded) {
+    int width, height;
+    FitWithin(decoded.width, decoded.height, gameWidth, gameHeight, width, height);
+    size_t bytes = size_t(width) * height * 4;
+    if (displayCopyBytes + bytes > display_copy_budget || decodedCache.Contains(fileName))
+        return;
 
-    double r = img.averageRgb.r / 255.f;
-    double g = img.averageRgb.g / 255.f;
-    double b = img.averageRgb.b / 255.f;
+    displayCopyBytes += bytes;
+    std::vector<unsigned char, PoolAllocator<unsigned char>> resampled(bytes);
+    ResampleRgba(decoded.pixels.get(), decoded.width, decoded.height, resampled.data(), width, height);
 
-    double max = std::max(std::max(r, g), b);
-    double min = std::min(std::min(r, g), b);
+    auto display = std::make_shared<sf::Image>();
+    display->create(unsigned(width), unsigned(height), resampled.data());
+    pixels.display = display;
+}
 
-    double delta = max - min;
+// Bytes a decode of file will hold at its peak, the RGBA decode and the RGB copy made from it
+size_t EstimatePixelBytes(const MappedFile &file) {
+    int width, height;
+    if (!ReadImageSize(file.Data(), file.Size(), width, height) || width <= 0 || height <= 0)
+        return 0;
+    return size_t(width) * height * (4 + sizeof(RGB));
+}
 
-    if (max == min) {
-        hsl.h = 0.f;
+bool GetPixels(PipelineImage &item, const MappedFile &file) {
+    Image& img = item.image;
+    ImagePixels& pixels = item.pixels;
+    // RGBA so the same decode can also give the viewer its display copy
+    DecodedImage decoded;
+    if (!DecodeImage(file.Data(), file.Size(), img.format, decoded, 4)) {
+        std::cout << "Failed to decode " << item.fileName << std::endl;
+        return false;
     }
-    else {
-        if (max == r) {
-            double temp;
-            if (g < b)
-                temp = 6.f;
-            else
-                temp = 0.f;
 
-            hsl.h = (g - b) / delta + temp;
-        }
-        else if (max == g) {
-            hsl.h = (b - r) / delta + 2.f;
-        }
-        else if (max == b) {
-            hsl.h = (r - g) / delta + 4.f;
-        }
+    img.width = pixels.width = decoded.width;
+    img.height = pixels.height = decoded.height;
+    size_t pixelCount = size_t(decoded.width) * decoded.height;
+    const unsigned char* pixel = decoded.pixels.get();
+
+    pixels.rgb.reserve(pixelCount);
+    for (size_t i = 0; i < pixelCount; i++, pixel += 4) {
+        RGB rgb;
+
+        rgb.r = pixel[0];
+        rgb.g = pixel[1];
+        rgb.b = pixel[2];
+
+        pixels.rgb.push_back(rgb);
     }
 
-    hsl.h = (hsl.h / 6) * 360;
+    MakeDisplayCopy(item.fileName, pixels, decoded);
+    return true;
+}
 
-    img.hsl = hsl;
+// Get the Average RGB value from a list of RGBs, in linear light with --linear-light
+void AverageRgbColour(Image &img, const ImagePixels &pixels) {
+    if (options.linearLight)
+        img.averageRgb = AverageLinear(pixels.rgb.data(), pixels.rgb.size());
+    else
+        img.averageRgb = AverageSrgb(pixels.rgb.data(), pixels.rgb.size());
+}
+
+// Convert RGB to HSL
+void RgbToHsl(Image &img) {
+    RgbToHsl(img.averageRgb, img.hsl);
 }
 
 // Driver function for GetPixels(), constantly running on seperate thread
 // Get image from start of pipeline, get it's pixels then add it to the next section of the pipeline
 
 void GetPixelsDriver() {
-    bool loop = true;
+    // The pile closes once the pipeline has drained for good
+    while (true) {
+        PipelineImage item;
+        if (!to_get_pixels.Pop(item))
+            break;
 
-    while (loop) {
-        if (to_get_pixels.Num() > 0) {
-            Image img = to_get_pixels.Pop();
-            //std::cout << "Calculating image pixels: " << img.fileName << std::endl;
-            GetPixels(img);
-            to_get_average_color.Put(img);
+        Image& img = item.image;
+        //std::cout << "Calculating image pixels: " << item.fileName << std::endl;
+        MappedFile file;
+        if (!file.Open(item.fileName)) {
+            std::cout << "Failed to read " << item.fileName << std::endl;
+            DropImage();
         }
+        else {
+            img.contentHash = HashBytes(file.Data(), file.Size());
+            if (!NeedsThumbnail(item.fileName, img) && IsDuplicate(item))
+                continue;
+
+            // Only the RGB copy outlives GetPixels, the average colour stage releases that
+            size_t estimate = EstimatePixelBytes(file);
+            inFlightBudget.Acquire(estimate);
+            bool decoded = GetPixels(item, file);
+            // The average colour stage releases what's kept, so the reservation has to end up
+            // exactly that. The estimate is 0 when the header couldn't be read.
+            size_t kept = item.pixels.rgb.capacity() * sizeof(RGB);
+            if (kept > estimate)
+                inFlightBudget.Acquire(kept - estimate);
+            else
+                inFlightBudget.Release(estimate - kept);
 
-        // This prevents this loop ending before imageCount is initially updated.
-        if (sortedImages.size() == imageCount && imageCount > 0) {
-            loop = false;
+            if (decoded) {
+                if (options.thumbnails.empty())
+                    to_get_average_color.Put(std::move(item));
+                else
+                    to_make_thumbnail.Put(std::move(item));
+            }
+            else {
+                DropImage();
+                // Copies of a file that can't be decoded can't be decoded either
+                for (size_t i = 0, copies = dedupIndex.Abandon(img).size(); i < copies; i++)
+                    DropImage();
+            }
         }
     }
 }
 
+// Driver function for MakeThumbnail(), constantly running on seperate thread when --thumbnails is given
+// Get image from respective part of pipeline, append a thumbnail of its pixels to the pack then add it to the next section of the pipeline
+void ThumbnailDriver() {
+    std::vector<unsigned char> pixels;
+
+    // The pile closes once the pipeline has drained for good
+    while (true) {
+        PipelineImage item;
+        if (!to_make_thumbnail.Pop(item))
+            break;
+
+        int width, height;
+        MakeThumbnail(item.pixels, ThumbnailLongEdge, pixels, width, height);
+        if (thumbnailWriter.Append(item.fileName, item.image.fileSize, item.image.modifiedTime, pixels.data(), width, height))
+            thumbnailsWritten++;
+        to_get_average_color.Put(std::move(item));
+    }
+}
+
 // Driver function for AverageColour(), constantly running on seperate thread
 // Get image from respective part of pipeline, get it's average colour then add it to the next section of the pipeline
 void AverageColourDriver() {
-    bool loop = true;
-
-    while (loop) {
-        if (to_get_average_color.Num() > 0) {
-            Image img = to_get_average_color.Pop();
-            //std::cout << "Calculating image average colour: " << img.fileName << std::endl;
-            AverageRgbColour(img);
-            to_convert_rgb_to_hsl.Put(img);
-        }
+    // The pile closes once the pipeline has drained for good
+    while (true) {
+        PipelineImage item;
+        if (!to_get_average_color.Pop(item))
+            break;
 
-        // This prevents this loop ending before imageCount is initially updated.
-        if (sortedImages.size() == imageCount && imageCount > 0) {
-            loop = false;
-        }
+        //std::cout << "Calculating image average colour: " << item.fileName << std::endl;
+        AverageRgbColour(item.image, item.pixels);
+        // Nothing past here reads the pixels, give their buffer back to the pool
+        inFlightBudget.Release(item.pixels.rgb.capacity() * sizeof(RGB));
+        decltype(item.pixels.rgb)().swap(item.pixels.rgb);
+        to_convert_rgb_to_hsl.Put(std::move(item));
     }
 }
 
 // Driver function for RgbToHsl(), constantly running on seperate thread
 // Get image from respective part of pipeline, convert its colour values from RGB to HSL then add it to the next section of the pipeline
 void RgbToHslDriver() {
-    bool loop = true;
+    // The pile closes once the pipeline has drained for good
+    while (true) {
+        PipelineImage item;
+        if (!to_convert_rgb_to_hsl.Pop(item))
+            break;
 
-    while (loop) {
-        if (to_convert_rgb_to_hsl.Num() > 0) {
-            Image img = to_convert_rgb_to_hsl.Pop();
-            //std::cout << "converting image pixels to hsl: " << img.fileName << std::endl;
-            RgbToHsl(img);
-            done.Put(img);
-        }
+        //std::cout << "converting image pixels to hsl: " << item.fileName << std::endl;
+        RgbToHsl(item.image);
+        done.Put(std::move(item));
+    }
+}
 
-        // This prevents this loop ending before imageCount is initially updated.
-        if (sortedImages.size() == imageCount && imageCount > 0) {
-            loop = false;
-        }
+// Insert a finished image, replacing an older result for the same file
+void AddToCatalog(const PipelineImage& item) {
+    const Image& img = item.image;
+    if (!options.external.empty()) {
+        externalSorter.Add(SortValue(img, options.sortKey), item.fileName);
+        externalCount++;
+        catalogVersion++;
+        processedCount++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(removedMutex);
+    std::error_code error;
+    if (removedInFlight.erase(item.fileName) || (checkInFlight && !fs::exists(fs::u8path(item.fileName), error))) {
+        imageCount--;
+        processedCount++;
+        return;
+    }
+
+    if (catalog.Add(img))
+        imageCount--;
+    catalogVersion++;
+    processedCount++;
+}
+
+// Merge the spilled runs and map the order for the viewer
+void FinishExternalSort() {
+    auto start = std::chrono::steady_clock::now();
+    if (!externalSorter.Finish() || !externalOrder.Open(options.external)) {
+        std::cout << "External sort into " << options.external << " failed" << std::endl;
+        return;
     }
+    externalReady = true;
+    catalogVersion++;
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "External sort: " << externalOrder.Size() << " images by " << SortKeyName(options.sortKey) << " from "
+              << externalSorter.GetStats().runs << " runs, merged in " << elapsed.count() << "s into " << options.external << std::endl;
+}
+
+// Catalog version the saved file holds, so an unchanged catalog isn't written again
+std::mutex catalogSaveMutex;
+uint64_t savedCatalogVersion = UINT64_MAX;
+
+// Save the catalog so the next run can browse it straight away, closing the one it replaces
+void SaveCatalogFile() {
+    std::lock_guard<std::mutex> saving(catalogSaveMutex);
+    uint64_t version = catalogVersion;
+    if (version == savedCatalogVersion)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    bool wasOpen;
+    {
+        std::lock_guard<std::mutex> guard(savedCatalogMutex);
+        wasOpen = savedCatalog.IsOpen();
+        savedCatalog.Close();
+    }
+
+    std::vector<Image> records;
+    std::array<std::vector<uint32_t>, SortKeyCount> orders;
+    catalog.Export(records, orders);
+    if (!SaveCatalog(CatalogFile(), records, orders)) {
+        std::cout << "Couldn't save the catalog to " << CatalogFile() << std::endl;
+        return;
+    }
+    // The grid moves from the saved order to this run's. That alone isn't a change to save.
+    if (wasOpen) {
+        uint64_t expected = version;
+        if (catalogVersion.compare_exchange_strong(expected, version + 1))
+            version++;
+        else
+            catalogVersion++;
+    }
+    savedCatalogVersion = version;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Catalog of " << records.size() << " images saved to " << CatalogFile() << " in " << elapsed.count() << "ms" << std::endl;
+}
+
+// Print per-format counts and totals once the pipeline has drained
+void PrintRunSummary() {
+    {
+        std::lock_guard<std::mutex> guard(drainedMutex);
+        drained = true;
+        drainedAt = std::chrono::steady_clock::now();
+        drainedCpuSeconds = ProcessCpuSeconds();
+        drainedFrames = framesDrawn;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    size_t catalogSize = CatalogSize();
+    std::cout << std::endl << "Processed " << catalogSize << " images in " << elapsed.count() << "s" << std::endl;
+
+    for (int i = 0; i < ImageFormatCount; i++) {
+        auto format = ImageFormat(i);
+        if (formatCounts[i] == 0)
+            continue;
+
+        std::cout << "\t" << FormatName(format) << ": " << formatCounts[i];
+        if (format == ImageFormat::Unknown)
+            std::cout << " (not an image, skipped)";
+        else if (!HasDecoder(format))
+            std::cout << " (no decoder, skipped)";
+        std::cout << std::endl;
+    }
+
+    std::cout << "\tfrom result cache: " << cacheHits << std::endl;
+    if (displayCopiesKept > 0)
+        std::cout << "\tdisplay copies handed to the viewer: " << displayCopiesKept << std::endl;
+    if (thumbnailWriter.IsOpen())
+        std::cout << "\tthumbnails written: " << thumbnailsWritten << " to " << options.thumbnails << std::endl;
+
+    auto duplicates = dedupIndex.Duplicates();
+    if (!duplicates.empty()) {
+        std::ofstream report(duplicates_file);
+        for (auto& pair : duplicates)
+            report << pair.first << "\t" << pair.second << std::endl;
+
+        std::cout << "\tduplicates (not decoded): " << duplicates.size() << ", listed in " << duplicates_file << std::endl;
+    }
+    if (failedDecodes > 0)
+        std::cout << "\tfailed to decode: " << failedDecodes << std::endl;
+
+    auto paths = CatalogPaths().GetStats();
+    std::cout << "Catalog: " << catalogSize << " images at " << ImageRecordBytes << " bytes each, " << paths.paths << " paths in "
+              << paths.directories << " directories interned in " << paths.bytes / 1024 << "KB" << std::endl;
+    std::cout << "In flight pixels peaked at " << inFlightBudget.Peak() / (1024 * 1024) << "MB of "
+              << inFlightBudget.Limit() / (1024 * 1024) << "MB" << std::endl;
+
+    auto pool = PixelBufferPool().GetStats();
+    std::cout << "Buffer pool: " << pool.systemAllocations << " system allocations, " << pool.reused << " reused";
+    if (pool.hugePageBlocks > 0)
+        std::cout << " (" << pool.hugePageBlocks << " on huge pages)";
+    std::cout << ", " << pool.retainedBytes / (1024 * 1024) << "MB kept for reuse" << std::endl;
 }
 
 // Driver function for SortList(), constantly running on seperate thread
 // Get image vector from respective part of pipeline, sort it then add it to the next section of the pipeline
 void SortDriver() {
-    bool loop = true;
-        while (loop) {
-            if (done.Num() > 0) {
-                auto img = done.Pop();
-                sortedImages.insert(img);
-                //std::cout << "First item sorted" << std::endl;
+    bool summaryPrinted = false;
+    // Images sorted since the pipeline last drained
+    bool sorted = true;
+    // When the catalog last changed, for saving it once it settles in watch mode
+    uint64_t seenVersion = catalogVersion;
+    auto changedAt = std::chrono::steady_clock::now();
+    while (true) {
+        // Drops and the end of the scan wake this without an item, they can finish the pipeline too.
+        // Once the first drain is done, watch mode also wakes it to save a settled catalog.
+        PipelineImage item;
+        bool popped = summaryPrinted ? done.Pop(item, std::chrono::duration_cast<std::chrono::milliseconds>(catalog_save_quiet))
+                                     : done.Pop(item);
+        if (popped) {
+            const Image& img = item.image;
+            auto display = std::move(item.pixels.display);
+            AddToCatalog(item);
+
+            if (display) {
+                displayCopyBytes -= size_t(display->getSize().x) * display->getSize().y * 4;
+                if (NearViewer(img)) {
+                    decodedCache.Put(item.fileName, display);
+                    displayCopiesKept++;
+                }
+            }
+            if (!img.cached)
+                resultCache.Append(img, item.fileName);
+            if (options.external.empty()) {
+                for (auto& copy : dedupIndex.Complete(img))
+                    done.Put(PipelineImage(copy, copy.FileName()));
+            }
+            sorted = true;
+            //std::cout << "First item sorted" << std::endl;
+        }
+
+        // Each time the pipeline drains index the new thumbnails. The first time save the catalog
+        // and print the summary, after that the catalog is saved when it has been quiet a while.
+        bool finished = PipelineFinished();
+        if (sorted && finished) {
+            sorted = false;
+            // Nothing is in flight, a removal that didn't catch its file was for one that never came
+            {
+                std::lock_guard<std::mutex> guard(removedMutex);
+                if (PipelineFinished()) {
+                    removedInFlight.clear();
+                    checkInFlight = false;
+                }
+            }
+            thumbnailWriter.Finish();
+            thumbnailPackVersion++;
+            if (!summaryPrinted) {
+                if (options.external.empty())
+                    SaveCatalogFile();
+                if (!options.external.empty())
+                    FinishExternalSort();
+                PrintRunSummary();
+                summaryPrinted = true;
             }
+            if (!options.watch) {
+                // Nothing more is coming, let the other stages return
+                for (pile_t* pile : { &to_get_pixels, &to_make_thumbnail, &to_get_average_color, &to_convert_rgb_to_hsl, &done })
+                    pile->Close();
+                return;
+            }
+        }
 
-            if (sortedImages.size() == imageCount && imageCount > 0)
-                loop = false;
+        auto now = std::chrono::steady_clock::now();
+        uint64_t version = catalogVersion;
+        if (version != seenVersion) {
+            seenVersion = version;
+            changedAt = now;
         }
+        else if (summaryPrinted && finished && options.external.empty() && now - changedAt >= catalog_save_quiet) {
+            SaveCatalogFile();
+            seenVersion = catalogVersion;
+        }
+    }
+}
+
+// Pipeline progress and queue depths for the HUD
+void FillPipelineStats(HudStats& stats) {
+    stats.processed = CatalogSize();
+    stats.total = imageCount;
+    stats.scanning = !loadingComplete;
+    stats.resultCacheHits = cacheHits;
+    stats.inFlightBytes = inFlightBudget.Current();
+    stats.inFlightPeak = inFlightBudget.Peak();
+    stats.inFlightLimit = inFlightBudget.Limit();
+    stats.sortKey = SortKeyName(catalog.Key());
+    stats.queues = {
+        { "get pixels", to_get_pixels.Num() },
+        { "thumbnail", to_make_thumbnail.Num() },
+        { "average", to_get_average_color.Num() },
+        { "rgb to hsl", to_convert_rgb_to_hsl.Num() },
+        { "sort", done.Num() },
+    };
 }
 
 // For Debugging, Print values and filename
@@ -287,14 +1007,13 @@ void PrintWhenComplete() {
     bool loop = true;    
 
     while (loop) {
-        if (sortedImages.size() == imageCount) {
-            std::vector<Image> Images;
-            std::copy(sortedImages.begin(), sortedImages.end(), std::back_inserter(Images));
+        if (PipelineFinished()) {
+            std::vector<Image> Images = CatalogSnapshot();
 
             std::cout << std::endl;
 
             for (auto img : Images) {
-                std::cout << img.fileName << "\t | \t" << img.hsl.h << std::endl;
+                std::cout << img.FileName() << "\t | \t" << img.hsl.h << std::endl;
             }
 
             loop = false; 
@@ -302,17 +1021,36 @@ void PrintWhenComplete() {
     }
 } 
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (!ParseOptions(argc, argv, options))
+        return EXIT_FAILURE;
+    if (options.folders.empty())
+        options.folders.push_back(image_folder);
+    PixelBufferPool().SetRetainLimit(options.poolMegabytes * 1024 * 1024);
+    PixelBufferPool().SetHugePages(options.hugePages);
+    inFlightBudget.SetLimit(options.inFlightMegabytes * 1024 * 1024);
+    catalog.SetKey(options.sortKey);
+    if (options.external.empty())
+        savedCatalog.Open(CatalogFile());
+    if (!options.external.empty() && !externalSorter.Open(options.external, options.externalMegabytes * 1024 * 1024))
+    {
+        std::cout << "Couldn't open " << options.external << " for the external sort" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     std::srand(static_cast<unsigned int>(std::time(NULL)));
     //std::cout << fs::current_path();
 
     // Define some constants
     const float pi = 3.14159f;
-    const int gameWidth = 800;
-    const int gameHeight = 600;
 
-    int imageIndex = 0;
+    // The file on screen (or being decoded for it), found again in each snapshot as the catalog reorders
+    std::string currentFile;
+    // +1 or -1, the way the user last moved through the images
+    int direction = 1;
+    // Position in the external or saved order, which are paged through rather than copied
+    int pagedIndex = -1;
 
     // Create the window of the application
     sf::RenderWindow window(sf::VideoMode(gameWidth, gameHeight, 32), "Image Fever",
@@ -320,8 +1058,33 @@ int main()
     window.setVerticalSyncEnabled(true);      
 
     // Create SFML objects to display the images
+    // Decoding happens on the loader's thread, this thread only uploads finished pixels
+    // Smoothing keeps a stretched proxy from looking blocky until the full image replaces it
     sf::Texture texture;
+    texture.setSmooth(true);
     sf::Sprite sprite;
+    decodedCache.SetBudget(options.cacheMegabytes * 1024 * 1024);
+    TextureLoader loader(decodedCache, gameWidth, gameHeight, options.thumbnails);
+    LoadedImage loaded;
+    uint64_t loaderPackVersion = 0;
+
+    // Contact sheet of every image in catalog order, created the first time it's opened
+    std::unique_ptr<ThumbnailGrid> grid;
+    bool gridMode = false;
+    uint64_t gridVersion = 0;
+    auto gridRefreshed = std::chrono::steady_clock::now();
+
+    // Zooming into the current image, tiles stream from its pyramid
+    DeepZoomView deepZoom(gameWidth, gameHeight, pyramid_folder);
+    // File whose pixels are in texture, stretched under the tiles until they arrive
+    std::string shownFile;
+    bool dragging = false;
+    sf::Vector2i dragFrom;
+
+    // Statistics overlay, H toggles it
+    Hud hud;
+    HudStats hudStats;
+    hud.LoadFont(options.font);
     
     // This is used to also output values when complete
     // std::array<std::thread, 6> threads = { std::thread(LoadImages), std::thread(GetPixelsDriver), std::thread(AverageColourDriver), std::thread(RgbToHslDriver), std::thread(SortDriver), std::thread(PrintWhenComplete) };
@@ -332,33 +1095,62 @@ int main()
     for (auto& t : threads)
         t.detach();
 
-    
-    // If there is no texture and a image that has been completely processed
-    // loop until one has been processed then set the image
-    while (true) {
-        if (sprite.getTexture() == nullptr && sortedImages.size() > 0)
+    if (!options.thumbnails.empty())
+        std::thread(ThumbnailDriver).detach();
+    if (options.watch)
+        std::thread(WatchDriver).detach();
+
+    // Time to first frame is measured from startup to the first display() with an image in it
+    bool firstFrameShown = false;
+    bool firstFrameFromCatalog = false;
+
+    // Only draw when something on screen has changed: input, a resize or a newly arrived image
+    bool dirty = true;
+
+    sf::Clock clock;
+    while (window.isOpen())
+    {
+        // Nothing requested yet: show the first of the sorted images, or if none is ready within the budget
+        // the first file found, rather than leaving the window blank while the pipeline warms up
+        if (currentFile.empty())
         {
             std::vector<Image> Images;
-            std::copy(sortedImages.begin(), sortedImages.end(), std::back_inserter(Images));
-            if (texture.loadFromFile(Images[0].fileName))
+            if (PagedBrowsing() && PagedCount() > 0)
             {
-                sprite = sf::Sprite(texture);
-                sprite.setScale(ScaleFromDimensions(texture.getSize(), gameWidth, gameHeight));
+                currentFile = PagedPath(0);
+                pagedIndex = 0;
+                firstFrameFromCatalog = true;
             }
+            else if (!(Images = CatalogSnapshot()).empty())
+            {
+                currentFile = Images[0].FileName();
+                firstFrameFromCatalog = true;
+            }
+            else if (std::chrono::steady_clock::now() - startTime > first_frame_budget)
+                currentFile = FirstEnumeratedFile();
 
-            break;
+            if (!currentFile.empty())
+            {
+                window.setTitle(currentFile);
+                ViewerMoved(currentFile);
+                loader.Request(currentFile);
+            }
         }
-    }
 
-    sf::Clock clock;
-    while (window.isOpen())
-    {
-        std::vector<Image> Images;
+        // With no decode in flight and nothing due from the pipeline only input can change the
+        // picture, so sleep in waitEvent rather than spinning. Watch mode keeps the grid polling
+        // for new files, but only at watch_poll_interval.
+        bool settled = !dirty && !currentFile.empty() && !loader.Busy() && !hud.Visible() && !deepZoom.Busy() &&
+                       !(gridMode && (grid->Busy() || catalogVersion != gridVersion));
+        bool idle = settled && !(gridMode && options.watch);
 
         // Handle events
         sf::Event event;
-        while (window.pollEvent(event))
+        for (bool hasEvent = idle ? window.waitEvent(event) : window.pollEvent(event); hasEvent; hasEvent = window.pollEvent(event))
         {
+            if (event.type != sf::Event::MouseMoved)
+                dirty = true;
+
             // Window closed or escape key pressed: exit
             if ((event.type == sf::Event::Closed) ||
                ((event.type == sf::Event::KeyPressed) && (event.key.code == sf::Keyboard::Escape)))
@@ -376,37 +1168,302 @@ int main()
                 window.setView(view);
             }
 
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::H)
+            {
+                hud.Toggle();
+                continue;
+            }
+
+            // G switches between the single image and the thumbnail grid
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::G)
+            {
+                gridMode = !gridMode;
+                if (gridMode)
+                {
+                    deepZoom.Close();
+                    if (!grid)
+                        grid = std::make_unique<ThumbnailGrid>(gameWidth, gameHeight, options.thumbnails);
+                    gridVersion = catalogVersion;
+                    gridRefreshed = std::chrono::steady_clock::now();
+                    grid->SetFiles(BrowseFiles(pagedIndex));
+                    grid->Select(currentFile);
+                }
+                continue;
+            }
+
+            // S re-sorts the catalog by the next key, from the values every image already has
+            // The external order was written by the --sort key alone, it can't be re-sorted
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::S && !options.external.empty())
+            {
+                std::cout << "The external order is sorted by " << SortKeyName(options.sortKey) << ", pick another key with --sort" << std::endl;
+                continue;
+            }
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::S)
+            {
+                SortKey key = SortKey((int(catalog.Key()) + 1) % SortKeyCount);
+                hudStats.sortMs = catalog.SetKey(key);
+                catalogVersion++;
+                std::cout << "Sorted by " << SortKeyName(key) << " in " << hudStats.sortMs << "ms" << std::endl;
+                if (gridMode)
+                {
+                    std::string selected = grid->Selected();
+                    gridVersion = catalogVersion;
+                    gridRefreshed = std::chrono::steady_clock::now();
+                    grid->SetFiles(BrowseFiles(pagedIndex));
+                    grid->Select(selected);
+                }
+                continue;
+            }
+
+            // Grid navigation: arrows move the selection, page keys and the wheel scroll,
+            // +/- change the cell size, Enter or clicking the selection opens it
+            if (gridMode)
+            {
+                bool open = false;
+                if (event.type == sf::Event::KeyPressed)
+                {
+                    switch (event.key.code)
+                    {
+                    case sf::Keyboard::Left: grid->MoveSelection(-1, 0); break;
+                    case sf::Keyboard::Right: grid->MoveSelection(1, 0); break;
+                    case sf::Keyboard::Up: grid->MoveSelection(0, -1); break;
+                    case sf::Keyboard::Down: grid->MoveSelection(0, 1); break;
+                    case sf::Keyboard::PageUp: grid->Scroll(-float(gameHeight)); break;
+                    case sf::Keyboard::PageDown: grid->Scroll(float(gameHeight)); break;
+                    case sf::Keyboard::Add: case sf::Keyboard::Equal: grid->Zoom(1); break;
+                    case sf::Keyboard::Subtract: case sf::Keyboard::Hyphen: grid->Zoom(-1); break;
+                    case sf::Keyboard::Enter: open = true; break;
+                    default: break;
+                    }
+                }
+                else if (event.type == sf::Event::MouseWheelScrolled)
+                    grid->Scroll(-event.mouseWheelScroll.delta * 64);
+                else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
+                {
+                    std::string before = grid->Selected();
+                    auto point = window.mapPixelToCoords({ event.mouseButton.x, event.mouseButton.y });
+                    open = grid->SelectAt(point.x, point.y) && grid->Selected() == before;
+                }
+
+                if (!grid->Selected().empty())
+                    window.setTitle(grid->Selected());
+                if (open && !grid->Selected().empty())
+                {
+                    currentFile = grid->Selected();
+                    pagedIndex = grid->SelectedIndex();
+                    ViewerMoved(currentFile);
+                    loader.Request(currentFile);
+                    deepZoom.Close();
+                    gridMode = false;
+                }
+                continue;
+            }
+
+            // +/- and the mouse wheel zoom into the current image, while zoomed in the arrows and
+            // dragging pan. Zooming back out to fit returns to browsing.
+            bool zoomIn = (event.type == sf::Event::KeyPressed && (event.key.code == sf::Keyboard::Add || event.key.code == sf::Keyboard::Equal)) ||
+                          (event.type == sf::Event::MouseWheelScrolled && event.mouseWheelScroll.delta > 0);
+            if (!deepZoom.IsOpen() && zoomIn && !currentFile.empty())
+                deepZoom.Open(currentFile);
+
+            if (deepZoom.IsOpen())
+            {
+                float centreX = gameWidth / 2.f, centreY = gameHeight / 2.f;
+                if (event.type == sf::Event::KeyPressed)
+                {
+                    switch (event.key.code)
+                    {
+                    case sf::Keyboard::Add: case sf::Keyboard::Equal: deepZoom.ZoomAt(1.5f, centreX, centreY); break;
+                    case sf::Keyboard::Subtract: case sf::Keyboard::Hyphen: deepZoom.ZoomAt(1 / 1.5f, centreX, centreY); break;
+                    case sf::Keyboard::Left: deepZoom.Pan(-gameWidth / 4.f, 0); break;
+                    case sf::Keyboard::Right: deepZoom.Pan(gameWidth / 4.f, 0); break;
+                    case sf::Keyboard::Up: deepZoom.Pan(0, -gameHeight / 4.f); break;
+                    case sf::Keyboard::Down: deepZoom.Pan(0, gameHeight / 4.f); break;
+                    default: break;
+                    }
+                }
+                else if (event.type == sf::Event::MouseWheelScrolled)
+                {
+                    auto point = window.mapPixelToCoords({ event.mouseWheelScroll.x, event.mouseWheelScroll.y });
+                    deepZoom.ZoomAt(std::pow(1.25f, event.mouseWheelScroll.delta), point.x, point.y);
+                }
+                else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
+                {
+                    dragging = true;
+                    dragFrom = { event.mouseButton.x, event.mouseButton.y };
+                }
+                else if (event.type == sf::Event::MouseButtonReleased)
+                    dragging = false;
+                else if (event.type == sf::Event::MouseMoved && dragging)
+                {
+                    deepZoom.Pan(float(dragFrom.x - event.mouseMove.x), float(dragFrom.y - event.mouseMove.y));
+                    dragFrom = { event.mouseMove.x, event.mouseMove.y };
+                    dirty = true;
+                }
+
+                if (!deepZoom.Zoomed())
+                    deepZoom.Close();
+                continue;
+            }
+
             // Arrow key handling!
             if (event.type == sf::Event::KeyPressed)
             {                          
-                // adjust the image index
-                if (event.key.code == sf::Keyboard::Key::Left)
-                    imageIndex = (imageIndex + sortedImages.size() - 1) % sortedImages.size();
-                else if (event.key.code == sf::Keyboard::Key::Right)
-                    imageIndex = (imageIndex + 1) % sortedImages.size();
-                // get image filename
-                std::copy(sortedImages.begin(), sortedImages.end(), std::back_inserter(Images));
-                if (Images.size() > 0)
+                // get image filename, the catalog can grow or shrink in watch mode
+                // External and saved orders are read from their mappings instead of copied
+                std::vector<Image> Images;
+                bool paged = PagedBrowsing();
+                int count;
+                if (paged)
+                    count = int(std::min<uint64_t>(PagedCount(), INT_MAX));
+                else
+                {
+                    Images = CatalogSnapshot();
+                    count = int(Images.size());
+                }
+                auto fileAt = [&](int index) { return paged ? PagedPath(uint64_t(index)) : Images[index].FileName(); };
+                if (count > 0)
                 {
-                    auto& imageFilename = Images[imageIndex].fileName;
+                    // adjust the image index
+                    if (event.key.code == sf::Keyboard::Key::Left)
+                        direction = -1;
+                    else if (event.key.code == sf::Keyboard::Key::Right)
+                        direction = 1;
+                    else
+                        continue;
+                    // Step from wherever the current image has been sorted to, a file that
+                    // isn't sorted yet steps onto the first or last one
+                    int imageIndex = paged ? pagedIndex : CatalogIndex(Images, currentFile);
+                    if (imageIndex < 0)
+                        imageIndex = direction > 0 ? -1 : count;
+                    imageIndex = ((imageIndex + direction) % count + count) % count;
+                    if (paged)
+                        pagedIndex = imageIndex;
+
+                    std::string imageFilename = fileAt(imageIndex);
                     // set it as the window title
                     window.setTitle(imageFilename);
-                    // ... and load the appropriate texture, and put it in the sprite
-                    if (texture.loadFromFile(imageFilename))
-                    {
-                        sprite = sf::Sprite(texture);
-                        sprite.setScale(ScaleFromDimensions(texture.getSize(), gameWidth, gameHeight));
-                    }
+                    // ... and start decoding it, the previous image stays up until it's ready
+                    // Neighbours further along the direction of travel (and one behind) are decoded into the cache next
+                    std::vector<std::string> prefetch;
+                    for (int i = 1; i <= options.prefetch && i < count; i++)
+                        prefetch.push_back(fileAt(((imageIndex + direction * i) % count + count) % count));
+                    if (count > 2)
+                        prefetch.push_back(fileAt(((imageIndex - direction) % count + count) % count));
+                    currentFile = imageFilename;
+                    ViewerMoved(currentFile);
+                    loader.Request(imageFilename, prefetch);
                 }
             }
         }
 
+        auto frameStart = std::chrono::steady_clock::now();
+
+        // Thumbnails written this run can be proxies once the pack has an index for them
+        if (thumbnailPackVersion != loaderPackVersion)
+        {
+            loaderPackVersion = thumbnailPackVersion;
+            loader.ReopenPack();
+        }
+
+        // Upload the newest decoded image, if one has arrived, and put it in the sprite
+        if (loader.TryTake(loaded))
+        {
+            if (texture.loadFromImage(*loaded.image))
+            {
+                sprite = sf::Sprite(texture);
+                sprite.setScale(ScaleFromDimensions(texture.getSize(), gameWidth, gameHeight));
+                shownFile = loaded.fileName;
+                dirty = true;
+            }
+            if (loaded.proxy)
+            {
+                hudStats.proxyMs = loaded.decodeMs;
+            }
+            else
+            {
+                hudStats.decodeMs = loaded.decodeMs;
+                hudStats.fromCache = loaded.fromCache;
+            }
+            hudStats.proxyShown = loaded.proxy;
+            hudStats.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        }
+
+        if (gridMode)
+        {
+            // The order keeps changing while the pipeline runs, pick it up a few times a second
+            auto now = std::chrono::steady_clock::now();
+            if (catalogVersion != gridVersion && now - gridRefreshed > std::chrono::milliseconds(250))
+            {
+                gridVersion = catalogVersion;
+                gridRefreshed = now;
+                grid->SetFiles(BrowseFiles(pagedIndex));
+                dirty = true;
+            }
+            if (grid->Update())
+                dirty = true;
+        }
+        else if (deepZoom.IsOpen() && deepZoom.Update())
+            dirty = true;
+
+        if (hud.Due())
+            dirty = true;
+
+        // Waiting on a decode or the pipeline, but there's nothing new to show yet
+        if (!dirty)
+        {
+            std::this_thread::sleep_for(settled ? watch_poll_interval : busy_poll_interval);
+            continue;
+        }
+        dirty = false;
+
         // Clear the window
         window.clear(sf::Color(0, 0, 0));
-        // draw the sprite
-        window.draw(sprite);
+        // draw the grid or the sprite
+        if (gridMode)
+            grid->Draw(window);
+        else if (deepZoom.IsOpen())
+            deepZoom.Draw(window, shownFile == deepZoom.FileName() ? &texture : nullptr);
+        else
+            window.draw(sprite);
+        if (hud.Visible())
+        {
+            auto navigation = decodedCache.GetStats();
+            hudStats.navigationHits = navigation.hits;
+            hudStats.navigationMisses = navigation.misses;
+            FillPipelineStats(hudStats);
+            hud.Draw(window, hudStats);
+        }
         // Display things on screen
         window.display();
+        framesDrawn++;
+        hudStats.frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+
+        if (!firstFrameShown && sprite.getTexture() != nullptr)
+        {
+            firstFrameShown = true;
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+            std::cout << "First frame after " << elapsed.count() << "ms ("
+                      << (firstFrameFromCatalog ? "sorted" : "first file found") << ", "
+                      << CatalogSize() << " images sorted so far)" << std::endl;
+        }
+    }
+
+    // Changes since the last save in watch mode, which waits for the catalog to settle
+    if (options.watch && options.external.empty() && PipelineFinished())
+        SaveCatalogFile();
+
+    auto cacheStats = decodedCache.GetStats();
+    std::cout << "Navigation cache: " << cacheStats.hits << " hits, " << cacheStats.misses << " misses, "
+              << cacheStats.evictions << " evictions, " << cacheStats.bytes / (1024 * 1024) << "MB in " << cacheStats.entries << " images" << std::endl;
+
+    // Whatever ran after the pipeline drained: input, watch mode and the viewer sitting idle
+    std::lock_guard<std::mutex> guard(drainedMutex);
+    if (drained) {
+        std::chrono::duration<double> idle = std::chrono::steady_clock::now() - drainedAt;
+        double cpu = ProcessCpuSeconds() - drainedCpuSeconds;
+        std::cout << "Since the pipeline finished: " << cpu * 1000 << "ms of CPU time in " << idle.count() << "s ("
+                  << (idle.count() > 0 ? 100 * cpu / idle.count() : 0) << "% of a core), " << framesDrawn - drainedFrames << " frames drawn" << std::endl;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,44 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+
+MemoryBudget::MemoryBudget(size_t limitBytes) : limit(limitBytes) {
+}
+
+void MemoryBudget::SetLimit(size_t limitBytes) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        limit = limitBytes;
+    }
+    released.notify_all();
+}
+
+void MemoryBudget::Acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [&] { return current == 0 || current + bytes <= limit; });
+    current += bytes;
+    peak = std::max(peak, current);
+}
+
+void MemoryBudget::Release(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        current -= std::min(bytes, current);
+    }
+    released.notify_all();
+}
+
+size_t MemoryBudget::Limit() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return limit;
+}
+
+size_t MemoryBudget::Current() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return current;
+}
+
+size_t MemoryBudget::Peak() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return peak;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Byte accounted admission control for pixels in flight through the pipeline
+//
+// A stage reserves the bytes an image will need before decoding it and the stages after it
+// release them as the pixels are freed. When the budget is spent Acquire waits for a release,
+// so a decoder that outruns the stages after it stalls instead of growing memory without
+// bound. An image bigger than the whole budget is still let through once nothing else is in
+// flight, otherwise it could never be processed.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limitBytes);
+
+    // Change the limit, for a budget created before the options were read
+    void SetLimit(size_t limitBytes);
+
+    // Wait until bytes fit in the budget, then reserve them
+    void Acquire(size_t bytes);
+    void Release(size_t bytes);
+
+    size_t Limit() const;
+    size_t Current() const;
+    size_t Peak() const;
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    size_t limit;
+    size_t current = 0;
+    size_t peak = 0;
+};
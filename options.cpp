@@ -0,0 +1,125 @@
+#include "options.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+void PrintUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options] [folder...]" << std::endl
+              << "  --watch                keep watching the folders and process new, changed and deleted files" << std::endl
+              << "  --thumbnails <pack>    write a thumbnail of every decoded image to a pack file" << std::endl
+              << "  --cache-mb <n>         memory for decoded images kept for navigation (default 512)" << std::endl
+              << "  --prefetch <k>         neighbours decoded ahead while browsing (default 2, at most 1000)" << std::endl
+              << "  --font <ttf>           font for the HUD (H to toggle)" << std::endl
+              << "  --pool-mb <n>          freed pixel buffers kept for reuse by later decodes (default 256)" << std::endl
+              << "  --huge-pages           back large pixel buffers with huge pages where the system allows it" << std::endl
+              << "  --inflight-mb <n>      decoded pixels allowed in the pipeline before decoding waits (default 1024)" << std::endl
+              << "  --sort <key>           order images by hue, saturation, lightness, value, hsv-saturation or hue-bands" << std::endl
+              << "                         (default hue, S cycles), or perceptually by oklab-l, -a, -b, -chroma or -hue," << std::endl
+              << "                         or the same for lab" << std::endl
+              << "  --external <folder>    sort on disk through folder, for more images than fit in memory" << std::endl
+              << "  --external-mb <n>      memory the external sort uses before spilling to disk (default 256)" << std::endl
+              << "  --linear-light         average colours in linear light instead of as stored sRGB values" << std::endl;
+}
+
+// Megabyte options are used as byte counts, so they must still fit once multiplied up
+constexpr uint64_t MaxMegabytes = SIZE_MAX / (1024 * 1024);
+// More neighbours than this is just decoding the whole catalog
+constexpr uint64_t MaxPrefetch = 1000;
+
+// The whole of argv[i] as a number in [0, max], the value of the option before it
+// A sign, trailing characters or a number out of range print the usage and give false
+bool ParseCount(char* argv[], int i, uint64_t max, uint64_t& out) {
+    const char* text = argv[i];
+    const char* end = text + std::strlen(text);
+    auto result = std::from_chars(text, end, out);
+    if (result.ec == std::errc() && result.ptr == end && end != text && out <= max)
+        return true;
+
+    std::cout << "Bad value for " << argv[i - 1] << ": " << text << std::endl;
+    PrintUsage(argv[0]);
+    return false;
+}
+
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--watch") {
+            options.watch = true;
+        }
+        else if (arg == "--thumbnails" && i + 1 < argc) {
+            options.thumbnails = argv[++i];
+        }
+        else if (arg == "--cache-mb" && i + 1 < argc) {
+            uint64_t value;
+            if (!ParseCount(argv, ++i, MaxMegabytes, value))
+                return false;
+            options.cacheMegabytes = size_t(value);
+        }
+        else if (arg == "--prefetch" && i + 1 < argc) {
+            uint64_t value;
+            if (!ParseCount(argv, ++i, MaxPrefetch, value))
+                return false;
+            options.prefetch = int(value);
+        }
+        else if (arg == "--font" && i + 1 < argc) {
+            options.font = argv[++i];
+        }
+        else if (arg == "--pool-mb" && i + 1 < argc) {
+            uint64_t value;
+            if (!ParseCount(argv, ++i, MaxMegabytes, value))
+                return false;
+            options.poolMegabytes = size_t(value);
+        }
+        else if (arg == "--huge-pages") {
+            options.hugePages = true;
+        }
+        else if (arg == "--inflight-mb" && i + 1 < argc) {
+            uint64_t value;
+            if (!ParseCount(argv, ++i, MaxMegabytes, value))
+                return false;
+            options.inFlightMegabytes = size_t(value);
+        }
+        else if (arg == "--sort" && i + 1 < argc) {
+            if (!ParseSortKey(argv[++i], options.sortKey)) {
+                std::cout << "Unknown sort key " << argv[i] << std::endl;
+                PrintUsage(argv[0]);
+                return false;
+            }
+        }
+        else if (arg == "--external" && i + 1 < argc) {
+            options.external = argv[++i];
+        }
+        else if (arg == "--external-mb" && i + 1 < argc) {
+            uint64_t value;
+            if (!ParseCount(argv, ++i, MaxMegabytes, value))
+                return false;
+            options.externalMegabytes = size_t(value);
+        }
+        else if (arg == "--linear-light") {
+            options.linearLight = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cout << "Unknown option " << arg << std::endl;
+            PrintUsage(argv[0]);
+            return false;
+        }
+        else {
+            options.folders.push_back(arg);
+        }
+    }
+
+    // The external order is written once, it can't take changes the way the catalog does
+    if (options.watch && !options.external.empty()) {
+        std::cout << "--watch can't be combined with --external" << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "sort_keys.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Command line settings
+struct Options {
+    // Folders to enumerate, image_folder if none are given
+    std::vector<std::string> folders;
+    // Keep watching the folders and feed changes into the pipeline
+    bool watch = false;
+    // Pack file to write thumbnails to, empty to skip the thumbnail stage
+    std::string thumbnails;
+    // Memory budget for decoded images kept for navigation
+    size_t cacheMegabytes = 512;
+    // Neighbours decoded ahead in the direction of travel
+    int prefetch = 2;
+    // Font for the HUD, system fonts are tried if empty or missing
+    std::string font;
+    // Freed pixel buffers kept for the next decodes
+    size_t poolMegabytes = 256;
+    // Back large pixel buffers with huge pages
+    bool hugePages = false;
+    // Decoded pixels allowed in the pipeline at once before the decoder waits
+    size_t inFlightMegabytes = 1024;
+    // Key the catalog is sorted by at start, S cycles through the others
+    SortKey sortKey = SortKey::Hue;
+    // Folder to sort through on disk instead of in memory, for catalogs larger than RAM
+    std::string external;
+    // Memory the external sort holds records in before spilling a run
+    size_t externalMegabytes = 256;
+    // Average colours in linear light rather than as stored, cached and saved apart from sRGB ones
+    bool linearLight = false;
+};
+
+// Parse argv, printing usage and returning false on an unknown flag or a bad value
+bool ParseOptions(int argc, char* argv[], Options& options);
@@ -0,0 +1,224 @@
+#include "path_arena.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace {
+
+constexpr size_t LengthBytes = sizeof(uint16_t);
+constexpr size_t InitialTableSize = 1024;
+
+uint64_t Pack(PathId id) {
+    return uint64_t(id.directory) << 32 | id.name;
+}
+
+PathId Unpack(uint64_t packed) {
+    return { uint32_t(packed >> 32), uint32_t(packed) };
+}
+
+// Split after the last separator, either kind so Windows paths split too
+void SplitPath(std::string_view path, std::string_view& directory, std::string_view& name) {
+    size_t separator = path.find_last_of("/\\");
+    size_t split = separator == std::string_view::npos ? 0 : separator + 1;
+    directory = path.substr(0, split);
+    name = path.substr(split);
+}
+
+// Compare a + b against c + d as strings, without joining them
+int CompareJoined(std::string_view a, std::string_view b, std::string_view c, std::string_view d) {
+    // Directories mostly differ somewhere inside, compare that part in one go
+    size_t common = std::min(a.size(), c.size());
+    if (int result = std::memcmp(a.data(), c.data(), common))
+        return result < 0 ? -1 : 1;
+
+    size_t left = a.size() + b.size(), right = c.size() + d.size();
+    for (size_t i = common, n = std::min(left, right); i < n; i++) {
+        unsigned char x = i < a.size() ? a[i] : b[i - a.size()];
+        unsigned char y = i < c.size() ? c[i] : d[i - c.size()];
+        if (x != y)
+            return x < y ? -1 : 1;
+    }
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+}
+
+PathArena::PathArena() {
+    // Offset 0 is the empty text and directory 0 the empty directory, so PathId{} is the empty path
+    Store({});
+    directoryChunks[0] = std::make_unique<uint32_t[]>(DirectoriesPerChunk);
+    directoryChunks[0][0] = 0;
+    directoryCount = 1;
+    directoryIds.emplace(std::string_view(), 0);
+    table.assign(InitialTableSize, 0);
+}
+
+uint32_t PathArena::Store(std::string_view text) {
+    // Paths are capped at 64KB by the length, far past what any file system allows for a name
+    size_t length = std::min(text.size(), size_t(UINT16_MAX));
+    size_t needed = LengthBytes + length;
+
+    // Text never straddles two chunks
+    if (used % ChunkBytes + needed > ChunkBytes)
+        used += ChunkBytes - used % ChunkBytes;
+    size_t chunk = used / ChunkBytes;
+    if (chunk >= ChunkCount)
+        throw std::bad_alloc();
+    if (!chunks[chunk])
+        chunks[chunk] = std::make_unique<char[]>(ChunkBytes);
+
+    char* out = chunks[chunk].get() + used % ChunkBytes;
+    uint16_t prefix = uint16_t(length);
+    std::memcpy(out, &prefix, LengthBytes);
+    std::memcpy(out + LengthBytes, text.data(), length);
+
+    uint32_t offset = uint32_t(used);
+    used += needed;
+    return offset;
+}
+
+std::string_view PathArena::Text(uint32_t offset) const {
+    const char* in = chunks[offset / ChunkBytes].get() + offset % ChunkBytes;
+    uint16_t length;
+    std::memcpy(&length, in, LengthBytes);
+    return { in + LengthBytes, length };
+}
+
+uint32_t PathArena::DirectoryOffset(uint32_t directory) const {
+    return directoryChunks[directory / DirectoriesPerChunk][directory % DirectoriesPerChunk];
+}
+
+uint64_t PathArena::HashPath(uint32_t directory, std::string_view name) const {
+    return HashBytes(name.data(), name.size(), directory);
+}
+
+void PathArena::GrowTable() {
+    std::vector<uint64_t> grown(table.size() * 2, 0);
+    size_t mask = grown.size() - 1;
+    for (uint64_t packed : table) {
+        if (packed == 0)
+            continue;
+        PathId id = Unpack(packed);
+        size_t slot = HashPath(id.directory, Text(id.name)) & mask;
+        while (grown[slot] != 0)
+            slot = (slot + 1) & mask;
+        grown[slot] = packed;
+    }
+    table.swap(grown);
+}
+
+PathId PathArena::Intern(std::string_view path) {
+    if (path.empty())
+        return {};
+
+    std::string_view directoryText, name;
+    SplitPath(path, directoryText, name);
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    PathId id;
+    auto known = directoryIds.find(directoryText);
+    if (known != directoryIds.end()) {
+        id.directory = known->second;
+    }
+    else {
+        if (directoryCount >= DirectoriesPerChunk * ChunkCount)
+            throw std::bad_alloc();
+        auto& chunk = directoryChunks[directoryCount / DirectoriesPerChunk];
+        if (!chunk)
+            chunk = std::make_unique<uint32_t[]>(DirectoriesPerChunk);
+
+        uint32_t offset = Store(directoryText);
+        chunk[directoryCount % DirectoriesPerChunk] = offset;
+        id.directory = directoryCount++;
+        directoryIds.emplace(Text(offset), id.directory);
+    }
+
+    size_t mask = table.size() - 1;
+    size_t slot = HashPath(id.directory, name) & mask;
+    for (; table[slot] != 0; slot = (slot + 1) & mask) {
+        PathId existing = Unpack(table[slot]);
+        if (existing.directory == id.directory && Text(existing.name) == name)
+            return existing;
+    }
+
+    id.name = Store(name);
+    table[slot] = Pack(id);
+    pathCount++;
+    // Keep the table at most three quarters full so probes stay short
+    if (pathCount * 4 > table.size() * 3)
+        GrowTable();
+    return id;
+}
+
+bool PathArena::Find(std::string_view path, PathId& out) const {
+    if (path.empty()) {
+        out = {};
+        return true;
+    }
+
+    std::string_view directoryText, name;
+    SplitPath(path, directoryText, name);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto known = directoryIds.find(directoryText);
+    if (known == directoryIds.end())
+        return false;
+
+    size_t mask = table.size() - 1;
+    for (size_t slot = HashPath(known->second, name) & mask; table[slot] != 0; slot = (slot + 1) & mask) {
+        PathId existing = Unpack(table[slot]);
+        if (existing.directory == known->second && Text(existing.name) == name) {
+            out = existing;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string_view PathArena::Directory(PathId id) const {
+    return Text(DirectoryOffset(id.directory));
+}
+
+std::string_view PathArena::Name(PathId id) const {
+    return Text(id.name);
+}
+
+std::string PathArena::Path(PathId id) const {
+    std::string_view directory = Directory(id), name = Name(id);
+    std::string path;
+    path.reserve(directory.size() + name.size());
+    path.append(directory).append(name);
+    return path;
+}
+
+int PathArena::Compare(PathId a, PathId b) const {
+    if (a.directory == b.directory)
+        return Name(a).compare(Name(b));
+    return CompareJoined(Directory(a), Name(a), Directory(b), Name(b));
+}
+
+PathArena::Stats PathArena::GetStats() const {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    Stats stats;
+    stats.paths = pathCount;
+    // Not counting the empty directory every arena starts with
+    stats.directories = directoryCount - 1;
+    for (auto& chunk : chunks)
+        stats.bytes += chunk ? ChunkBytes : 0;
+    for (auto& chunk : directoryChunks)
+        stats.bytes += chunk ? DirectoriesPerChunk * sizeof(uint32_t) : 0;
+    // Roughly a node and a bucket per directory
+    stats.bytes += directoryIds.size() * (sizeof(std::pair<std::string_view, uint32_t>) + 2 * sizeof(void*));
+    stats.bytes += table.size() * sizeof(uint64_t);
+    return stats;
+}
+
+PathArena& CatalogPaths() {
+    // Never destroyed, paths can still be read by threads while the program exits
+    static PathArena* arena = new PathArena();
+    return *arena;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A path interned in a PathArena: the directory it's in and where its name starts in the arena
+// The default id is the empty path
+struct PathId {
+    uint32_t directory = 0;
+    uint32_t name = 0;
+
+    bool operator==(const PathId& other) const { return directory == other.directory && name == other.name; }
+    bool operator!=(const PathId& other) const { return !(*this == other); }
+};
+
+// Interned file paths for catalogs of millions of images
+//
+// Most paths share a handful of directories, so each directory's text is stored once in a
+// directory table and each file name once in a shared arena. A path is then 8 bytes that
+// copy and compare cheaply, instead of a std::string with a heap allocation repeating the
+// directory. The arena grows in fixed 1MB chunks that never move, so reading a path needs no
+// lock; only interning does. Interning the same path twice gives the same id.
+class PathArena {
+public:
+    struct Stats {
+        size_t paths = 0;
+        size_t directories = 0;
+        // Everything the arena holds: text, directory table and the lookup tables
+        size_t bytes = 0;
+    };
+
+    PathArena();
+
+    PathArena(const PathArena&) = delete;
+    PathArena& operator=(const PathArena&) = delete;
+
+    // Id for path, adding it if it's new
+    PathId Intern(std::string_view path);
+    // Id of a path interned earlier, false if it never was
+    bool Find(std::string_view path, PathId& out) const;
+
+    // The directory includes its trailing separator, so Directory + Name is the whole path
+    std::string_view Directory(PathId id) const;
+    std::string_view Name(PathId id) const;
+    std::string Path(PathId id) const;
+
+    // Orders ids the same way their whole paths compare as strings
+    int Compare(PathId a, PathId b) const;
+
+    Stats GetStats() const;
+
+private:
+    static constexpr size_t ChunkBytes = 1 << 20;
+    static constexpr size_t ChunkCount = 4096;
+    static constexpr size_t DirectoriesPerChunk = 4096;
+
+    // Copies text into the arena behind a 2 byte length, returns its offset
+    uint32_t Store(std::string_view text);
+    std::string_view Text(uint32_t offset) const;
+    uint32_t DirectoryOffset(uint32_t directory) const;
+    uint64_t HashPath(uint32_t directory, std::string_view name) const;
+    void GrowTable();
+
+    mutable std::mutex mutex;
+
+    // Arena text, a chunk is filled before the next one is started
+    std::array<std::unique_ptr<char[]>, ChunkCount> chunks;
+    size_t used = 0;
+
+    // Directory id -> offset of its text, and back from the text
+    std::array<std::unique_ptr<uint32_t[]>, ChunkCount> directoryChunks;
+    uint32_t directoryCount = 0;
+    std::unordered_map<std::string_view, uint32_t> directoryIds;
+
+    // Open addressed set of interned ids (directory << 32 | name), 0 marks an empty slot
+    std::vector<uint64_t> table;
+    size_t pathCount = 0;
+};
+
+// The arena every Image path lives in
+PathArena& CatalogPaths();
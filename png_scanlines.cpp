@@ -0,0 +1,452 @@
+#include "png_scanlines.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr unsigned char Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// Deflate's furthest match
+constexpr size_t WindowBytes = 32768;
+constexpr size_t LongestMatch = 258;
+
+// Larger sides are left to stb, a damaged header shouldn't ask for GBs of rows or tiles. Four times
+// the largest JPEG; the tile pyramid holds 256 rows per level and a table entry per tile.
+constexpr uint32_t MaxSide = 1 << 18;
+
+constexpr uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr uint8_t LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr uint16_t DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr uint8_t DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// Order the code length code lengths are sent in
+constexpr uint8_t CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+uint32_t BigEndian32(const unsigned char* bytes) {
+    return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | bytes[3];
+}
+
+int ReverseBits(int code, int length) {
+    int reversed = 0;
+    for (int i = 0; i < length; i++, code >>= 1)
+        reversed = reversed << 1 | (code & 1);
+    return reversed;
+}
+
+uint8_t Paeth(int left, int up, int upLeft) {
+    int p = left + up - upLeft;
+    int toLeft = std::abs(p - left), toUp = std::abs(p - up), toUpLeft = std::abs(p - upLeft);
+    if (toLeft <= toUp && toLeft <= toUpLeft)
+        return uint8_t(left);
+    return uint8_t(toUp <= toUpLeft ? up : upLeft);
+}
+
+}
+
+bool PngScanlines::Open(const unsigned char* bytes, size_t size) {
+    *this = PngScanlines();
+    data = bytes;
+    length = size;
+    if (data == nullptr || length < sizeof(Signature) + 25 || std::memcmp(data, Signature, sizeof(Signature)) != 0)
+        return false;
+
+    // IHDR comes first and is always 13 bytes
+    const unsigned char* header = data + sizeof(Signature);
+    if (BigEndian32(header) != 13 || std::memcmp(header + 4, "IHDR", 4) != 0)
+        return false;
+    uint32_t headerWidth = BigEndian32(header + 8), headerHeight = BigEndian32(header + 12);
+    depth = header[16];
+    colourType = header[17];
+    if (headerWidth == 0 || headerHeight == 0 || headerWidth > MaxSide || headerHeight > MaxSide ||
+        header[18] != 0 || header[19] != 0 || header[20] != 0)
+        return false;
+    width = int(headerWidth);
+    height = int(headerHeight);
+
+    switch (colourType) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: return false;
+    }
+    bool depthAllowed = depth == 8 || (depth == 16 && colourType != 3) || ((depth == 1 || depth == 2 || depth == 4) && (colourType == 0 || colourType == 3));
+    if (!depthAllowed)
+        return false;
+    size_t bitsPerPixel = size_t(channels) * depth;
+    rowBytes = (size_t(width) * bitsPerPixel + 7) / 8;
+    filterStride = std::max<size_t>(1, bitsPerPixel / 8);
+
+    // On to the first IDAT, picking up the palette on the way
+    bool hasPalette = false;
+    size_t chunk = sizeof(Signature) + 25;
+    while (true) {
+        if (length - chunk < 12)
+            return false;
+        size_t chunkLength = BigEndian32(data + chunk);
+        const unsigned char* type = data + chunk + 4;
+        if (chunkLength > length - chunk - 12)
+            return false;
+
+        if (std::memcmp(type, "IDAT", 4) == 0) {
+            position = chunk + 8;
+            chunkLeft = chunkLength;
+            break;
+        }
+        if (std::memcmp(type, "IEND", 4) == 0)
+            return false;
+        if (std::memcmp(type, "PLTE", 4) == 0) {
+            if (chunkLength % 3 != 0 || chunkLength > sizeof(palette))
+                return false;
+            std::memcpy(palette, data + chunk + 8, chunkLength);
+            hasPalette = true;
+        }
+        chunk += 12 + chunkLength;
+    }
+    if (colourType == 3 && !hasPalette)
+        return false;
+
+    // zlib header: deflate with a window of at most 32KB and no preset dictionary
+    uint32_t method = Bits(8), flags = Bits(8);
+    if (damaged || (method & 15) != 8 || (method >> 4) > 7 || (method << 8 | flags) % 31 != 0 || (flags & 0x20) != 0)
+        return false;
+
+    // Room for the window and a whole row on top, so taking a row never waits on bytes that were overwritten
+    size_t windowSize = 1;
+    while (windowSize < WindowBytes + rowBytes + 1 + LongestMatch)
+        windowSize <<= 1;
+    window.resize(windowSize);
+    windowMask = windowSize - 1;
+
+    row.resize(rowBytes);
+    previous.assign(rowBytes, 0);
+    rowsLeft = height;
+    return true;
+}
+
+bool PngScanlines::NextByte(uint8_t& byte) {
+    // The zlib stream runs on from one IDAT chunk into the next, past each one's CRC
+    while (chunkLeft == 0) {
+        size_t next = position + 4;
+        if (next > length || length - next < 12 || std::memcmp(data + next + 4, "IDAT", 4) != 0)
+            return false;
+        size_t chunkLength = BigEndian32(data + next);
+        if (chunkLength > length - next - 12)
+            return false;
+        position = next + 8;
+        chunkLeft = chunkLength;
+    }
+
+    byte = data[position++];
+    chunkLeft--;
+    return true;
+}
+
+void PngScanlines::Fill(int count) {
+    uint8_t byte;
+    while (bitCount < count && NextByte(byte)) {
+        bitBuffer |= uint64_t(byte) << bitCount;
+        bitCount += 8;
+    }
+}
+
+uint32_t PngScanlines::Bits(int count) {
+    Fill(count);
+    if (bitCount < count) {
+        damaged = true;
+        return 0;
+    }
+
+    uint32_t value = uint32_t(bitBuffer & ((uint64_t(1) << count) - 1));
+    bitBuffer >>= count;
+    bitCount -= count;
+    return value;
+}
+
+bool PngScanlines::Build(Huffman& table, const uint8_t* lengths, int count) {
+    int counts[16] = {};
+    for (int i = 0; i < count; i++)
+        counts[lengths[i]]++;
+    counts[0] = 0;
+
+    // More codes of a length than there's room for can't be decoded, too few is allowed
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - counts[len];
+        if (left < 0)
+            return false;
+    }
+
+    int next[16] = {};
+    int code = 0, symbol = 0;
+    table.firstCode[0] = table.firstSymbol[0] = table.count[0] = 0;
+    for (int len = 1; len < 16; len++) {
+        table.firstCode[len] = next[len] = code;
+        table.firstSymbol[len] = symbol;
+        table.count[len] = counts[len];
+        code = (code + counts[len]) << 1;
+        symbol += counts[len];
+    }
+
+    std::memset(table.fast, 0, sizeof(table.fast));
+    int offsets[16];
+    std::memcpy(offsets, table.firstSymbol, sizeof(offsets));
+    for (int i = 0; i < count; i++) {
+        int len = lengths[i];
+        if (len == 0)
+            continue;
+        table.symbols[offsets[len]++] = uint16_t(i);
+
+        int assigned = next[len]++;
+        if (len > FastBits)
+            continue;
+        for (int bits = ReverseBits(assigned, len); bits < 1 << FastBits; bits += 1 << len)
+            table.fast[bits] = uint16_t(i | len << 9);
+    }
+    return true;
+}
+
+int PngScanlines::DecodeSymbol(const Huffman& table) {
+    Fill(16);
+    uint16_t entry = table.fast[bitBuffer & ((1 << FastBits) - 1)];
+    if (entry != 0) {
+        int len = entry >> 9;
+        if (len > bitCount)
+            return -1;
+        bitBuffer >>= len;
+        bitCount -= len;
+        return entry & 511;
+    }
+
+    // Longer codes, a bit at a time in the order the code was assigned
+    int code = 0;
+    for (int len = 1; len < 16 && len <= bitCount; len++) {
+        code = code << 1 | int(bitBuffer >> (len - 1) & 1);
+        int offset = code - table.firstCode[len];
+        if (offset >= 0 && offset < table.count[len]) {
+            bitBuffer >>= len;
+            bitCount -= len;
+            return table.symbols[table.firstSymbol[len] + offset];
+        }
+    }
+    return -1;
+}
+
+bool PngScanlines::StartBlock() {
+    if (finalBlock)
+        return false;
+
+    finalBlock = Bits(1) != 0;
+    uint32_t type = Bits(2);
+    stored = type == 0;
+    if (stored) {
+        // Stored blocks start on a byte boundary
+        Bits(bitCount % 8);
+        uint32_t len = Bits(16), check = Bits(16);
+        if ((len ^ 0xFFFF) != check)
+            return false;
+        storedLeft = len;
+    }
+    else if (type == 1) {
+        uint8_t lengths[288 + 32];
+        std::fill(lengths, lengths + 144, uint8_t(8));
+        std::fill(lengths + 144, lengths + 256, uint8_t(9));
+        std::fill(lengths + 256, lengths + 280, uint8_t(7));
+        std::fill(lengths + 280, lengths + 288, uint8_t(8));
+        std::fill(lengths + 288, lengths + 320, uint8_t(5));
+        if (!Build(literals, lengths, 288) || !Build(distances, lengths + 288, 32))
+            return false;
+    }
+    else if (type != 2 || !ReadDynamicTables()) {
+        return false;
+    }
+
+    inBlock = true;
+    return !damaged;
+}
+
+bool PngScanlines::ReadDynamicTables() {
+    int literalCount = int(Bits(5)) + 257;
+    int distanceCount = int(Bits(5)) + 1;
+    int codeLengthCount = int(Bits(4)) + 4;
+
+    uint8_t codeLengths[19] = {};
+    for (int i = 0; i < codeLengthCount; i++)
+        codeLengths[CodeLengthOrder[i]] = uint8_t(Bits(3));
+    Huffman codeLengthCode;
+    if (damaged || !Build(codeLengthCode, codeLengths, 19))
+        return false;
+
+    // Literal and distance lengths are sent as one run, repeats can cross from one to the other
+    uint8_t lengths[286 + 32] = {};
+    int total = literalCount + distanceCount;
+    for (int i = 0; i < total;) {
+        int symbol = DecodeSymbol(codeLengthCode);
+        if (symbol < 0)
+            return false;
+        if (symbol < 16) {
+            lengths[i++] = uint8_t(symbol);
+            continue;
+        }
+
+        int repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (i == 0)
+                return false;
+            value = lengths[i - 1];
+            repeat = 3 + int(Bits(2));
+        }
+        else if (symbol == 17) {
+            repeat = 3 + int(Bits(3));
+        }
+        else {
+            repeat = 11 + int(Bits(7));
+        }
+        if (repeat > total - i)
+            return false;
+        std::fill(lengths + i, lengths + i + repeat, value);
+        i += repeat;
+    }
+
+    return !damaged && literalCount <= 286 && Build(literals, lengths, literalCount) && Build(distances, lengths + literalCount, distanceCount);
+}
+
+bool PngScanlines::Inflate(size_t count) {
+    while (produced - consumed < count) {
+        if (!inBlock && !StartBlock())
+            return false;
+
+        if (stored) {
+            for (; storedLeft > 0 && produced - consumed < count; storedLeft--)
+                window[produced++ & windowMask] = uint8_t(Bits(8));
+            inBlock = storedLeft > 0;
+        }
+        else {
+            int symbol = DecodeSymbol(literals);
+            if (symbol < 0)
+                return false;
+            if (symbol < 256) {
+                window[produced++ & windowMask] = uint8_t(symbol);
+            }
+            else if (symbol == 256) {
+                inBlock = false;
+            }
+            else {
+                if (symbol > 285)
+                    return false;
+                size_t matchLength = LengthBase[symbol - 257] + Bits(LengthExtra[symbol - 257]);
+                int code = DecodeSymbol(distances);
+                if (code < 0 || code > 29)
+                    return false;
+                size_t distance = DistanceBase[code] + Bits(DistanceExtra[code]);
+                if (distance > produced)
+                    return false;
+                for (size_t i = 0; i < matchLength; i++, produced++)
+                    window[produced & windowMask] = window[(produced - distance) & windowMask];
+            }
+        }
+        if (damaged)
+            return false;
+    }
+    return true;
+}
+
+bool PngScanlines::Unfilter(int filter) {
+    uint8_t* current = row.data();
+    const uint8_t* up = previous.data();
+    size_t stride = filterStride;
+
+    switch (filter) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = stride; i < rowBytes; i++)
+            current[i] = uint8_t(current[i] + current[i - stride]);
+        break;
+    case 2:
+        for (size_t i = 0; i < rowBytes; i++)
+            current[i] = uint8_t(current[i] + up[i]);
+        break;
+    case 3:
+        for (size_t i = 0; i < rowBytes; i++) {
+            int left = i >= stride ? current[i - stride] : 0;
+            current[i] = uint8_t(current[i] + ((left + up[i]) >> 1));
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < rowBytes; i++) {
+            int left = i >= stride ? current[i - stride] : 0;
+            int upLeft = i >= stride ? up[i - stride] : 0;
+            current[i] = uint8_t(current[i] + Paeth(left, up[i], upLeft));
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+void PngScanlines::ConvertRow(unsigned char* rgb) const {
+    const uint8_t* bytes = row.data();
+    if (depth == 8 && colourType == 2) {
+        std::memcpy(rgb, bytes, size_t(width) * 3);
+        return;
+    }
+
+    // The index'th sample of the row as 8 bits, palette indices left as they are
+    auto sample = [&](size_t index) -> uint8_t {
+        if (depth == 8)
+            return bytes[index];
+        if (depth == 16)
+            return bytes[index * 2];
+        size_t bit = index * depth;
+        int mask = (1 << depth) - 1;
+        int value = bytes[bit / 8] >> (8 - depth - bit % 8) & mask;
+        return uint8_t(colourType == 3 ? value : value * (255 / mask));
+    };
+
+    for (size_t x = 0; x < size_t(width); x++, rgb += 3) {
+        switch (colourType) {
+        case 0:
+        case 4:
+            rgb[0] = rgb[1] = rgb[2] = sample(x * channels);
+            break;
+        case 3:
+            std::memcpy(rgb, palette[sample(x)], 3);
+            break;
+        default:
+            rgb[0] = sample(x * channels);
+            rgb[1] = sample(x * channels + 1);
+            rgb[2] = sample(x * channels + 2);
+            break;
+        }
+    }
+}
+
+bool PngScanlines::ReadRows(unsigned char* rgb, int count) {
+    if (count < 0 || count > rowsLeft)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        if (!Inflate(rowBytes + 1))
+            return false;
+
+        // A filter type byte, then the row
+        int filter = window[consumed++ & windowMask];
+        size_t start = size_t(consumed & windowMask);
+        size_t first = std::min(rowBytes, window.size() - start);
+        std::memcpy(row.data(), window.data() + start, first);
+        std::memcpy(row.data() + first, window.data(), rowBytes - first);
+        consumed += rowBytes;
+        if (!Unfilter(filter))
+            return false;
+
+        ConvertRow(rgb + size_t(i) * width * 3);
+        row.swap(previous);
+        rowsLeft--;
+    }
+    return true;
+}
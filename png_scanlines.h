@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Non-interlaced PNG decoded one row at a time
+//
+// stb inflates the whole image before unfiltering it, and won't open one over 1GB decoded. This
+// inflates the IDAT data only as far as the next row, holding the 32KB deflate window, the row
+// being unfiltered and the one above it. Every bit depth and colour type is read; as when stb is
+// asked for RGB, alpha is dropped and 16 bit samples keep their high byte. Interlaced files, whose
+// passes each cover the whole image, and images over 262144 pixels a side are left to stb.
+class PngScanlines {
+public:
+    // Parse the chunks up to the first IDAT, data has to outlive the decoder
+    bool Open(const unsigned char* data, size_t length);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // Decode the next count rows as packed RGB, false if the data is damaged or runs out of rows
+    bool ReadRows(unsigned char* rgb, int count);
+
+private:
+    static constexpr int FastBits = 10;
+
+    // Deflate's canonical Huffman codes, which arrive least significant bit first
+    struct Huffman {
+        // Codes of up to FastBits bits looked up straight from the next bits: symbol | length << 9, 0 if longer
+        uint16_t fast[1 << FastBits];
+        // Codes read most significant bit first: first code and count of each length
+        int firstCode[16];
+        int count[16];
+        int firstSymbol[16];
+        uint16_t symbols[288];
+    };
+
+    bool NextByte(uint8_t& byte);
+    void Fill(int count);
+    uint32_t Bits(int count);
+    bool Build(Huffman& table, const uint8_t* lengths, int count);
+    int DecodeSymbol(const Huffman& table);
+    bool StartBlock();
+    bool ReadDynamicTables();
+    // Inflate until count bytes are waiting to be taken
+    bool Inflate(size_t count);
+    bool Unfilter(int filter);
+    void ConvertRow(unsigned char* rgb) const;
+
+    const unsigned char* data = nullptr;
+    size_t length = 0;
+    // Where the zlib stream continues in the current IDAT chunk, and how much of the chunk is left
+    size_t position = 0;
+    size_t chunkLeft = 0;
+
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    int colourType = 0;
+    int channels = 0;
+    size_t rowBytes = 0;
+    // Distance back to the same byte of the pixel to the left, at least 1 for bit depths under 8
+    size_t filterStride = 0;
+    uint8_t palette[256][3] = {};
+
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+    // Set when the bits ran out or made no sense
+    bool damaged = false;
+
+    bool inBlock = false;
+    bool finalBlock = false;
+    bool stored = false;
+    size_t storedLeft = 0;
+    Huffman literals, distances;
+
+    // Inflated bytes: the last 32KB for matches to copy from, and those not yet taken as rows
+    std::vector<uint8_t> window;
+    size_t windowMask = 0;
+    uint64_t produced = 0;
+    uint64_t consumed = 0;
+
+    std::vector<uint8_t> row, previous;
+    int rowsLeft = 0;
+};
@@ -0,0 +1,35 @@
+#include "process_time.h"
+
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+
+double ProcessCpuSeconds() {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+        return 0;
+
+    // FILETIMEs count 100ns intervals
+    auto seconds = [](const FILETIME& time) { return (uint64_t(time.dwHighDateTime) << 32 | time.dwLowDateTime) / 1e7; };
+    return seconds(kernel) + seconds(user);
+}
+
+#else
+
+double ProcessCpuSeconds() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+#endif
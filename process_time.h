@@ -0,0 +1,5 @@
+#pragma once
+
+// CPU time every thread of this process has used so far, user and kernel, in seconds
+// Wall clock time can't tell an idle viewer from a spinning one, this can
+double ProcessCpuSeconds();
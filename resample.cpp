@@ -0,0 +1,146 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// acc[i] += row[i] over a whole row of channel bytes
+void AccumulateRow(uint32_t* acc, const unsigned char* row, size_t length) {
+    size_t i = 0;
+
+#ifdef RESAMPLE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+
+        __m128i* sums = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(sums + 0, _mm_add_epi32(_mm_loadu_si128(sums + 0), _mm_unpacklo_epi16(low, zero)));
+        _mm_storeu_si128(sums + 1, _mm_add_epi32(_mm_loadu_si128(sums + 1), _mm_unpackhi_epi16(low, zero)));
+        _mm_storeu_si128(sums + 2, _mm_add_epi32(_mm_loadu_si128(sums + 2), _mm_unpacklo_epi16(high, zero)));
+        _mm_storeu_si128(sums + 3, _mm_add_epi32(_mm_loadu_si128(sums + 3), _mm_unpackhi_epi16(high, zero)));
+    }
+#endif
+
+    for (; i < length; i++)
+        acc[i] += row[i];
+}
+
+// Average acc pixels [x0, x1) and scale by the number of rows summed into them
+void StorePixel(const uint32_t* acc, int x0, int x1, float rowScale, unsigned char* out) {
+    float scale = rowScale / float(x1 - x0);
+
+#ifdef RESAMPLE_SSE2
+    __m128i sum = _mm_setzero_si128();
+    for (int x = x0; x < x1; x++)
+        sum = _mm_add_epi32(sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + size_t(x) * 4)));
+
+    __m128 mean = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(scale)), _mm_set1_ps(0.5f));
+    __m128i packed = _mm_cvttps_epi32(mean);
+    packed = _mm_packs_epi32(packed, packed);
+    packed = _mm_packus_epi16(packed, packed);
+
+    uint32_t pixel = uint32_t(_mm_cvtsi128_si32(packed));
+    std::memcpy(out, &pixel, sizeof(pixel));
+#else
+    uint32_t sum[4] = {};
+    for (int x = x0; x < x1; x++) {
+        for (int c = 0; c < 4; c++)
+            sum[c] += acc[size_t(x) * 4 + c];
+    }
+
+    for (int c = 0; c < 4; c++)
+        out[c] = (unsigned char)std::min(255.f, sum[c] * scale + 0.5f);
+#endif
+}
+
+}
+
+void FitWithin(int width, int height, int maxWidth, int maxHeight, int& fitWidth, int& fitHeight) {
+    double scale = std::min(1.0, std::min(maxWidth / double(width), maxHeight / double(height)));
+    fitWidth = std::max(1, int(std::lround(width * scale)));
+    fitHeight = std::max(1, int(std::lround(height * scale)));
+}
+
+void AreaAverageRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight) {
+    size_t rowLength = size_t(srcWidth) * 4;
+    std::vector<uint32_t> acc(rowLength);
+
+    // Source columns covered by each output column
+    std::vector<int> columns(size_t(dstWidth) + 1);
+    for (int x = 0; x <= dstWidth; x++)
+        columns[x] = int(int64_t(x) * srcWidth / dstWidth);
+
+    for (int y = 0; y < dstHeight; y++) {
+        int y0 = int(int64_t(y) * srcHeight / dstHeight);
+        int y1 = std::max(y0 + 1, int(int64_t(y + 1) * srcHeight / dstHeight));
+
+        // Sum the band of source rows first, each source byte is read exactly once
+        std::fill(acc.begin(), acc.end(), 0);
+        for (int sy = y0; sy < y1; sy++)
+            AccumulateRow(acc.data(), src + size_t(sy) * rowLength, rowLength);
+
+        float rowScale = 1.f / float(y1 - y0);
+        unsigned char* out = dst + size_t(y) * dstWidth * 4;
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = std::min(columns[x], srcWidth - 1);
+            int x1 = std::max(x0 + 1, columns[x + 1]);
+            StorePixel(acc.data(), x0, x1, rowScale, out + size_t(x) * 4);
+        }
+    }
+}
+
+void BilinearRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight) {
+    // Per column source positions and 8 bit weights, shared by every row
+    std::vector<int> left(dstWidth), right(dstWidth), columnWeight(dstWidth);
+    for (int x = 0; x < dstWidth; x++) {
+        float fx = std::max(0.f, (x + 0.5f) * srcWidth / dstWidth - 0.5f);
+        left[x] = std::min(int(fx), srcWidth - 1);
+        right[x] = std::min(left[x] + 1, srcWidth - 1);
+        columnWeight[x] = int((fx - left[x]) * 256);
+    }
+
+    for (int y = 0; y < dstHeight; y++) {
+        float fy = std::max(0.f, (y + 0.5f) * srcHeight / dstHeight - 0.5f);
+        int top = std::min(int(fy), srcHeight - 1);
+        int bottom = std::min(top + 1, srcHeight - 1);
+        int wy = int((fy - top) * 256);
+
+        const unsigned char* topRow = src + size_t(top) * srcWidth * 4;
+        const unsigned char* bottomRow = src + size_t(bottom) * srcWidth * 4;
+        unsigned char* out = dst + size_t(y) * dstWidth * 4;
+
+        for (int x = 0; x < dstWidth; x++) {
+            const unsigned char* a = topRow + size_t(left[x]) * 4;
+            const unsigned char* b = topRow + size_t(right[x]) * 4;
+            const unsigned char* c = bottomRow + size_t(left[x]) * 4;
+            const unsigned char* d = bottomRow + size_t(right[x]) * 4;
+            int wx = columnWeight[x];
+
+            for (int ch = 0; ch < 4; ch++) {
+                int upper = a[ch] * (256 - wx) + b[ch] * wx;
+                int lower = c[ch] * (256 - wx) + d[ch] * wx;
+                out[size_t(x) * 4 + ch] = (unsigned char)((upper * (256 - wy) + lower * wy + 32768) >> 16);
+            }
+        }
+    }
+}
+
+void ResampleRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight) {
+    if (srcWidth == dstWidth && srcHeight == dstHeight)
+        std::memcpy(dst, src, size_t(srcWidth) * srcHeight * 4);
+    else if (dstWidth * 2 <= srcWidth && dstHeight * 2 <= srcHeight)
+        AreaAverageRgba(src, srcWidth, srcHeight, dst, dstWidth, dstHeight);
+    else
+        BilinearRgba(src, srcWidth, srcHeight, dst, dstWidth, dstHeight);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Resizing of packed 8 bit RGBA pixels, used to shrink decoded images to the window before upload
+
+// Largest size with the same aspect ratio that fits in maxWidth x maxHeight, never enlarging
+void FitWithin(int width, int height, int maxWidth, int maxHeight, int& fitWidth, int& fitHeight);
+
+// Mean of the source rectangle under each output pixel, for large reductions
+// Uses SSE2 when the target has it
+void AreaAverageRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight);
+
+// Bilinear interpolation, for reductions under 2x and enlargements
+void BilinearRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight);
+
+// Pick the filter for the scale factor and resize
+void ResampleRgba(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight);
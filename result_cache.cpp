@@ -0,0 +1,370 @@
+#include "result_cache.h"
+#include "content_hash.h"
+#include "sort_keys.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char CacheMagic[4] = { 'I', 'V', 'R', 'C' };
+constexpr uint32_t CacheVersion = 2;
+constexpr size_t FileHeaderSize = 8;
+
+struct RecordHeader {
+    uint32_t checksum;
+    uint32_t pathLength;
+    uint64_t fileSize;
+    int64_t modifiedTime;
+    uint64_t contentHash;
+    uint8_t r, g, b;
+    uint8_t format;
+    // Once HSL, which every key now works out from the average colour. Written as zeros.
+    uint8_t reserved[12];
+};
+static_assert(sizeof(RecordHeader) == 48, "cache record header must stay packed");
+
+// One entry of an on disk index: the path or content hash and where its record starts
+struct IndexEntry {
+    uint64_t hash;
+    uint64_t offset;
+};
+static_assert(sizeof(IndexEntry) == 16, "index entries are written to disk as they are");
+
+constexpr const char* PathIndexFile = "cache_paths.idx";
+constexpr const char* ContentIndexFile = "cache_content.idx";
+// Each index is built from up to this many buckets, one open file each
+constexpr int MaxBucketBits = 8;
+
+// FNV-1a over everything after the checksum field
+uint32_t Checksum(const unsigned char* record, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = sizeof(uint32_t); i < length; i++) {
+        hash ^= record[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool HasFileHeader(const unsigned char* data, size_t size) {
+    uint32_t version = 0;
+    if (size < FileHeaderSize || std::memcmp(data, CacheMagic, sizeof(CacheMagic)) != 0)
+        return false;
+    std::memcpy(&version, data + sizeof(CacheMagic), sizeof(version));
+    return version == CacheVersion;
+}
+
+// Call visit(offset, header) for each record up to the first torn or damaged one
+// Returns the offset just past the last good record
+template <typename Visit>
+size_t WalkRecords(const unsigned char* data, size_t size, Visit visit) {
+    size_t offset = FileHeaderSize;
+    while (offset + sizeof(RecordHeader) <= size) {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+
+        size_t length = sizeof(RecordHeader) + header.pathLength;
+        if (offset + length > size || Checksum(data + offset, length) != header.checksum)
+            break;
+
+        visit(offset, header);
+        offset += length;
+    }
+    return offset;
+}
+
+std::string Join(const std::string& folder, const std::string& name) {
+    return (fs::u8path(folder) / fs::u8path(name)).u8string();
+}
+
+IndexEntry EntryAt(const MappedFile& file, uint64_t i) {
+    IndexEntry entry;
+    std::memcpy(&entry, file.Data() + i * sizeof(IndexEntry), sizeof(entry));
+    return entry;
+}
+
+// Position of the first entry with hash in a sorted index, or of where it would be
+uint64_t FirstEntry(const MappedFile& file, uint64_t hash) {
+    uint64_t low = 0, high = file.Size() / sizeof(IndexEntry);
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (EntryAt(file, middle).hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void WriteFileHeader(std::ofstream& out) {
+    out.write(CacheMagic, sizeof(CacheMagic));
+    out.write(reinterpret_cast<const char*>(&CacheVersion), sizeof(CacheVersion));
+}
+
+// Copy the stored results of a record into img
+void FillResults(const RecordHeader& header, Image& img) {
+    img.format = ImageFormat(header.format);
+    img.averageRgb.r = header.r;
+    img.averageRgb.g = header.g;
+    img.averageRgb.b = header.b;
+    // HSL isn't stored, it comes from the colour like every other key
+    RgbToHsl(img.averageRgb, img.hsl);
+}
+
+}
+
+bool ResultCache::Load(const std::string& cacheFile, const std::string& indexFolder, size_t memoryBytes) {
+    fileName = cacheFile;
+    onDisk = !indexFolder.empty();
+
+    bool fresh = !fs::exists(fs::u8path(fileName));
+    if (!fresh) {
+        if (!mapping.Open(fileName))
+            return false;
+
+        if (!onDisk) {
+            // Drop torn tails and superseded records before we start appending again
+            if (!Scan() || validEnd < mapping.Size() || recordCount > 2 * index.size() + 1024)
+                Rewrite();
+        }
+        else if (!HasFileHeader(mapping.Data(), mapping.Size())) {
+            mapping.Close();
+            fresh = true;
+        }
+        else {
+            if (!BuildDiskIndexes(indexFolder, memoryBytes))
+                return false;
+            // Cut off a torn tail, the indexes hold offsets so they stay good
+            if (validEnd < mapping.Size()) {
+                mapping.Close();
+                std::error_code error;
+                fs::resize_file(fs::u8path(fileName), validEnd, error);
+                if (error || !mapping.Open(fileName))
+                    return false;
+            }
+        }
+    }
+    if (fresh) {
+        std::ofstream out(fs::u8path(fileName), std::ios::binary | std::ios::trunc);
+        WriteFileHeader(out);
+    }
+
+    appendStream.open(fs::u8path(fileName), std::ios::binary | std::ios::app);
+    return bool(appendStream);
+}
+
+// Walk the mapped records and index the newest one for each path
+bool ResultCache::Scan() {
+    index.clear();
+    contentIndex.clear();
+    recordCount = 0;
+    validEnd = 0;
+
+    const unsigned char* data = mapping.Data();
+    if (!HasFileHeader(data, mapping.Size()))
+        return false;
+
+    validEnd = WalkRecords(data, mapping.Size(), [&](size_t offset, const RecordHeader& header) {
+        std::string_view path(reinterpret_cast<const char*>(data + offset + sizeof(RecordHeader)), header.pathLength);
+        index[path] = data + offset;
+        if (header.contentHash != 0)
+            contentIndex[header.contentHash] = data + offset;
+        recordCount++;
+    });
+    return true;
+}
+
+// Write the path and content indexes sorted by hash, newest record first among equal hashes.
+// One walk of the records splits the entries into buckets by the top bits of their hash, small
+// enough to sort in memoryBytes, then the buckets are sorted and appended in turn.
+bool ResultCache::BuildDiskIndexes(const std::string& folder, size_t memoryBytes) {
+    std::error_code error;
+    fs::create_directories(fs::u8path(folder), error);
+    const unsigned char* data = mapping.Data();
+
+    // At most one record per header's worth of file, so this many entries at most
+    uint64_t most = mapping.Size() / sizeof(RecordHeader);
+    int bits = 0;
+    while (bits < MaxBucketBits && (most * sizeof(IndexEntry) >> bits) > memoryBytes)
+        bits++;
+    size_t bucketCount = size_t(1) << bits;
+    auto bucketOf = [&](uint64_t hash) { return bits == 0 ? size_t(0) : size_t(hash >> (64 - bits)); };
+
+    for (const char* name : { PathIndexFile, ContentIndexFile }) {
+        bool paths = name == PathIndexFile;
+        std::string target = Join(folder, name);
+        auto bucketFile = [&](size_t bucket) { return target + "." + std::to_string(bucket); };
+
+        std::vector<std::ofstream> buckets(bucketCount);
+        for (size_t b = 0; b < bucketCount; b++)
+            buckets[b].open(fs::u8path(bucketFile(b)), std::ios::binary | std::ios::trunc);
+
+        recordCount = 0;
+        validEnd = WalkRecords(data, mapping.Size(), [&](size_t offset, const RecordHeader& header) {
+            recordCount++;
+            IndexEntry entry = { header.contentHash, offset };
+            if (paths)
+                entry.hash = HashBytes(data + offset + sizeof(RecordHeader), header.pathLength);
+            else if (entry.hash == 0)
+                return;
+            buckets[bucketOf(entry.hash)].write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        });
+
+        bool written = true;
+        for (auto& bucket : buckets) {
+            bucket.close();
+            written = written && !bucket.fail();
+        }
+
+        fs::path temp = fs::u8path(target + ".tmp");
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            std::vector<IndexEntry> entries;
+            for (size_t b = 0; b < bucketCount && written; b++) {
+                fs::path file = fs::u8path(bucketFile(b));
+                entries.resize(size_t(fs::file_size(file, error)) / sizeof(IndexEntry));
+                std::ifstream in(file, std::ios::binary);
+                in.read(reinterpret_cast<char*>(entries.data()), std::streamsize(entries.size() * sizeof(IndexEntry)));
+                std::sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+                    return a.hash != b.hash ? a.hash < b.hash : a.offset > b.offset;
+                });
+                out.write(reinterpret_cast<const char*>(entries.data()), std::streamsize(entries.size() * sizeof(IndexEntry)));
+                written = bool(in) && bool(out);
+            }
+            written = written && out.flush();
+        }
+        for (size_t b = 0; b < bucketCount; b++)
+            fs::remove(fs::u8path(bucketFile(b)), error);
+
+        MappedFile& index = paths ? pathIndexFile : contentIndexFile;
+        index.Close();
+        fs::rename(temp, fs::u8path(target), error);
+        if (!written || error || !index.Open(target))
+            return false;
+    }
+    return true;
+}
+
+// Write the live records to a fresh file and swap it in
+void ResultCache::Rewrite() {
+    std::vector<char> live;
+    for (auto& entry : index) {
+        RecordHeader header;
+        std::memcpy(&header, entry.second, sizeof(header));
+
+        const char* record = reinterpret_cast<const char*>(entry.second);
+        live.insert(live.end(), record, record + sizeof(RecordHeader) + header.pathLength);
+    }
+
+    index.clear();
+    contentIndex.clear();
+    mapping.Close();
+
+    fs::path target = fs::u8path(fileName);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        WriteFileHeader(out);
+        out.write(live.data(), std::streamsize(live.size()));
+    }
+
+    std::error_code error;
+    fs::rename(temp, target, error);
+    if (!error && mapping.Open(fileName))
+        Scan();
+}
+
+const unsigned char* ResultCache::FindPath(std::string_view path) const {
+    if (!onDisk) {
+        auto it = index.find(path);
+        return it == index.end() ? nullptr : it->second;
+    }
+
+    // Paths whose hashes collide are told apart by the path stored in the record
+    uint64_t hash = HashBytes(path.data(), path.size());
+    uint64_t count = pathIndexFile.Size() / sizeof(IndexEntry);
+    for (uint64_t i = FirstEntry(pathIndexFile, hash); i < count; i++) {
+        IndexEntry entry = EntryAt(pathIndexFile, i);
+        if (entry.hash != hash)
+            break;
+
+        const unsigned char* record = mapping.Data() + entry.offset;
+        RecordHeader header;
+        std::memcpy(&header, record, sizeof(header));
+        if (std::string_view(reinterpret_cast<const char*>(record + sizeof(RecordHeader)), header.pathLength) == path)
+            return record;
+    }
+    return nullptr;
+}
+
+const unsigned char* ResultCache::FindContent(uint64_t contentHash) const {
+    if (!onDisk) {
+        auto it = contentIndex.find(contentHash);
+        return it == contentIndex.end() ? nullptr : it->second;
+    }
+
+    uint64_t i = FirstEntry(contentIndexFile, contentHash);
+    if (i == contentIndexFile.Size() / sizeof(IndexEntry) || EntryAt(contentIndexFile, i).hash != contentHash)
+        return nullptr;
+    return mapping.Data() + EntryAt(contentIndexFile, i).offset;
+}
+
+bool ResultCache::Lookup(Image& img, std::string_view path) const {
+    const unsigned char* record = FindPath(path);
+    if (record == nullptr)
+        return false;
+
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.fileSize != img.fileSize || header.modifiedTime != img.modifiedTime)
+        return false;
+
+    FillResults(header, img);
+    img.contentHash = header.contentHash;
+    img.cached = true;
+    return true;
+}
+
+bool ResultCache::LookupContent(Image& img, std::string& original) const {
+    const unsigned char* record = FindContent(img.contentHash);
+    if (record == nullptr)
+        return false;
+
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.fileSize != img.fileSize)
+        return false;
+
+    FillResults(header, img);
+    original.assign(reinterpret_cast<const char*>(record + sizeof(RecordHeader)), header.pathLength);
+    return true;
+}
+
+void ResultCache::Append(const Image& img, std::string_view path) {
+    RecordHeader header = {};
+    header.pathLength = uint32_t(path.size());
+    header.fileSize = img.fileSize;
+    header.modifiedTime = img.modifiedTime;
+    header.contentHash = img.contentHash;
+    header.r = uint8_t(img.averageRgb.r);
+    header.g = uint8_t(img.averageRgb.g);
+    header.b = uint8_t(img.averageRgb.b);
+    header.format = uint8_t(img.format);
+
+    // Build the whole record first so it reaches the file in one write
+    std::vector<unsigned char> record(sizeof(RecordHeader));
+    record.insert(record.end(), path.begin(), path.end());
+    std::memcpy(record.data(), &header, sizeof(header));
+
+    header.checksum = Checksum(record.data(), record.size());
+    std::memcpy(record.data(), &header.checksum, sizeof(header.checksum));
+
+    std::lock_guard<std::mutex> guard(appendMutex);
+    appendStream.write(reinterpret_cast<const char*>(record.data()), std::streamsize(record.size()));
+    appendStream.flush();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "image.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Persistent cache of per-image results keyed by path, size and modification time
+//
+// The file is an 8 byte header followed by an append-only log of records, each a
+// fixed 48 byte header (checksum, path length, size, mtime, content hash, average
+// RGB, format, 12 reserved bytes) and the path bytes. It is memory-mapped on Load and indexed in place. A record torn by a
+// crash fails its checksum and is cut off the next time the cache is loaded.
+//
+// The indexes are hash maps by default. For more images than fit in memory they can instead be
+// written to two files of (hash, record offset) entries sorted by hash, searched through a
+// mapping, so the cache holds nothing per record.
+class ResultCache {
+public:
+    // Map the cache file (creating it if needed) and open it for appending
+    // Given an index folder the indexes are built there within memoryBytes, rather than in memory.
+    // Records appended after Load aren't in them, and superseded records are only dropped by a
+    // load that indexes in memory.
+    bool Load(const std::string& fileName, const std::string& indexFolder = std::string(), size_t memoryBytes = 0);
+
+    // Fill averageRgb, hsl and format for the file at path if size and mtime still match
+    bool Lookup(Image& img, std::string_view path) const;
+
+    // Fill the results from any record with the same content hash and size as img
+    // original receives the path that record was stored under
+    bool LookupContent(Image& img, std::string& original) const;
+
+    // Append the results for the image at path, safe to call from any thread
+    void Append(const Image& img, std::string_view path);
+
+    size_t Size() const { return onDisk ? recordCount : index.size(); }
+
+private:
+    bool Scan();
+    void Rewrite();
+    bool BuildDiskIndexes(const std::string& folder, size_t memoryBytes);
+    // The newest record for a path or content hash, from whichever indexes Load built
+    const unsigned char* FindPath(std::string_view path) const;
+    const unsigned char* FindContent(uint64_t contentHash) const;
+
+    std::string fileName;
+    MappedFile mapping;
+    // Path -> record, both pointing into the mapping
+    std::unordered_map<std::string_view, const unsigned char*> index;
+    // Content hash -> record
+    std::unordered_map<uint64_t, const unsigned char*> contentIndex;
+    // The same two on disk
+    bool onDisk = false;
+    MappedFile pathIndexFile;
+    MappedFile contentIndexFile;
+    size_t validEnd = 0;
+    size_t recordCount = 0;
+
+    std::mutex appendMutex;
+    std::ofstream appendStream;
+};
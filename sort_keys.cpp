@@ -0,0 +1,276 @@
+#include "sort_keys.h"
+#include "colour_space.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+
+namespace {
+
+constexpr const char* KeyNames[SortKeyCount] = {
+    "hue", "saturation", "lightness", "value", "hsv-saturation", "hue-bands",
+    "oklab-l", "oklab-a", "oklab-b", "oklab-chroma", "oklab-hue",
+    "lab-l", "lab-a", "lab-b", "lab-chroma", "lab-hue",
+};
+
+constexpr int HueBandCount = 12;
+constexpr int BandBits = 4;
+
+// 11 bit digits, three passes cover a 32 bit value and a histogram still fits in L1
+constexpr int DigitBits = 11;
+constexpr int Passes = 3;
+constexpr int Buckets = 1 << DigitBits;
+constexpr uint32_t DigitMask = Buckets - 1;
+// Fewest items worth handing a thread, below this starting it costs more than it saves
+constexpr size_t ParallelSlice = 1 << 16;
+
+using Histograms = std::array<std::array<size_t, Buckets>, Passes>;
+
+// Run body(t) for t from 0 to threads - 1, body(0) on the calling thread
+template <typename F>
+void ParallelFor(unsigned threads, F body) {
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++)
+        workers.emplace_back(body, t);
+    body(0);
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// Colours converted at a time for the perceptual keys
+constexpr size_t ConvertBlock = 4096;
+
+// 0 to 1 over the whole 32 bit range, anything unset (-1) sorts first
+uint32_t Quantise(double unit) {
+    unit = std::min(std::max(unit, 0.0), 1.0);
+    // Rounds to nearest like llround for anything in range, without the library call
+    return uint32_t(unit * double(UINT32_MAX) + 0.5);
+}
+
+enum class Component { L, A, B, Chroma, Hue };
+
+// Where a perceptual key's value comes from and the ranges it's scaled over, wide enough for every
+// sRGB colour: Oklab's axes stay within 0.32 and CIELAB's within 110, its chroma within 134
+struct PerceptualKey {
+    ColourSpace space;
+    Component component;
+    float lightness;
+    float axis;
+    float chroma;
+};
+
+bool IsPerceptual(SortKey key) {
+    return key >= SortKey::OklabL && key < SortKey::Count;
+}
+
+PerceptualKey Perceptual(SortKey key) {
+    if (key >= SortKey::LabL)
+        return { ColourSpace::Cielab, Component(int(key) - int(SortKey::LabL)), 100, 128, 150 };
+    return { ColourSpace::Oklab, Component(int(key) - int(SortKey::OklabL)), 1, 0.4f, 0.4f };
+}
+
+// Values of count converted colours, the component picked once for the whole block
+void PerceptualValues(const PerceptualKey& key, const LabColumns& lab, size_t count, uint32_t* values) {
+    switch (key.component) {
+    case Component::L:
+        for (size_t i = 0; i < count; i++)
+            values[i] = Quantise(lab.l[i] / key.lightness);
+        break;
+    case Component::A:
+        for (size_t i = 0; i < count; i++)
+            values[i] = Quantise((lab.a[i] / key.axis + 1) / 2);
+        break;
+    case Component::B:
+        for (size_t i = 0; i < count; i++)
+            values[i] = Quantise((lab.b[i] / key.axis + 1) / 2);
+        break;
+    case Component::Chroma:
+        for (size_t i = 0; i < count; i++)
+            values[i] = Quantise(lab.chroma[i] / key.chroma);
+        break;
+    case Component::Hue: {
+        // Greys in the lower half by lightness, colours in the upper half by angle
+        float achromatic = AchromaticChroma(key.space);
+        for (size_t i = 0; i < count; i++) {
+            if (lab.chroma[i] < achromatic)
+                values[i] = Quantise(lab.l[i] / key.lightness) >> 1;
+            else
+                values[i] = 0x80000000u | Quantise(lab.hue[i] / 360.0) >> 1;
+        }
+        break;
+    }
+    }
+}
+
+// SortValues for one thread's slice
+void SliceValues(const Image* images, size_t count, SortKey key, uint32_t* values) {
+    if (!IsPerceptual(key)) {
+        for (size_t i = 0; i < count; i++)
+            values[i] = SortValue(images[i], key);
+        return;
+    }
+
+    // Kept between calls, SortValue comes through here for every image added
+    thread_local std::vector<RGB> colours;
+    thread_local LabColumns lab;
+    PerceptualKey perceptual = Perceptual(key);
+    bool polar = perceptual.component == Component::Chroma || perceptual.component == Component::Hue;
+    for (size_t start = 0; start < count; start += ConvertBlock) {
+        size_t n = std::min(ConvertBlock, count - start);
+        colours.resize(n);
+        for (size_t i = 0; i < n; i++)
+            colours[i] = images[start + i].averageRgb;
+
+        ConvertColours(perceptual.space, colours.data(), n, lab, polar);
+        PerceptualValues(perceptual, lab, n, values + start);
+    }
+}
+
+}
+
+const char* SortKeyName(SortKey key) {
+    return key < SortKey::Count ? KeyNames[int(key)] : "unknown";
+}
+
+bool ParseSortKey(const std::string& name, SortKey& out) {
+    for (int i = 0; i < SortKeyCount; i++) {
+        if (name == KeyNames[i]) {
+            out = SortKey(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RgbToHsl(const RGB& rgb, HSL& hsl) {
+    double r = rgb.r / 255.f;
+    double g = rgb.g / 255.f;
+    double b = rgb.b / 255.f;
+
+    double max = std::max(std::max(r, g), b);
+    double min = std::min(std::min(r, g), b);
+
+    double delta = max - min;
+
+    double h = 0;
+    if (max != min) {
+        if (max == r)
+            h = (g - b) / delta + (g < b ? 6.f : 0.f);
+        else if (max == g)
+            h = (b - r) / delta + 2.f;
+        else
+            h = (r - g) / delta + 4.f;
+    }
+    h = (h / 6) * 360;
+
+    double l = (max + min) / 2;
+    hsl.h = float(h);
+    hsl.l = float(l);
+    hsl.s = delta == 0 ? 0.f : float(delta / (1 - std::abs(2 * l - 1)));
+}
+
+uint32_t SortValue(const Image& img, SortKey key) {
+    if (IsPerceptual(key)) {
+        uint32_t value;
+        SortValues(&img, 1, key, &value);
+        return value;
+    }
+
+    switch (key) {
+    case SortKey::Hue:
+        return Quantise(img.hsl.h / 360.0);
+    case SortKey::Saturation:
+        return Quantise(img.hsl.s);
+    case SortKey::Lightness:
+        return Quantise(img.hsl.l);
+    case SortKey::Value:
+        // HSV's value, the brightest channel. Cheap enough to work out here rather than keep in every record.
+        return Quantise(std::max({ img.averageRgb.r, img.averageRgb.g, img.averageRgb.b }) / 255.0);
+    case SortKey::HsvSaturation: {
+        // Derived from the average colour the same way, black counts as unsaturated
+        int max = std::max({ img.averageRgb.r, img.averageRgb.g, img.averageRgb.b });
+        int min = std::min({ img.averageRgb.r, img.averageRgb.g, img.averageRgb.b });
+        return max == 0 ? 0 : Quantise(double(max - min) / max);
+    }
+    case SortKey::HueBands: {
+        // Band in the top bits, darkness below it
+        uint32_t band = std::min(uint32_t(std::max(img.hsl.h, 0.f) / (360.f / HueBandCount)), uint32_t(HueBandCount - 1));
+        return band << (32 - BandBits) | Quantise(1 - img.hsl.l) >> BandBits;
+    }
+    default:
+        return 0;
+    }
+}
+
+void SortValues(const Image* images, size_t count, SortKey key, uint32_t* values) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = unsigned(std::min<size_t>(threads, count / ParallelSlice + 1));
+    ParallelFor(threads, [&](unsigned t) {
+        size_t begin = count * t / threads, end = count * (t + 1) / threads;
+        SliceValues(images + begin, end - begin, key, values + begin);
+    });
+}
+
+void RadixSort(std::vector<KeyedId>& items, std::vector<KeyedId>& scratch, unsigned threads) {
+    size_t count = items.size();
+    scratch.resize(count);
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = unsigned(std::min<size_t>(threads, count / ParallelSlice + 1));
+    auto sliceBegin = [&](unsigned t) { return count * t / threads; };
+
+    // Each slice's histograms for all three passes in one read of the values. They stay right
+    // for a single slice, with more the slices hold different items after every scatter.
+    std::vector<Histograms> counts(threads);
+    ParallelFor(threads, [&](unsigned t) {
+        Histograms& histograms = counts[t];
+        for (auto& histogram : histograms)
+            histogram.fill(0);
+        for (size_t i = sliceBegin(t), end = sliceBegin(t + 1); i < end; i++) {
+            for (int pass = 0; pass < Passes; pass++)
+                histograms[pass][(items[i].value >> (pass * DigitBits)) & DigitMask]++;
+        }
+    });
+
+    bool scattered = false;
+    for (int pass = 0; pass < Passes; pass++) {
+        int shift = pass * DigitBits;
+
+        // Nothing to do if every value has the same digit here
+        size_t first = 0;
+        for (unsigned t = 0; t < threads; t++)
+            first += counts[t][pass][count > 0 ? (items[0].value >> shift) & DigitMask : 0];
+        if (first == count)
+            continue;
+
+        if (scattered && threads > 1) {
+            ParallelFor(threads, [&](unsigned t) {
+                auto& histogram = counts[t][pass];
+                histogram.fill(0);
+                for (size_t i = sliceBegin(t), end = sliceBegin(t + 1); i < end; i++)
+                    histogram[(items[i].value >> shift) & DigitMask]++;
+            });
+        }
+
+        // Bucket by bucket, each slice's items go after those of the slices before it, so the
+        // sort stays stable
+        std::vector<std::array<size_t, Buckets>> offsets(threads);
+        size_t total = 0;
+        for (int bucket = 0; bucket < Buckets; bucket++) {
+            for (unsigned t = 0; t < threads; t++) {
+                offsets[t][bucket] = total;
+                total += counts[t][pass][bucket];
+            }
+        }
+
+        ParallelFor(threads, [&](unsigned t) {
+            auto& offset = offsets[t];
+            for (size_t i = sliceBegin(t), end = sliceBegin(t + 1); i < end; i++)
+                scratch[offset[(items[i].value >> shift) & DigitMask]++] = items[i];
+        });
+        items.swap(scratch);
+        scattered = true;
+    }
+}
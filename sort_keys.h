@@ -0,0 +1,62 @@
+#pragma once
+
+#include "image.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the catalog can be ordered by
+// Every key comes from the colours each Image already holds, so switching needs no decoding
+enum class SortKey : uint8_t {
+    Hue,
+    Saturation,
+    Lightness,
+    Value,
+    // HSV's saturation, (max - min) / max, so a dark but pure colour is as saturated as a bright one
+    HsvSaturation,
+    // Twelve 30 degree hue bands, light to dark within each band
+    HueBands,
+    // Perceptual lightness, opponent axes, chroma and hue angle, computed from the average colour
+    // when the key is chosen. Hue puts greys first, dark to light, then the colours by angle.
+    OklabL,
+    OklabA,
+    OklabB,
+    OklabChroma,
+    OklabHue,
+    LabL,
+    LabA,
+    LabB,
+    LabChroma,
+    LabHue,
+    Count
+};
+
+constexpr int SortKeyCount = int(SortKey::Count);
+
+const char* SortKeyName(SortKey key);
+// Key from its name as SortKeyName gives it, false if there's no such key
+bool ParseSortKey(const std::string& name, SortKey& out);
+
+// Full HSL of a colour, hue in degrees and saturation and lightness 0 to 1
+void RgbToHsl(const RGB& rgb, HSL& hsl);
+
+// img's key scaled to the whole 32 bit range, so orders compare integers and can be radix sorted
+// Keeps the order of the float it comes from
+uint32_t SortValue(const Image& img, SortKey key);
+
+// SortValue of count images into values, the same answers in one pass over the catalog
+// Perceptual keys convert the colours in blocks with ConvertColours, working out chroma and hue
+// only for the keys that use them. Large catalogs are split between threads like RadixSort.
+void SortValues(const Image* images, size_t count, SortKey key, uint32_t* values);
+
+// An image's sort value next to its catalog id
+struct KeyedId {
+    uint32_t value;
+    uint32_t id;
+};
+
+// Stable LSD radix sort by value, 11 bits at a time, scratch is resized to match items
+// Passes where every value has the same digit are skipped. Large arrays are split between
+// threads (0 for one per core), each counting and scattering its own slice.
+void RadixSort(std::vector<KeyedId>& items, std::vector<KeyedId>& scratch, unsigned threads = 0);
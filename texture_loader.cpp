@@ -0,0 +1,180 @@
+#include "texture_loader.h"
+#include "decoder.h"
+#include "resample.h"
+#include "exif_thumbnail.h"
+#include "mapped_file.h"
+
+#include <chrono>
+#include <iostream>
+
+TextureLoader::TextureLoader(DecodedImageCache& cache, int displayWidth, int displayHeight, const std::string& thumbnailPack)
+    : cache(cache), displayWidth(displayWidth), displayHeight(displayHeight), packFile(thumbnailPack) {
+    worker = std::thread(&TextureLoader::Run, this);
+}
+
+TextureLoader::~TextureLoader() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void TextureLoader::Request(const std::string& fileName, const std::vector<std::string>& prefetch) {
+    auto cached = cache.Get(fileName);
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        requested = fileName;
+        requestId++;
+        prefetchQueue.assign(prefetch.begin(), prefetch.end());
+
+        hasResult = cached != nullptr;
+        if (cached) {
+            result = { fileName, cached, 0, true };
+            startedId = finishedId = requestId;
+        }
+    }
+    wake.notify_all();
+}
+
+bool TextureLoader::TryTake(LoadedImage& out) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!hasResult)
+        return false;
+
+    out = std::move(result);
+    hasResult = false;
+    return true;
+}
+
+bool TextureLoader::Busy() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return finishedId != requestId || hasResult;
+}
+
+void TextureLoader::ReopenPack() {
+    std::lock_guard<std::mutex> guard(mutex);
+    reopenPack = !packFile.empty();
+}
+
+std::shared_ptr<const sf::Image> TextureLoader::Decode(const std::string& fileName) {
+    DecodedImage decoded;
+    if (!DecodeImage(fileName, SniffImageFormat(fileName), decoded, 4)) {
+        std::cout << "Failed to decode " << fileName << std::endl;
+        return nullptr;
+    }
+
+    int width, height;
+    FitWithin(decoded.width, decoded.height, displayWidth, displayHeight, width, height);
+
+    auto image = std::make_shared<sf::Image>();
+    if (width == decoded.width && height == decoded.height) {
+        image->create(unsigned(width), unsigned(height), decoded.pixels.get());
+        return image;
+    }
+
+    // Shrink before upload, and release the full size pixels as soon as possible
+    std::vector<unsigned char> pixels(size_t(width) * height * 4);
+    ResampleRgba(decoded.pixels.get(), decoded.width, decoded.height, pixels.data(), width, height);
+    decoded.pixels.reset();
+
+    image->create(unsigned(width), unsigned(height), pixels.data());
+    return image;
+}
+
+std::shared_ptr<const sf::Image> TextureLoader::Proxy(const std::string& fileName) {
+    DecodedImage decoded;
+    Thumbnail thumbnail;
+    if (pack.Find(fileName, thumbnail)) {
+        if (!DecodeImage(thumbnail.jpeg, thumbnail.size, ImageFormat::Jpeg, decoded, 4))
+            return nullptr;
+    }
+    else {
+        // Only the first few KB of the mapping are touched to find the Exif block
+        MappedFile file;
+        const unsigned char* jpeg;
+        size_t length;
+        if (!file.Open(fileName) || !FindExifThumbnail(file.Data(), file.Size(), jpeg, length) ||
+            !DecodeImage(jpeg, length, ImageFormat::Jpeg, decoded, 4))
+            return nullptr;
+    }
+
+    auto image = std::make_shared<sf::Image>();
+    image->create(unsigned(decoded.width), unsigned(decoded.height), decoded.pixels.get());
+    return image;
+}
+
+void TextureLoader::Run() {
+    // A missing or unfinished pack just leaves the Exif thumbnail as a proxy
+    if (!packFile.empty())
+        pack.Open(packFile);
+
+    while (true) {
+        std::string fileName;
+        uint64_t id;
+        bool prefetch;
+        bool reopen;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stop || startedId != requestId || !prefetchQueue.empty(); });
+            if (stop)
+                return;
+
+            // The requested image always goes before prefetching
+            prefetch = startedId == requestId;
+            if (prefetch) {
+                fileName = prefetchQueue.front();
+                prefetchQueue.pop_front();
+            }
+            else {
+                fileName = requested;
+                startedId = requestId;
+            }
+            id = requestId;
+            reopen = reopenPack;
+            reopenPack = false;
+        }
+
+        if (reopen)
+            pack.Open(packFile);
+
+        if (prefetch) {
+            if (!cache.Contains(fileName)) {
+                auto image = Decode(fileName);
+                if (image)
+                    cache.Put(fileName, image);
+            }
+            continue;
+        }
+
+        // Post a proxy first, the full image replaces it when it's ready
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto proxy = Proxy(fileName);
+            double proxyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> guard(mutex);
+            if (proxy && id == requestId) {
+                result = { fileName, proxy, proxyMs, false, true };
+                hasResult = true;
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto image = Decode(fileName);
+        if (image)
+            cache.Put(fileName, image);
+        double decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> guard(mutex);
+        finishedId = id;
+        // The user has already moved on, drop it
+        if (id != requestId || !image)
+            continue;
+
+        result = { fileName, image, decodeMs, false };
+        hasResult = true;
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "decoded_lru.h"
+#include "thumbnail_pack.h"
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pixels decoded off the UI thread, ready to upload into an sf::Texture
+struct LoadedImage {
+    std::string fileName;
+    std::shared_ptr<const sf::Image> image;
+    double decodeMs = 0;
+    bool fromCache = false;
+    // A small stand-in shown until the full decode arrives
+    bool proxy = false;
+};
+
+// Decodes the image the viewer wants next on a background thread
+//
+// Only the newest request matters: a request that hasn't started yet is replaced by the
+// next one, and a decode that finishes after a newer request was made is thrown away.
+// Once the requested image is done the worker decodes the prefetch list into the cache,
+// so the following key presses are served from memory. Images are shrunk to fit the
+// display before they are cached or uploaded.
+//
+// A request that misses the cache gets a proxy first when one is cheap to find, the thumbnail
+// from the pack or the one embedded in the JPEG's Exif block. The worker looks it up before
+// the full decode and posts it the same way, so the viewer shows something within a frame or
+// two while the full decode runs.
+class TextureLoader {
+public:
+    TextureLoader(DecodedImageCache& cache, int displayWidth, int displayHeight, const std::string& thumbnailPack = "");
+    ~TextureLoader();
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // Ask for fileName, superseding every earlier request and prefetch list
+    // A cached image is ready for TryTake straight away
+    void Request(const std::string& fileName, const std::vector<std::string>& prefetch = {});
+
+    // Take the decoded image for the newest request, if it has finished
+    // A proxy can be taken first, followed by the full image
+    bool TryTake(LoadedImage& out);
+
+    // True while the newest request hasn't been taken yet
+    bool Busy();
+
+    // Map the thumbnail pack again before the next proxy lookup, to pick up what was written since
+    void ReopenPack();
+
+private:
+    void Run();
+    std::shared_ptr<const sf::Image> Decode(const std::string& fileName);
+    std::shared_ptr<const sf::Image> Proxy(const std::string& fileName);
+
+    DecodedImageCache& cache;
+    int displayWidth;
+    int displayHeight;
+    // Only the worker reads the pack
+    std::string packFile;
+    ThumbnailPack pack;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+    bool stop = false;
+
+    // Newest request, and the last ones the worker picked up and finished
+    std::string requested;
+    uint64_t requestId = 0;
+    uint64_t startedId = 0;
+    uint64_t finishedId = 0;
+    std::deque<std::string> prefetchQueue;
+    bool reopenPack = false;
+
+    bool hasResult = false;
+    LoadedImage result;
+};
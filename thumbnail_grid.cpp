@@ -0,0 +1,381 @@
+#include "thumbnail_grid.h"
+#include "decoder.h"
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Thumbnails are kept at up to SlotSize square and scaled to the cell size when drawn
+constexpr int SlotSize = 128;
+constexpr int AtlasSize = 2048;
+constexpr int AtlasCount = 4;
+constexpr int SlotsPerRow = AtlasSize / SlotSize;
+constexpr int SlotsPerAtlas = SlotsPerRow * SlotsPerRow;
+
+// Cell sizes the grid zooms through, at the smallest an 800x600 view shows 500 cells
+constexpr int CellSizes[] = { 32, 48, 64, 96, 128, 192, 256 };
+constexpr int DefaultZoom = 2;
+constexpr int ZoomLevels = int(sizeof(CellSizes) / sizeof(CellSizes[0]));
+constexpr float Gutter = 2;
+
+// Cap on atlas uploads per frame, so scrolling through many new rows doesn't stall a frame
+constexpr int MaxUploadsPerFrame = 48;
+
+const sf::Color PlaceholderColour(40, 40, 40);
+const sf::Color SelectionColour(255, 255, 255);
+
+// Append an axis aligned quad, texRect in atlas pixels
+void AddQuad(sf::VertexArray& vertices, const sf::FloatRect& rect, const sf::Color& colour, const sf::FloatRect& texRect = {}) {
+    float right = rect.left + rect.width, bottom = rect.top + rect.height;
+    float texRight = texRect.left + texRect.width, texBottom = texRect.top + texRect.height;
+
+    vertices.append(sf::Vertex({ rect.left, rect.top }, colour, { texRect.left, texRect.top }));
+    vertices.append(sf::Vertex({ right, rect.top }, colour, { texRight, texRect.top }));
+    vertices.append(sf::Vertex({ right, bottom }, colour, { texRight, texBottom }));
+    vertices.append(sf::Vertex({ rect.left, bottom }, colour, { texRect.left, texBottom }));
+}
+
+// Outline a cell with four thin quads
+void AddFrame(sf::VertexArray& vertices, float x, float y, float size, const sf::Color& colour) {
+    AddQuad(vertices, { x, y, size, Gutter }, colour);
+    AddQuad(vertices, { x, y + size - Gutter, size, Gutter }, colour);
+    AddQuad(vertices, { x, y, Gutter, size }, colour);
+    AddQuad(vertices, { x + size - Gutter, y, Gutter, size }, colour);
+}
+
+}
+
+ThumbnailGrid::ThumbnailGrid(int viewWidth, int viewHeight, const std::string& thumbnailPack)
+    : viewWidth(viewWidth), viewHeight(viewHeight), zoom(DefaultZoom),
+      atlases(AtlasCount), slots(AtlasCount * SlotsPerAtlas),
+      backgrounds(sf::Quads), batches(AtlasCount, sf::VertexArray(sf::Quads)), packFile(thumbnailPack) {
+    // Hand out slots from the front so later atlases are only created when they're needed
+    for (int i = int(slots.size()) - 1; i >= 0; i--)
+        freeSlots.push_back(i);
+
+    worker = std::thread(&ThumbnailGrid::Run, this);
+}
+
+ThumbnailGrid::~ThumbnailGrid() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void ThumbnailGrid::SetFiles(GridFiles newFiles) {
+    std::string current = Selected();
+    files = std::move(newFiles);
+    namesStale = true;
+
+    selected = current.empty() ? -1 : files.find(current);
+    selected = std::clamp(selected, 0, std::max(0, CellCount() - 1));
+    ClampScroll();
+}
+
+void ThumbnailGrid::Select(const std::string& fileName) {
+    selected = CellCount() > 0 ? std::max(0, files.find(fileName)) : 0;
+    ScrollToSelection();
+}
+
+void ThumbnailGrid::MoveSelection(int columns, int rows) {
+    if (CellCount() == 0)
+        return;
+
+    selected = std::clamp(selected + columns + rows * Columns(), 0, CellCount() - 1);
+    ScrollToSelection();
+}
+
+bool ThumbnailGrid::SelectAt(float x, float y) {
+    int cell = CellSizes[zoom];
+    int columns = Columns();
+    float left = (viewWidth - columns * cell) / 2.f;
+
+    if (x < left || x >= left + columns * cell || y < 0)
+        return false;
+
+    int index = int((y + scroll) / cell) * columns + int((x - left) / cell);
+    if (index >= CellCount())
+        return false;
+
+    selected = index;
+    return true;
+}
+
+std::string ThumbnailGrid::Selected() const {
+    if (CellCount() == 0)
+        return {};
+    if (!namesStale && selected >= namesFirst && selected < namesFirst + int(names.size()))
+        return names[selected - namesFirst];
+
+    std::vector<std::string> one = files.names(selected, selected + 1);
+    return one.empty() ? std::string() : one.front();
+}
+
+void ThumbnailGrid::Scroll(float pixels) {
+    scroll += pixels;
+    ClampScroll();
+}
+
+void ThumbnailGrid::Zoom(int steps) {
+    zoom = std::clamp(zoom + steps, 0, ZoomLevels - 1);
+    ScrollToSelection();
+}
+
+int ThumbnailGrid::Columns() const {
+    return std::max(1, viewWidth / CellSizes[zoom]);
+}
+
+void ThumbnailGrid::ClampScroll() {
+    int cell = CellSizes[zoom];
+    int rows = (CellCount() + Columns() - 1) / Columns();
+    float maxScroll = std::max(0.f, float(rows * cell - viewHeight));
+    scroll = std::clamp(scroll, 0.f, maxScroll);
+}
+
+void ThumbnailGrid::ScrollToSelection() {
+    int cell = CellSizes[zoom];
+    float top = float(selected / Columns() * cell);
+
+    if (top < scroll)
+        scroll = top;
+    else if (top + cell > scroll + viewHeight)
+        scroll = top + cell - viewHeight;
+    ClampScroll();
+}
+
+void ThumbnailGrid::VisibleRange(int& first, int& last) const {
+    int cell = CellSizes[zoom];
+    int columns = Columns();
+    int firstRow = int(scroll / cell);
+    int lastRow = int(std::ceil((scroll + viewHeight) / cell));
+
+    first = std::min(CellCount(), firstRow * columns);
+    last = std::min(CellCount(), lastRow * columns);
+}
+
+const std::string& ThumbnailGrid::Name(int cell) const {
+    static const std::string none;
+    if (cell < namesFirst || cell >= namesFirst + int(names.size()))
+        return none;
+    return names[cell - namesFirst];
+}
+
+int ThumbnailGrid::AllocateSlot() {
+    if (!freeSlots.empty()) {
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    // Reuse the slot that has gone longest without being wanted, never one wanted this frame
+    int oldest = -1;
+    for (int i = 0; i < int(slots.size()); i++) {
+        if (slots[i].lastUsed < frame && (oldest < 0 || slots[i].lastUsed < slots[oldest].lastUsed))
+            oldest = i;
+    }
+    if (oldest >= 0)
+        slotOf.erase(slots[oldest].fileName);
+    return oldest;
+}
+
+void ThumbnailGrid::Upload(Decoded& thumbnail) {
+    int slot = AllocateSlot();
+    if (slot < 0)
+        return;
+
+    int atlas = slot / SlotsPerAtlas;
+    if (!atlases[atlas]) {
+        atlases[atlas] = std::make_unique<sf::Texture>();
+        atlases[atlas]->create(AtlasSize, AtlasSize);
+        atlases[atlas]->setSmooth(true);
+    }
+
+    int x = slot % SlotsPerAtlas % SlotsPerRow * SlotSize;
+    int y = slot % SlotsPerAtlas / SlotsPerRow * SlotSize;
+    atlases[atlas]->update(thumbnail.pixels.data(), unsigned(thumbnail.width), unsigned(thumbnail.height), unsigned(x), unsigned(y));
+
+    slots[slot] = { thumbnail.fileName, thumbnail.width, thumbnail.height, frame };
+    slotOf[thumbnail.fileName] = slot;
+}
+
+bool ThumbnailGrid::Update() {
+    frame++;
+
+    std::vector<Decoded> arrived;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        while (!results.empty() && int(arrived.size()) < MaxUploadsPerFrame) {
+            arrived.push_back(std::move(results.front()));
+            results.pop_front();
+        }
+    }
+
+    for (auto& thumbnail : arrived) {
+        if (thumbnail.width == 0)
+            failed.insert(thumbnail.fileName);
+        else if (slotOf.count(thumbnail.fileName) == 0)
+            Upload(thumbnail);
+    }
+
+    int first, last;
+    VisibleRange(first, last);
+
+    // Keep a margin of rows either side decoded as well, as much as the slots left over allow
+    int columns = Columns();
+    int screenRows = viewHeight / CellSizes[zoom] + 2;
+    int marginRows = std::clamp((int(slots.size()) - screenRows * columns) / (2 * columns), 0, screenRows);
+
+    // Only these cells are looked up, again when the view moves or the order is replaced
+    int before = std::max(0, first - marginRows * columns);
+    int after = std::min(CellCount(), last + marginRows * columns);
+    if (namesStale || before != namesFirst || after != namesFirst + int(names.size())) {
+        names = files.count > 0 ? files.names(before, after) : std::vector<std::string>();
+        namesFirst = before;
+        namesStale = false;
+    }
+
+    std::vector<std::string> wanted;
+    auto want = [&](int i) {
+        const std::string& name = Name(i);
+        if (name.empty())
+            return;
+        auto it = slotOf.find(name);
+        if (it != slotOf.end())
+            slots[it->second].lastUsed = frame;
+        else if (failed.count(name) == 0)
+            wanted.push_back(name);
+    };
+
+    // On screen first, then the margin below (the usual scroll direction) and above
+    for (int i = first; i < last; i++)
+        want(i);
+    for (int i = last; i < after; i++)
+        want(i);
+    for (int i = first - 1; i >= before; i--)
+        want(i);
+
+    if (wanted != lastWanted) {
+        RequestDecodes(wanted);
+        lastWanted = std::move(wanted);
+    }
+    return !arrived.empty();
+}
+
+bool ThumbnailGrid::Busy() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return !queue.empty() || !decoding.empty() || !results.empty();
+}
+
+void ThumbnailGrid::Draw(sf::RenderTarget& target) {
+    float cell = float(CellSizes[zoom]);
+    int columns = Columns();
+    float left = (viewWidth - columns * cell) / 2.f;
+    float inner = cell - 2 * Gutter;
+
+    backgrounds.clear();
+    for (auto& batch : batches)
+        batch.clear();
+
+    int first, last;
+    VisibleRange(first, last);
+    for (int i = first; i < last; i++) {
+        float x = left + i % columns * cell;
+        float y = i / columns * cell - scroll;
+
+        if (i == selected)
+            AddFrame(backgrounds, x, y, cell, SelectionColour);
+
+        auto it = slotOf.find(Name(i));
+        if (it == slotOf.end()) {
+            AddQuad(backgrounds, { x + 2 * Gutter, y + 2 * Gutter, inner - 2 * Gutter, inner - 2 * Gutter }, PlaceholderColour);
+            continue;
+        }
+
+        // Fit the thumbnail in the cell, centred, scaling up as well as down
+        int slot = it->second;
+        auto& s = slots[slot];
+        float scale = std::min(inner / s.width, inner / s.height);
+        float w = s.width * scale, h = s.height * scale;
+
+        // Half a texel in from the edge so smoothing doesn't pick up the neighbouring slot
+        float texX = float(slot % SlotsPerAtlas % SlotsPerRow * SlotSize);
+        float texY = float(slot % SlotsPerAtlas / SlotsPerRow * SlotSize);
+        sf::FloatRect texRect(texX + 0.5f, texY + 0.5f, s.width - 1.f, s.height - 1.f);
+
+        AddQuad(batches[slot / SlotsPerAtlas], { x + (cell - w) / 2, y + (cell - h) / 2, w, h }, sf::Color::White, texRect);
+    }
+
+    target.draw(backgrounds);
+    drawCalls = 1;
+    for (int i = 0; i < AtlasCount; i++) {
+        if (batches[i].getVertexCount() == 0)
+            continue;
+
+        target.draw(batches[i], sf::RenderStates(atlases[i].get()));
+        drawCalls++;
+    }
+}
+
+void ThumbnailGrid::RequestDecodes(const std::vector<std::string>& wanted) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        queue.clear();
+        for (auto& fileName : wanted) {
+            // Already on its way
+            if (fileName == decoding)
+                continue;
+            if (std::any_of(results.begin(), results.end(), [&](const Decoded& d) { return d.fileName == fileName; }))
+                continue;
+            queue.push_back(fileName);
+        }
+    }
+    wake.notify_all();
+}
+
+bool ThumbnailGrid::Decode(const std::string& fileName, Decoded& out) {
+    DecodedImage decoded;
+    Thumbnail thumbnail;
+
+    bool fromPack = pack.Find(fileName, thumbnail) &&
+                    DecodeImage(thumbnail.jpeg, thumbnail.size, ImageFormat::Jpeg, decoded, 4);
+    if (!fromPack && !DecodeImage(fileName, SniffImageFormat(fileName), decoded, 4))
+        return false;
+
+    FitWithin(decoded.width, decoded.height, SlotSize, SlotSize, out.width, out.height);
+    out.pixels.resize(size_t(out.width) * out.height * 4);
+    ResampleRgba(decoded.pixels.get(), decoded.width, decoded.height, out.pixels.data(), out.width, out.height);
+    return true;
+}
+
+void ThumbnailGrid::Run() {
+    // A missing or unfinished pack just means decoding the source files
+    if (!packFile.empty())
+        pack.Open(packFile);
+
+    while (true) {
+        Decoded thumbnail;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stop || !queue.empty(); });
+            if (stop)
+                return;
+
+            thumbnail.fileName = queue.front();
+            queue.pop_front();
+            decoding = thumbnail.fileName;
+        }
+
+        // A failed decode is passed on with no size so the grid stops asking for it
+        if (!Decode(thumbnail.fileName, thumbnail))
+            thumbnail.width = thumbnail.height = 0;
+
+        std::lock_guard<std::mutex> guard(mutex);
+        results.push_back(std::move(thumbnail));
+        decoding.clear();
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "thumbnail_pack.h"
+
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// The order the grid shows, read a stretch at a time so only the cells around the view are ever
+// turned into file names, however many files there are
+struct GridFiles {
+    int count = 0;
+    // File names at positions [first, last), fewer if the order has shrunk since count
+    std::function<std::vector<std::string>(int first, int last)> names;
+    // Position of a file, -1 if it isn't in the order
+    std::function<int(const std::string& fileName)> find;
+};
+
+// Contact sheet of thumbnails in catalog (hue) order
+//
+// Thumbnails are stored in slots of a few large atlas textures and each atlas is drawn with
+// one vertex array, so a screen of hundreds of thumbnails costs a handful of draw calls rather
+// than one per image. Only the visible rows and a margin around them hold slots, slots that
+// scroll well out of view are reused. Thumbnails are decoded on a background thread, from the
+// thumbnail pack when it has them and otherwise from the source file.
+class ThumbnailGrid {
+public:
+    ThumbnailGrid(int viewWidth, int viewHeight, const std::string& thumbnailPack);
+    ~ThumbnailGrid();
+
+    ThumbnailGrid(const ThumbnailGrid&) = delete;
+    ThumbnailGrid& operator=(const ThumbnailGrid&) = delete;
+
+    // Replace the catalog order, the selection stays on the same file
+    void SetFiles(GridFiles files);
+
+    // Select a file and scroll it into view, the first file if it isn't in the grid
+    void Select(const std::string& fileName);
+    // Move the selection by cells, scrolling to keep it in view
+    void MoveSelection(int columns, int rows);
+    // Select the cell under a point in the view, false if there isn't one
+    bool SelectAt(float x, float y);
+    // Selected file, empty if the grid is empty
+    std::string Selected() const;
+    // Position of the selection in the order
+    int SelectedIndex() const { return selected; }
+
+    // Scroll by pixels, clamped to the catalog
+    void Scroll(float pixels);
+    // Step the cell size up or down, keeping the selection in view
+    void Zoom(int steps);
+
+    // Upload thumbnails that have been decoded and queue the missing visible ones
+    // Returns true if any arrived, so the grid needs drawing again
+    bool Update();
+
+    // True while thumbnails are queued, decoding or waiting to be uploaded
+    bool Busy();
+
+    void Draw(sf::RenderTarget& target);
+
+    // Draw calls made by the last Draw: the cell backgrounds plus one per atlas in use
+    int DrawCalls() const { return drawCalls; }
+
+private:
+    struct Slot {
+        std::string fileName;
+        int width = 0;
+        int height = 0;
+        uint64_t lastUsed = 0;
+    };
+
+    struct Decoded {
+        std::string fileName;
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    int Columns() const;
+    int CellCount() const { return files.count; }
+    void ClampScroll();
+    void ScrollToSelection();
+    // Cells [first, last) that are at least partly on screen
+    void VisibleRange(int& first, int& last) const;
+    // Name of a cell resolved by the last Update, empty outside the cells it looked at
+    const std::string& Name(int cell) const;
+
+    int AllocateSlot();
+    void Upload(Decoded& thumbnail);
+
+    // Decode thread
+    void Run();
+    bool Decode(const std::string& fileName, Decoded& out);
+    void RequestDecodes(const std::vector<std::string>& wanted);
+
+    int viewWidth;
+    int viewHeight;
+    int zoom;
+    float scroll = 0;
+    int selected = 0;
+    GridFiles files;
+    // Names of cells [namesFirst, namesFirst + names.size()), the view and its margin
+    std::vector<std::string> names;
+    int namesFirst = 0;
+    bool namesStale = true;
+
+    uint64_t frame = 0;
+    std::vector<std::unique_ptr<sf::Texture>> atlases;
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    std::unordered_map<std::string, int> slotOf;
+    // Files that couldn't be decoded, so they aren't asked for again
+    std::unordered_set<std::string> failed;
+    std::vector<std::string> lastWanted;
+
+    sf::VertexArray backgrounds;
+    std::vector<sf::VertexArray> batches;
+    int drawCalls = 0;
+
+    std::string packFile;
+    ThumbnailPack pack;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+    bool stop = false;
+    std::deque<std::string> queue;
+    std::string decoding;
+    std::deque<Decoded> results;
+};
@@ -0,0 +1,385 @@
+#include "thumbnail_pack.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char PackMagic[4] = { 'I', 'V', 'T', 'P' };
+// 2 wrapped the index in a skip block so entries can follow it, 3 added the source file's size
+// and mtime to entries and index records, and footers that index only part of the pack
+constexpr uint32_t PackVersion = 3;
+constexpr size_t FileHeaderSize = 8;
+constexpr char EntryMagic[4] = { 'I', 'V', 'T', 'E' };
+constexpr char SkipMagic[4] = { 'I', 'V', 'T', 'S' };
+constexpr char FooterMagic[8] = { 'I', 'V', 'T', 'P', 'I', 'N', 'D', 'X' };
+constexpr int JpegQuality = 85;
+
+struct EntryHeader {
+    char magic[4];
+    uint32_t pathLength;
+    uint32_t dataLength;
+    uint16_t width;
+    uint16_t height;
+    uint64_t fileSize;
+    int64_t modifiedTime;
+};
+static_assert(sizeof(EntryHeader) == 32, "thumbnail entry header must stay packed");
+
+// Path hash and PackEntry
+constexpr size_t IndexRecordSize = 32;
+
+struct Footer {
+    // Where the entries the index doesn't cover begin, the end of the footer when it covers all
+    uint64_t tailStart;
+    uint64_t indexOffset;
+    uint64_t count;
+    char magic[8];
+};
+static_assert(sizeof(Footer) == 32, "thumbnail footer must stay packed");
+
+// Header of a block scanning steps over, length bytes follow it
+EntryHeader SkipHeader(uint64_t length) {
+    EntryHeader header = {};
+    std::memcpy(header.magic, SkipMagic, sizeof(SkipMagic));
+    header.dataLength = uint32_t(length);
+    return header;
+}
+
+uint64_t PathHash(const std::string& fileName) {
+    return HashBytes(fileName.data(), fileName.size());
+}
+
+void AppendToVector(void* context, void* data, int size) {
+    auto* bytes = static_cast<std::vector<unsigned char>*>(context);
+    auto* begin = static_cast<unsigned char*>(data);
+    bytes->insert(bytes->end(), begin, begin + size);
+}
+
+}
+
+bool EncodeJpeg(const unsigned char* rgb, int width, int height, int quality, std::vector<unsigned char>& out) {
+    out.clear();
+    return stbi_write_jpg_to_func(AppendToVector, &out, width, height, 3, rgb, quality) != 0;
+}
+
+void MakeThumbnail(const ImagePixels& img, int longEdge, std::vector<unsigned char>& out, int& width, int& height) {
+    float scale = std::min(1.f, float(longEdge) / float(std::max(img.width, img.height)));
+    width = std::max(1, int(img.width * scale + 0.5f));
+    height = std::max(1, int(img.height * scale + 0.5f));
+    out.resize(size_t(width) * height * 3);
+
+    // Each output pixel is the mean of the source rectangle it covers
+    for (int y = 0; y < height; y++) {
+        int y0 = int(int64_t(y) * img.height / height);
+        int y1 = std::max(y0 + 1, int(int64_t(y + 1) * img.height / height));
+
+        for (int x = 0; x < width; x++) {
+            int x0 = int(int64_t(x) * img.width / width);
+            int x1 = std::max(x0 + 1, int(int64_t(x + 1) * img.width / width));
+
+            int r = 0, g = 0, b = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                const RGB* row = img.rgb.data() + size_t(sy) * img.width;
+                for (int sx = x0; sx < x1; sx++) {
+                    r += row[sx].r;
+                    g += row[sx].g;
+                    b += row[sx].b;
+                }
+            }
+
+            int count = (y1 - y0) * (x1 - x0);
+            unsigned char* pixel = &out[(size_t(y) * width + x) * 3];
+            pixel[0] = (unsigned char)(r / count);
+            pixel[1] = (unsigned char)(g / count);
+            pixel[2] = (unsigned char)(b / count);
+        }
+    }
+}
+
+bool ThumbnailPack::Open(const std::string& fileName) {
+    index = nullptr;
+    indexCount = 0;
+    scanned.clear();
+
+    if (!mapping.Open(fileName) || mapping.Size() < FileHeaderSize || std::memcmp(mapping.Data(), PackMagic, sizeof(PackMagic)) != 0)
+        return false;
+
+    uint32_t version;
+    std::memcpy(&version, mapping.Data() + sizeof(PackMagic), sizeof(version));
+    if (version != PackVersion)
+        return false;
+
+    // Without a footer at the end every entry has to be scanned
+    uint64_t tailStart = FileHeaderSize;
+    if (!ReadFooter(tailStart))
+        tailStart = FileHeaderSize;
+    ScanEntries(tailStart);
+    return true;
+}
+
+// Use the index the footer at the end of the pack points to, false if the pack doesn't end in one
+// tailStart is set to where the entries the index doesn't cover begin
+bool ThumbnailPack::ReadFooter(uint64_t& tailStart) {
+    if (mapping.Size() < FileHeaderSize + sizeof(Footer))
+        return false;
+
+    uint64_t footerOffset = mapping.Size() - sizeof(Footer);
+    Footer footer;
+    std::memcpy(&footer, mapping.Data() + footerOffset, sizeof(footer));
+    if (std::memcmp(footer.magic, FooterMagic, sizeof(FooterMagic)) != 0)
+        return false;
+    if (footer.indexOffset < FileHeaderSize || footer.count > (footerOffset - footer.indexOffset) / IndexRecordSize ||
+        footer.tailStart < FileHeaderSize || footer.tailStart > mapping.Size())
+        return false;
+
+    index = mapping.Data() + footer.indexOffset;
+    indexCount = footer.count;
+    tailStart = footer.tailStart;
+    return true;
+}
+
+// Walk the entries from offset to the end, stepping over indexes and footers and stopping at
+// the first damaged entry
+void ThumbnailPack::ScanEntries(uint64_t offset) {
+    std::string path;
+    Thumbnail thumbnail;
+    PackEntry entry;
+    while (true) {
+        EntryHeader header;
+        if (offset + sizeof(header) <= mapping.Size()) {
+            std::memcpy(&header, mapping.Data() + offset, sizeof(header));
+            uint64_t next = offset + sizeof(header) + header.dataLength;
+            if (std::memcmp(header.magic, SkipMagic, sizeof(SkipMagic)) == 0 && next <= mapping.Size()) {
+                offset = next;
+                continue;
+            }
+        }
+        if (!ReadEntry(offset, path, thumbnail, &entry))
+            break;
+        scanned[PathHash(path)] = entry;
+        offset += sizeof(EntryHeader) + path.size() + thumbnail.size;
+    }
+
+    dataEnd = offset;
+}
+
+bool ThumbnailPack::ReadEntry(uint64_t offset, std::string& path, Thumbnail& out, PackEntry* entry) const {
+    if (offset + sizeof(EntryHeader) > mapping.Size())
+        return false;
+
+    EntryHeader header;
+    std::memcpy(&header, mapping.Data() + offset, sizeof(header));
+    if (std::memcmp(header.magic, EntryMagic, sizeof(EntryMagic)) != 0)
+        return false;
+
+    uint64_t length = sizeof(EntryHeader) + uint64_t(header.pathLength) + header.dataLength;
+    if (offset + length > mapping.Size())
+        return false;
+
+    const unsigned char* pathStart = mapping.Data() + offset + sizeof(EntryHeader);
+    path.assign(reinterpret_cast<const char*>(pathStart), header.pathLength);
+
+    out.jpeg = pathStart + header.pathLength;
+    out.size = header.dataLength;
+    out.width = header.width;
+    out.height = header.height;
+    if (entry != nullptr)
+        *entry = { offset, header.fileSize, header.modifiedTime };
+    return true;
+}
+
+bool ThumbnailPack::Find(const std::string& fileName, Thumbnail& out) const {
+    uint64_t hash = PathHash(fileName);
+    uint64_t offset = 0;
+
+    // Entries after the index are newer than the ones in it
+    auto it = scanned.find(hash);
+    if (it != scanned.end()) {
+        offset = it->second.offset;
+    }
+    else {
+        // Binary search the mapped index records
+        uint64_t low = 0, high = indexCount;
+        while (low < high) {
+            uint64_t mid = (low + high) / 2;
+            uint64_t midHash;
+            std::memcpy(&midHash, index + mid * IndexRecordSize, sizeof(midHash));
+            if (midHash < hash)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        uint64_t foundHash = 0;
+        if (low < indexCount)
+            std::memcpy(&foundHash, index + low * IndexRecordSize, sizeof(foundHash));
+        if (low == indexCount || foundHash != hash)
+            return false;
+        std::memcpy(&offset, index + low * IndexRecordSize + 8, sizeof(offset));
+    }
+
+    std::string path;
+    return ReadEntry(offset, path, out) && path == fileName;
+}
+
+size_t ThumbnailPack::Count() const {
+    return size_t(indexCount) + scanned.size();
+}
+
+bool ThumbnailPackWriter::Open(const std::string& packFile) {
+    fileName = packFile;
+    fs::path path = fs::u8path(fileName);
+
+    ThumbnailPack existing;
+    uint64_t fileSize = 0;
+    if (existing.Open(fileName)) {
+        existing.ForEachEntry([this](uint64_t hash, const PackEntry& entry) {
+            entries.emplace_back(hash, entry);
+            stamps[hash] = entry;
+        });
+        dataEnd = existing.DataEnd();
+        std::error_code error;
+        fileSize = fs::file_size(path, error);
+    }
+    existing = ThumbnailPack();
+
+    if (dataEnd == 0) {
+        // Nothing usable, a new file rather than truncating one a reader may have mapped
+        std::error_code error;
+        fs::remove(path, error);
+        out.open(path, std::ios::binary | std::ios::trunc);
+        out.write(PackMagic, sizeof(PackMagic));
+        out.write(reinterpret_cast<const char*>(&PackVersion), sizeof(PackVersion));
+        dataEnd = FileHeaderSize;
+        return out.is_open();
+    }
+
+    // A torn end from a crash is covered by a skip block rather than cut off. Its header is
+    // written over bytes no reader looks at, and may run past them.
+    if (fileSize > dataEnd) {
+        std::fstream torn(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t skipped = fileSize - dataEnd >= sizeof(EntryHeader) ? fileSize - dataEnd - sizeof(EntryHeader) : 0;
+        EntryHeader header = SkipHeader(skipped);
+        torn.seekp(std::streamoff(dataEnd));
+        torn.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!torn)
+            return false;
+        dataEnd += sizeof(header) + skipped;
+    }
+
+    out.open(path, std::ios::binary | std::ios::app);
+    return out.is_open();
+}
+
+bool ThumbnailPackWriter::IsOpen() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return out.is_open();
+}
+
+bool ThumbnailPackWriter::Contains(const std::string& name, uint64_t fileSize, int64_t modifiedTime) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = stamps.find(PathHash(name));
+    return it != stamps.end() && it->second.fileSize == fileSize && it->second.modifiedTime == modifiedTime;
+}
+
+bool ThumbnailPackWriter::Append(const std::string& name, uint64_t fileSize, int64_t modifiedTime,
+                                 const unsigned char* rgb, int width, int height) {
+    std::vector<unsigned char> jpeg;
+    if (!EncodeJpeg(rgb, width, height, JpegQuality, jpeg))
+        return false;
+
+    EntryHeader header;
+    std::memcpy(header.magic, EntryMagic, sizeof(EntryMagic));
+    header.pathLength = uint32_t(name.size());
+    header.dataLength = uint32_t(jpeg.size());
+    header.width = uint16_t(width);
+    header.height = uint16_t(height);
+    header.fileSize = fileSize;
+    header.modifiedTime = modifiedTime;
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    // Appending after Finish, the old footer stays behind in its skip block
+    indexWritten = false;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(name.data(), std::streamsize(name.size()));
+    out.write(reinterpret_cast<const char*>(jpeg.data()), std::streamsize(jpeg.size()));
+
+    uint64_t hash = PathHash(name);
+    PackEntry entry = { dataEnd, fileSize, modifiedTime };
+    entries.emplace_back(hash, entry);
+    stamps[hash] = entry;
+    dataEnd += sizeof(header) + name.size() + jpeg.size();
+    return bool(out);
+}
+
+void ThumbnailPackWriter::Finish() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!out.is_open() || indexWritten)
+        return;
+
+    // A new index every time would grow the pack by its size per finish, only write one once
+    // it would cover at least twice what the last one did, so they add up to O(entries)
+    if (indexEnd == 0 || entries.size() - indexCount >= indexCount) {
+        WriteIndex();
+    }
+    else {
+        // Point at the last index, readers scan the entries after it
+        EntryHeader header = SkipHeader(sizeof(Footer));
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        WriteFooter(indexEnd);
+        dataEnd += sizeof(header) + sizeof(Footer);
+    }
+    out.flush();
+    indexWritten = true;
+}
+
+void ThumbnailPackWriter::WriteIndex() {
+    // Keep only the newest entry per path, then order by hash for the binary search
+    std::stable_sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    std::vector<std::pair<uint64_t, PackEntry>> unique;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i + 1 < entries.size() && entries[i + 1].first == entries[i].first)
+            continue;
+        unique.push_back(entries[i]);
+    }
+    entries = unique;
+
+    // Skip header, padding to align the index, the index and the footer
+    static const char padding[8] = {};
+    indexOffset = (dataEnd + sizeof(EntryHeader) + 7) & ~uint64_t(7);
+    indexCount = entries.size();
+    indexEnd = indexOffset + indexCount * IndexRecordSize + sizeof(Footer);
+    EntryHeader header = SkipHeader(indexEnd - dataEnd - sizeof(EntryHeader));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding, std::streamsize(indexOffset - dataEnd - sizeof(EntryHeader)));
+
+    for (auto& entry : entries) {
+        out.write(reinterpret_cast<const char*>(&entry.first), sizeof(entry.first));
+        out.write(reinterpret_cast<const char*>(&entry.second.offset), sizeof(entry.second.offset));
+        out.write(reinterpret_cast<const char*>(&entry.second.fileSize), sizeof(entry.second.fileSize));
+        out.write(reinterpret_cast<const char*>(&entry.second.modifiedTime), sizeof(entry.second.modifiedTime));
+    }
+
+    // It covers every entry, nothing to scan
+    WriteFooter(indexEnd);
+    dataEnd = indexEnd;
+}
+
+void ThumbnailPackWriter::WriteFooter(uint64_t tailStart) {
+    Footer footer;
+    footer.tailStart = tailStart;
+    footer.indexOffset = indexOffset;
+    footer.count = indexCount;
+    std::memcpy(footer.magic, FooterMagic, sizeof(FooterMagic));
+    out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "image.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Long edge of generated thumbnails
+constexpr int ThumbnailLongEdge = 256;
+
+// Area-average decoded pixels so the long edge is at most longEdge
+// Writes packed 8 bit RGB into out
+void MakeThumbnail(const ImagePixels& img, int longEdge, std::vector<unsigned char>& out, int& width, int& height);
+
+// JPEG encode packed 8 bit RGB pixels into out, also used for the tiles of zoom pyramids
+bool EncodeJpeg(const unsigned char* rgb, int width, int height, int quality, std::vector<unsigned char>& out);
+
+// Where a pack entry is, and the size and mtime of the file its thumbnail was made from
+struct PackEntry {
+    uint64_t offset = 0;
+    uint64_t fileSize = 0;
+    int64_t modifiedTime = 0;
+};
+
+// A thumbnail inside a mapped pack
+struct Thumbnail {
+    const unsigned char* jpeg = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Pack file of JPEG thumbnails, one entry per source image
+//
+// Layout: 8 byte file header, then entries of a 32 byte header ("IVTE", path length,
+// JPEG length, width, height, and the size and mtime of the source file), the path and the
+// JPEG bytes. When the writer finishes it appends an index of (path hash, entry offset, size,
+// mtime) records sorted by hash, followed by a 32 byte footer (tail start, index offset,
+// count, "IVTPINDX"), so a reader can find any thumbnail straight from the mapping. The index
+// and footer sit in a skip block ("IVTS" header, its length in the JPEG length), as does the
+// torn end a crash leaves.
+//
+// The file only ever grows. Readers map it while the writer appends, and cutting an old
+// index or torn end off would leave their mappings past the end of the file. New entries
+// go after the last footer. Rewriting the whole index each time would grow the file by the
+// size of the index per finish, so a finish that adds fewer entries than the last index holds
+// writes only a footer pointing at that index; the tail start tells readers where the entries
+// it doesn't cover begin, and they scan those.
+//
+// Read side, maps the pack and looks thumbnails up by source path
+class ThumbnailPack {
+public:
+    bool Open(const std::string& fileName);
+
+    bool Find(const std::string& fileName, Thumbnail& out) const;
+
+    // Entries, a path appended again after the index counts twice
+    size_t Count() const;
+
+    // Offset just past the last entry or skip block, where the next entry belongs
+    uint64_t DataEnd() const { return dataEnd; }
+
+    // Visit the path hash and PackEntry of every entry, the newest entry for a path last
+    template <typename F>
+    void ForEachEntry(F visit) const;
+
+private:
+    bool ReadEntry(uint64_t offset, std::string& path, Thumbnail& out, PackEntry* entry = nullptr) const;
+    bool ReadFooter(uint64_t& tailStart);
+    void ScanEntries(uint64_t offset);
+
+    MappedFile mapping;
+    uint64_t dataEnd = 0;
+    // Sorted index records in the mapping when the pack has an index
+    const unsigned char* index = nullptr;
+    uint64_t indexCount = 0;
+    // Built by scanning the entries the index doesn't cover, all of them if there's no index
+    std::unordered_map<uint64_t, PackEntry> scanned;
+};
+
+// Write side, appends thumbnails from the pipeline and indexes them on Finish
+class ThumbnailPackWriter {
+public:
+    bool Open(const std::string& fileName);
+
+    // True if the pack holds a thumbnail for this file made when it had this size and mtime
+    bool Contains(const std::string& fileName, uint64_t fileSize, int64_t modifiedTime) const;
+
+    // JPEG encode packed RGB pixels and append them, safe to call from any thread
+    bool Append(const std::string& fileName, uint64_t fileSize, int64_t modifiedTime,
+                const unsigned char* rgb, int width, int height);
+
+    // Make every entry findable from the footer, the pack can keep growing afterwards
+    // The first finish of a run writes an index of every entry. Later ones write a new index
+    // only once there are as many entries since the last as it holds, otherwise just a footer.
+    void Finish();
+
+    bool IsOpen() const;
+
+private:
+    void WriteIndex();
+    void WriteFooter(uint64_t tailStart);
+
+    std::string fileName;
+    mutable std::mutex mutex;
+    std::ofstream out;
+    uint64_t dataEnd = 0;
+    bool indexWritten = false;
+    // The last index this run wrote: where it is, how many entries it holds and where its block ends
+    uint64_t indexOffset = 0;
+    uint64_t indexCount = 0;
+    uint64_t indexEnd = 0;
+    // Path hash and entry, the indexed ones first, then appended since, later entries win
+    std::vector<std::pair<uint64_t, PackEntry>> entries;
+    std::unordered_map<uint64_t, PackEntry> stamps;
+};
+
+template <typename F>
+void ThumbnailPack::ForEachEntry(F visit) const {
+    for (uint64_t i = 0; i < indexCount; i++) {
+        uint64_t hash;
+        PackEntry entry;
+        std::memcpy(&hash, index + i * 32, sizeof(hash));
+        std::memcpy(&entry.offset, index + i * 32 + 8, sizeof(entry.offset));
+        std::memcpy(&entry.fileSize, index + i * 32 + 16, sizeof(entry.fileSize));
+        std::memcpy(&entry.modifiedTime, index + i * 32 + 24, sizeof(entry.modifiedTime));
+        visit(hash, entry);
+    }
+    for (auto& entry : scanned)
+        visit(entry.first, entry.second);
+}
@@ -0,0 +1,273 @@
+#include "tile_pyramid.h"
+#include "content_hash.h"
+#include "decoder.h"
+#include "thumbnail_pack.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char PyramidMagic[4] = { 'I', 'V', 'Z', 'P' };
+constexpr uint32_t PyramidVersion = 1;
+constexpr int TileQuality = 90;
+
+struct PyramidHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+    uint32_t levelCount;
+    uint32_t tileCount;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+};
+static_assert(sizeof(PyramidHeader) == 48, "pyramid header must stay packed");
+
+struct TileEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+static_assert(sizeof(TileEntry) == 16, "pyramid tile entry must stay packed");
+
+// 2x2 box filter of a pair of rows, an odd last column is averaged with itself
+void HalveRows(const unsigned char* top, const unsigned char* bottom, int width, int halfWidth, unsigned char* out) {
+    for (int x = 0; x < halfWidth; x++) {
+        size_t left = size_t(2 * x) * 3;
+        size_t right = size_t(std::min(2 * x + 1, width - 1)) * 3;
+        for (int c = 0; c < 3; c++)
+            out[x * 3 + c] = (unsigned char)((top[left + c] + top[right + c] + bottom[left + c] + bottom[right + c] + 2) / 4);
+    }
+}
+
+// Cuts every level's tiles from rows as they arrive, level 0's from the decoder and each later
+// level's from halving pairs of rows of the one before. A level only holds the strip of tile rows
+// it's filling, so memory follows the image's width rather than its area.
+class StripWriter {
+public:
+    StripWriter(const std::vector<TilePyramid::Level>& levels, std::ofstream& out, std::vector<TileEntry>& table, uint64_t offset)
+        : levels(levels), out(out), table(table), offset(offset), strips(levels.size()), rowsSeen(levels.size(), 0),
+          halved(levels.size()), tile(size_t(PyramidTileSize) * PyramidTileSize * 3) {
+        for (size_t l = 0; l < levels.size(); l++) {
+            strips[l].resize(size_t(levels[l].width) * std::min(levels[l].height, PyramidTileSize) * 3);
+            if (l + 1 < levels.size())
+                halved[l].resize(size_t(levels[l + 1].width) * 3);
+        }
+    }
+
+    bool AddRow(size_t l, const unsigned char* rgb) {
+        const auto& level = levels[l];
+        int y = rowsSeen[l]++;
+        int inStrip = y % PyramidTileSize;
+        size_t rowBytes = size_t(level.width) * 3;
+        unsigned char* stripRow = strips[l].data() + inStrip * rowBytes;
+        std::memcpy(stripRow, rgb, rowBytes);
+
+        bool lastRow = y == level.height - 1;
+        if ((inStrip == PyramidTileSize - 1 || lastRow) && !WriteStrip(l, y / PyramidTileSize, inStrip + 1))
+            return false;
+        if (l + 1 == levels.size())
+            return true;
+
+        // Rows pair up from the top, the tile size is even so a pair never straddles two strips.
+        // An odd last row is averaged with itself.
+        if (y % 2 == 0 && !lastRow)
+            return true;
+        const unsigned char* top = y % 2 == 0 ? stripRow : stripRow - rowBytes;
+        HalveRows(top, stripRow, level.width, levels[l + 1].width, halved[l].data());
+        return AddRow(l + 1, halved[l].data());
+    }
+
+    uint64_t Offset() const { return offset; }
+
+private:
+    bool WriteStrip(size_t l, int row, int stripRows) {
+        const auto& level = levels[l];
+        for (int column = 0; column < level.columns; column++) {
+            int x0 = column * PyramidTileSize;
+            int tileWidth = std::min(PyramidTileSize, level.width - x0);
+            for (int y = 0; y < stripRows; y++)
+                std::memcpy(tile.data() + size_t(y) * tileWidth * 3, strips[l].data() + (size_t(y) * level.width + x0) * 3, size_t(tileWidth) * 3);
+
+            if (!EncodeJpeg(tile.data(), tileWidth, stripRows, TileQuality, jpeg))
+                return false;
+
+            auto& entry = table[level.firstTile + size_t(row) * level.columns + column];
+            entry.offset = offset;
+            entry.length = uint32_t(jpeg.size());
+            out.write(reinterpret_cast<const char*>(jpeg.data()), std::streamsize(jpeg.size()));
+            offset += jpeg.size();
+        }
+        return bool(out);
+    }
+
+    const std::vector<TilePyramid::Level>& levels;
+    std::ofstream& out;
+    std::vector<TileEntry>& table;
+    uint64_t offset;
+    std::vector<std::vector<unsigned char>> strips;
+    std::vector<int> rowsSeen;
+    std::vector<std::vector<unsigned char>> halved;
+    std::vector<unsigned char> tile;
+    std::vector<unsigned char> jpeg;
+};
+
+}
+
+std::vector<TilePyramid::Level> PyramidLevels(int width, int height) {
+    std::vector<TilePyramid::Level> levels;
+    uint32_t firstTile = 0;
+
+    while (true) {
+        TilePyramid::Level level;
+        level.width = width;
+        level.height = height;
+        level.columns = (width + PyramidTileSize - 1) / PyramidTileSize;
+        level.rows = (height + PyramidTileSize - 1) / PyramidTileSize;
+        level.firstTile = firstTile;
+        levels.push_back(level);
+
+        firstTile += uint32_t(level.columns * level.rows);
+        if (width <= PyramidTileSize && height <= PyramidTileSize)
+            return levels;
+
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+}
+
+std::string PyramidFileName(const std::string& folder, const std::string& source) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.pyr", (unsigned long long)HashBytes(source.data(), source.size()));
+    return folder + "/" + name;
+}
+
+bool TilePyramid::Open(const std::string& fileName, uint64_t sourceSize, int64_t sourceModified) {
+    levels.clear();
+    // Unmapped again on failure so a stale pyramid can be replaced
+    if (!mapping.Open(fileName) || mapping.Size() < sizeof(PyramidHeader)) {
+        mapping.Close();
+        return false;
+    }
+
+    PyramidHeader header;
+    std::memcpy(&header, mapping.Data(), sizeof(header));
+    if (std::memcmp(header.magic, PyramidMagic, sizeof(PyramidMagic)) != 0 || header.version != PyramidVersion ||
+        header.tileSize != uint32_t(PyramidTileSize) || header.width == 0 || header.height == 0 ||
+        header.sourceSize != sourceSize || header.sourceModified != sourceModified) {
+        mapping.Close();
+        return false;
+    }
+
+    auto expected = PyramidLevels(int(header.width), int(header.height));
+    const auto& top = expected.back();
+    uint32_t expectedTiles = top.firstTile + uint32_t(top.columns * top.rows);
+    if (header.levelCount != expected.size() || header.tileCount != expectedTiles ||
+        mapping.Size() < sizeof(PyramidHeader) + size_t(expectedTiles) * sizeof(TileEntry)) {
+        mapping.Close();
+        return false;
+    }
+
+    levels = std::move(expected);
+    return true;
+}
+
+bool TilePyramid::Tile(int level, int column, int row, const unsigned char*& data, size_t& length) const {
+    if (level < 0 || level >= int(levels.size()))
+        return false;
+
+    const Level& l = levels[level];
+    if (column < 0 || column >= l.columns || row < 0 || row >= l.rows)
+        return false;
+
+    TileEntry entry;
+    size_t index = l.firstTile + size_t(row) * l.columns + column;
+    std::memcpy(&entry, mapping.Data() + sizeof(PyramidHeader) + index * sizeof(TileEntry), sizeof(entry));
+    if (entry.offset > mapping.Size() || entry.length > mapping.Size() - entry.offset)
+        return false;
+
+    data = mapping.Data() + entry.offset;
+    length = entry.length;
+    return true;
+}
+
+bool BuildTilePyramid(const std::string& source, uint64_t sourceSize, int64_t sourceModified, const std::string& fileName) {
+    MappedFile file;
+    if (!file.Open(source))
+        return false;
+    ImageFormat format = SniffImageFormat(source);
+
+    // Baseline JPEG and non-interlaced PNG are read a row at a time, so they can be any size.
+    // Anything else stb decodes whole, which caps it at 2GB of pixels.
+    ScanlineDecoder rows;
+    DecodedImage decoded;
+    bool streamed = rows.Open(file.Data(), file.Size(), format);
+    if (!streamed && !DecodeImage(file.Data(), file.Size(), format, decoded, 3))
+        return false;
+    int width = streamed ? rows.Width() : decoded.width;
+    int height = streamed ? rows.Height() : decoded.height;
+
+    auto levels = PyramidLevels(width, height);
+    const auto& top = levels.back();
+    uint32_t tileCount = top.firstTile + uint32_t(top.columns * top.rows);
+
+    std::error_code error;
+    fs::path path = fs::u8path(fileName);
+    fs::create_directories(path.parent_path(), error);
+    fs::path temporary = path;
+    temporary += ".tmp";
+
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    PyramidHeader header = {};
+    std::memcpy(header.magic, PyramidMagic, sizeof(PyramidMagic));
+    header.version = PyramidVersion;
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.tileSize = uint32_t(PyramidTileSize);
+    header.levelCount = uint32_t(levels.size());
+    header.tileCount = tileCount;
+    header.sourceSize = sourceSize;
+    header.sourceModified = sourceModified;
+
+    // The table is written last, once the tile offsets are known
+    std::vector<TileEntry> table(tileCount, TileEntry{});
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(table.size() * sizeof(TileEntry)));
+
+    // Tiles of every level are written as soon as their strip fills, in whatever order that is
+    StripWriter writer(levels, out, table, sizeof(header) + table.size() * sizeof(TileEntry));
+    std::vector<unsigned char> line(streamed ? size_t(width) * 3 : 0);
+    bool written = true;
+    for (int y = 0; y < height && written; y++) {
+        const unsigned char* pixels = line.data();
+        if (!streamed)
+            pixels = decoded.pixels.get() + size_t(y) * width * 3;
+        else if (!rows.ReadRows(line.data(), 1))
+            written = false;
+        written = written && writer.AddRow(0, pixels);
+    }
+
+    if (written) {
+        out.seekp(sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(table.size() * sizeof(TileEntry)));
+    }
+    out.close();
+    if (!written || !out) {
+        fs::remove(temporary, error);
+        return false;
+    }
+
+    fs::rename(temporary, path, error);
+    return !error;
+}
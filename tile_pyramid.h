@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Edge of the square tiles pyramids are cut into
+constexpr int PyramidTileSize = 256;
+
+// Multi-resolution tile pyramid of one source image, for zooming into images far larger than the window
+//
+// Level 0 is the full image and each level after it halves the one before, up to the first
+// level that fits in a single tile. Tiles are JPEG. Layout: a 48 byte header ("IVZP", version,
+// width, height, tile size, level count, tile count, source size and mtime), a table with the
+// (offset, length) of every tile, level by level in row order, then the JPEG data.
+class TilePyramid {
+public:
+    struct Level {
+        int width;
+        int height;
+        int columns;
+        int rows;
+        uint32_t firstTile;
+    };
+
+    // Map a pyramid, false if it's missing, damaged or built from another version of the source
+    bool Open(const std::string& fileName, uint64_t sourceSize, int64_t sourceModified);
+
+    int Width() const { return levels.empty() ? 0 : levels[0].width; }
+    int Height() const { return levels.empty() ? 0 : levels[0].height; }
+    const std::vector<Level>& Levels() const { return levels; }
+
+    // JPEG bytes of one tile, pointing into the mapping
+    bool Tile(int level, int column, int row, const unsigned char*& data, size_t& length) const;
+
+private:
+    MappedFile mapping;
+    std::vector<Level> levels;
+};
+
+// Level sizes and tile counts for an image, shared by the builder and the reader
+std::vector<TilePyramid::Level> PyramidLevels(int width, int height);
+
+// Where the pyramid of a source file is kept inside folder
+std::string PyramidFileName(const std::string& folder, const std::string& source);
+
+// Decode source and write its pyramid, through a temporary file so a reader never maps half of one
+// Baseline JPEG and non-interlaced PNG stream through a strip of tile rows per level, whatever their size
+bool BuildTilePyramid(const std::string& source, uint64_t sourceSize, int64_t sourceModified, const std::string& fileName);